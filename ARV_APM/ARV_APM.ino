@@ -83,10 +83,14 @@ version 2.1 of the License, or (at your option) any later version.
 //#include <AP_RCMapper.h>        // RC input mapping library
 #include <SITL.h>
 #include <AP_Scheduler.h>       // main loop scheduler
+#include <AP_Histogram.h>       // main loop timing histograms
 #include <stdarg.h>
 
 #include <AP_HAL_AVR.h>
 #include <AP_HAL_AVR_SITL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+#include <AP_HAL_AVR_SITL_Private.h>    // for naming the EEPROM regions
+#endif
 #include <AP_HAL_PX4.h>
 #include <AP_HAL_Empty.h>
 #include "compat.h"
@@ -112,9 +116,19 @@ const AP_HAL::HAL& hal = AP_HAL_BOARD_DRIVER;
 AP_Param param_loader(var_info, WP_START_BYTE);
 
 ////////////////////////////////////////////////////////////////////////////////
-// the rate we run the main loop at
+// the rate we run the main loop at. These are set from LOOP_RATE by
+// init_loop_rate()
 ////////////////////////////////////////////////////////////////////////////////
-static const AP_InertialSensor::Sample_rate ins_sample_rate = AP_InertialSensor::RATE_50HZ;
+static AP_InertialSensor::Sample_rate ins_sample_rate = AP_InertialSensor::RATE_50HZ;
+
+// milliseconds between runs of fast_loop()
+static uint8_t fast_loop_period_ms = 20;
+
+// number of runs of fast_loop() per 20ms scheduler tick, and which of
+// them we are on. The 50Hz work in fast_loop() is done when the phase
+// is zero
+static uint8_t loops_per_tick = 1;
+static uint8_t fast_loop_phase;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Parameters
@@ -157,6 +171,15 @@ static DataFlash_File DataFlash("/fs/microsd/APM/logs");
 DataFlash_Empty DataFlash;
 #endif
 
+// state of the library messages when they are logged as deltas
+static DataFlash_Delta<struct log_GPS> gps_delta;
+static DataFlash_Delta<struct log_IMU> imu_delta;
+
+#if BLACKBOX == ENABLED
+// 50Hz records kept in RAM, and written to the log around events
+static DataFlash_BlackBox blackbox(DataFlash);
+#endif
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // Sensors
@@ -417,6 +440,7 @@ static struct {
 
 static struct {
     uint16_t cast_depth_m;
+    uint32_t cast_start_time_ms;
     uint32_t cast_end_time_ms;
     bool     cast_done;
     bool     cast_snagged;      // Snag detected
@@ -547,6 +571,40 @@ static uint8_t 	gps_fix_count = 0;
 // Currently used to record the number of GCS heartbeat messages received
 static int16_t pmTest1 = 0;
 
+// Microsecond timing of each main loop period over the performance
+// monitoring interval: how far the fast loop start is from its
+// period, the time in fast_loop(), the time in scheduler.run() and
+// the time left over
+static AP_Histogram perf_jitter;
+static AP_Histogram perf_fast_loop;
+static AP_Histogram perf_scheduler;
+static AP_Histogram perf_idle;
+// micros() at the start of the last fast loop, and the time spent in
+// fast_loop() and scheduler.run() since then
+static uint32_t perf_loop_start_us;
+static uint32_t perf_fast_loop_us;
+static uint32_t perf_scheduler_us;
+// the timing of the last completed performance monitoring interval,
+// which is logged as PM2 and sent to the GCS. Idle time reports its
+// 1st percentile and minimum rather than its top end, as the margin
+// we have is how little idle time there can be
+struct PACKED perf_summary {
+    uint16_t loops;
+    uint16_t jitter_p50;
+    uint16_t jitter_p99;
+    uint16_t jitter_max;
+    uint16_t fast_loop_p50;
+    uint16_t fast_loop_p99;
+    uint16_t fast_loop_max;
+    uint16_t scheduler_p50;
+    uint16_t scheduler_p99;
+    uint16_t scheduler_max;
+    uint16_t idle_p50;
+    uint16_t idle_p1;
+    uint16_t idle_min;
+};
+static struct perf_summary perf_summary;
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // System Timers
@@ -570,25 +628,26 @@ static float 			load;
 /*
   scheduler table - all regular tasks apart from the fast_loop()
   should be listed here, along with how often they should be called
-  (in 20ms units) and the maximum time they are expected to take (in
-  microseconds)
+  (in 20ms units), the maximum time they are expected to take (in
+  microseconds) and their priority when SCHED_MODE picks tasks by
+  deadline
  */
 static const AP_Scheduler::Task scheduler_tasks[] PROGMEM = {
-    { update_GPS,             5,   2500 },
-    { navigate,               5,   1600 },
-    { update_compass,         5,   2000 },
-    { update_commands,        5,   1000 },
-    { update_logging,         5,   1000 },
-    { read_battery,           5,   1000 },
-    { read_receiver_rssi,     5,   1000 },
-    { read_trim_switch,       5,   1000 },
-    { read_control_switch,   15,   1000 },
-    { update_events,         15,   1000 },
-    { check_usb_mux,         15,   1000 },
-    { mount_update,           1,    500 },
-    { failsafe_check,         5,    500 },
-    { compass_accumulate,     1,    900 },
-    { one_second_loop,       50,   3000 }
+    { update_GPS,             5,   2500, 0 },
+    { navigate,               5,   1600, 0 },
+    { update_compass,         5,   2000, 0 },
+    { update_commands,        5,   1000, 0 },
+    { update_logging,         5,   1000, 0 },
+    { read_battery,           5,   1000, 0 },
+    { read_receiver_rssi,     5,   1000, 0 },
+    { read_trim_switch,       5,   1000, 0 },
+    { read_control_switch,   15,   1000, 1 },
+    { update_events,         15,   1000, 0 },
+    { check_usb_mux,         15,   1000, 0 },
+    { mount_update,           1,    500, 0 },
+    { failsafe_check,         5,    500, 2 },
+    { compass_accumulate,     1,    900, 0 },
+    { one_second_loop,       50,   3000, 1 }
 };
 
 
@@ -620,7 +679,7 @@ void loop()
 {
     uint32_t timer = millis();
 
-    // We want this to execute at 50Hz, but synchronised with the gyro/accel
+    // We want this to execute at LOOP_RATE, but synchronised with the gyro/accel
     uint16_t num_samples = ins.num_samples_available();
     if (num_samples >= 1) {
 		delta_ms_fast_loop	= timer - fast_loopTimer;
@@ -630,26 +689,55 @@ void loop()
 
 		mainLoop_count++;
 
+        uint32_t start_us = micros();
+        perf_loop_update(start_us);
+
 		// Execute the fast loop
 		// ---------------------
 		fast_loop();
 
-        // tell the scheduler one tick has passed
-        scheduler.tick();
+        perf_fast_loop_us = micros() - start_us;
+
+        // tell the scheduler when a 20ms tick has passed
+        if (++fast_loop_phase >= loops_per_tick) {
+            fast_loop_phase = 0;
+            scheduler.tick();
+        }
 		fast_loopTimeStamp = millis();
     } else {
         uint16_t dt = timer - fast_loopTimer;
-        if (dt < 20) {
-            uint16_t time_to_next_loop = 20 - dt;
+        if (dt < fast_loop_period_ms) {
+            uint16_t time_to_next_loop = fast_loop_period_ms - dt;
+            uint32_t start_us = micros();
             scheduler.run(time_to_next_loop * 1000U);
+            perf_scheduler_us += micros() - start_us;
         }
     }
 }
 
-// Main loop 50Hz
+/*
+  add the timing of the loop period that has just ended to the
+  performance histograms. now is the start time of the next fast loop
+ */
+static void perf_loop_update(uint32_t now)
+{
+    if (perf_loop_start_us != 0) {
+        uint32_t period = now - perf_loop_start_us;
+        uint32_t expected = fast_loop_period_ms * 1000UL;
+        perf_jitter.add(period > expected ? period - expected : expected - period);
+        perf_fast_loop.add(perf_fast_loop_us);
+        perf_scheduler.add(perf_scheduler_us);
+        uint32_t busy = perf_fast_loop_us + perf_scheduler_us;
+        perf_idle.add(period > busy ? period - busy : 0);
+    }
+    perf_loop_start_us = now;
+    perf_scheduler_us = 0;
+}
+
+// Main loop, at LOOP_RATE
 static void fast_loop()
 {
-	// This is the fast loop - we want it to execute at 50Hz if possible
+	// This is the fast loop - we want it to execute at LOOP_RATE if possible
 	// -----------------------------------------------------------------
 	if (delta_ms_fast_loop > G_Dt_max)
 		G_Dt_max = delta_ms_fast_loop;
@@ -669,17 +757,24 @@ static void fast_loop()
 
 	ahrs.update();
 
-    read_sonars();
-    read_winch();
+    if (fast_loop_phase == 0) {
+        // these count readings to debounce them, so stay at 50Hz
+        read_sonars();
+        read_winch();
+    }
 
 	// uses the yaw from the DCM to give more accurate turns
 	calc_bearing_error();
 
-    if (g.log_bitmask & MASK_LOG_ATTITUDE_FAST)
-        Log_Write_Attitude();
+    if (fast_loop_phase == 0) {
+        // logging stays at 50Hz whatever the loop rate, so the log
+        // volume and the black box duration don't depend on LOOP_RATE
+        if (g.log_bitmask & MASK_LOG_ATTITUDE_FAST)
+            Log_Write_Attitude();
 
-    if (g.log_bitmask & MASK_LOG_IMU)
-        DataFlash.Log_Write_IMU(&ins);
+        if (g.log_bitmask & MASK_LOG_IMU)
+            DataFlash.Log_Write_IMU(&ins, &imu_delta, (g.log_delta & MASK_LOG_IMU) != 0);
+    }
 
 	// custom code/exceptions for flight modes
 	// ---------------------------------------
@@ -689,8 +784,17 @@ static void fast_loop()
 	// ------------------------------
 	set_servos();
 
+#if BLACKBOX == ENABLED
+    if (fast_loop_phase == 0) {
+        Log_Write_BlackBox();
+    }
+#endif
+
     gcs_update();
-    gcs_data_stream_send();
+    if (fast_loop_phase == 0) {
+        // the stream rates count down at 50Hz
+        gcs_data_stream_send();
+    }
 }
 
 /*
@@ -785,8 +889,12 @@ static void one_second_loop(void)
 
     // write perf data every 20s
     if (counter == 20) {
-        if (g.log_bitmask & MASK_LOG_PM)
+        update_perf_summary();
+        if (g.log_bitmask & MASK_LOG_PM) {
             Log_Write_Performance();
+            Log_Write_Sched();
+            Log_Write_Perf2();
+        }
         resetPerfData();
     }
 
@@ -808,7 +916,8 @@ static void update_GPS(void)
     if (g_gps->last_message_time_ms() != last_gps_reading) {
         last_gps_reading = g_gps->last_message_time_ms();
         if (g.log_bitmask & MASK_LOG_GPS) {
-            DataFlash.Log_Write_GPS(g_gps, current_loc.alt);
+            DataFlash.Log_Write_GPS(g_gps, current_loc.alt, &gps_delta,
+                                    (g.log_delta & MASK_LOG_GPS) != 0);
         }
     }
 
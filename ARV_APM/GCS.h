@@ -112,6 +112,7 @@ public:
     void    data_stream_send(void);
 	void    queued_param_send();
 	void    queued_waypoint_send();
+    void    queued_log_send();
 
     static const struct AP_Param::GroupInfo var_info[];
 
@@ -132,12 +133,20 @@ public:
     // see if we should send a stream now. Called at 50Hz
     bool stream_trigger(enum streams stream_num);
 
-	// this costs us 51 bytes per instance, but means that low priority
-	// messages don't block the CPU
-    mavlink_statustext_t pending_status;
+    // send the requested, allocated and achieved stream rates
+    void send_stream_stats(void);
+
+    // queue a low priority text message, and send as many queued
+    // texts as the link allows. send_queued_text() returns true if
+    // some are still waiting
+    void queue_text(gcs_severity severity, const char *str);
+    bool send_queued_text(void);
 
     // call to reset the timeout window for entering the cli
     void reset_cli_timeout();
+
+    // true while log list entries or log data are being sent
+    bool log_sending(void) const { return _log_list_next != 0 || _log_num_ranges != 0; }
 private:
 	void 	handleMessage(mavlink_message_t * msg);
 
@@ -156,6 +165,24 @@ private:
                                                          // queued send
     uint32_t                    _queued_parameter_send_time_ms;
 
+    // log download. The list entries still to send, and the log being
+    // sent with the ranges of it the GCS has asked for, oldest first
+    void handle_log_request(const mavlink_data16_t &packet);
+    void log_download_end(void);
+    uint16_t _log_list_first;
+    uint16_t _log_list_next;
+    uint16_t _log_list_last;
+    uint16_t _log_num;
+    uint32_t _log_size;
+    struct log_range {
+        uint32_t ofs;
+        uint32_t count;
+    } _log_ranges[LOG_DOWNLOAD_MAX_RANGES];
+    uint8_t _log_num_ranges;
+    uint16_t _log_credit;
+    uint32_t _log_send_time_ms;
+    uint32_t _log_request_time_ms;
+
 	/// Count the number of reportable parameters.
 	///
     /// Not all parameters can be reported via MAVlink.  We count the number
@@ -211,6 +238,41 @@ private:
     // number of extra ticks to add to slow things down for the radio
     uint8_t stream_slowdown;
 
+    // stream bandwidth allocation. Each stream gets the 50Hz ticks
+    // between sends that fit its rate into the bytes per second left
+    // by the streams before it in priority order, zero if it gets
+    // none. The link capacity is the nominal rate of the port, or the
+    // measured throughput when the tx buffer is backing up
+    void stream_budget_update(void);
+    uint8_t stream_interval[NUM_STREAMS];
+    uint8_t stream_count[NUM_STREAMS];
+    uint8_t stream_achieved[NUM_STREAMS];
+    uint8_t _stream_share;
+    uint16_t _link_capacity;
+    uint16_t _stream_budget;
+    uint16_t _txspace_last;
+    uint16_t _txspace_max;
+    uint32_t _tx_bytes_last;
+    uint32_t _stream_budget_ms;
+
+    // the nominal bytes per second of the port
+    uint16_t link_nominal_rate(void) const;
+
+    // low priority text messages waiting to be sent, oldest first.
+    // A text the same as the newest one waiting is counted as a
+    // repeat of it rather than queued again, and when the queue is
+    // full the oldest text is dropped. The texts get the share of the
+    // link the streams leave free
+    struct queued_text {
+        mavlink_statustext_t s;
+        uint8_t repeats;
+    } _text_queue[MAVLINK_TEXT_QUEUE_LEN];
+    uint8_t _text_next;
+    uint8_t _text_count;
+    uint16_t _text_dropped;
+    uint16_t _text_credit;
+    uint32_t _text_send_time_ms;
+
     // millis value to calculate cli timeout relative to.
     // exists so we can separate the cli entry time from the system start time
     uint32_t _cli_timeout;
@@ -446,20 +446,62 @@ static void NOINLINE send_rangefinder(mavlink_channel_t chan)
         voltage);
 }
 
-static void NOINLINE send_current_waypoint(mavlink_channel_t chan)
+/*
+  scheduler task statistics, sent as the data of a DATA32 message
+ */
+struct PACKED sched_stats_data {
+    uint8_t  task;
+    uint8_t  num_tasks;
+    uint16_t max_time_micros;
+    uint32_t runs;
+    uint16_t skips;
+    uint16_t slips;
+    uint16_t overruns;
+    uint16_t min_micros;
+    uint16_t mean_micros;
+    uint16_t max_micros;
+    uint16_t hist[AP_SCHEDULER_HIST_BINS];
+};
+
+// send the statistics of one scheduler task, moving on to the next
+// task each time it is called
+static void NOINLINE send_sched_stats(mavlink_channel_t chan)
 {
-    mavlink_msg_mission_current_send(
-        chan,
-        g.command_index);
+    static uint8_t next_task[2];
+    uint8_t i = next_task[chan == MAVLINK_COMM_0?0:1];
+    if (i >= scheduler.num_tasks()) {
+        i = 0;
+    }
+    const AP_Scheduler::TaskStats &s = scheduler.task_stats(i);
+    struct sched_stats_data d;
+    d.task            = i;
+    d.num_tasks       = scheduler.num_tasks();
+    d.max_time_micros = scheduler.task_max_time(i);
+    d.runs            = s.runs;
+    d.skips           = s.skips;
+    d.slips           = s.slips;
+    d.overruns        = s.overruns;
+    d.min_micros      = s.runs?s.min_micros:0;
+    d.mean_micros     = scheduler.task_mean_micros(i);
+    d.max_micros      = s.max_micros;
+    memcpy(d.hist, s.hist, sizeof(d.hist));
+    mavlink_msg_data32_send(chan, DATAMSG_TYPE_SCHED_STATS, sizeof(d), (const uint8_t *)&d);
+    next_task[chan == MAVLINK_COMM_0?0:1] = i + 1;
 }
 
-static void NOINLINE send_statustext(mavlink_channel_t chan)
+// send the main loop timing of the last performance monitoring interval
+static void NOINLINE send_perf_summary(mavlink_channel_t chan)
 {
-    mavlink_statustext_t *s = (chan == MAVLINK_COMM_0?&gcs0.pending_status:&gcs3.pending_status);
-    mavlink_msg_statustext_send(
+    uint8_t buf[32] = {};
+    memcpy(buf, &perf_summary, sizeof(perf_summary));
+    mavlink_msg_data32_send(chan, DATAMSG_TYPE_PERF_SUMMARY, sizeof(perf_summary), buf);
+}
+
+static void NOINLINE send_current_waypoint(mavlink_channel_t chan)
+{
+    mavlink_msg_mission_current_send(
         chan,
-        s->severity,
-        s->text);
+        g.command_index);
 }
 
 // are we still delaying telemetry to try to avoid Xbee bricking?
@@ -488,6 +530,87 @@ static bool telemetry_delayed(mavlink_channel_t chan)
 }
 
 
+/*
+  messages that can't be sent straight away are deferred, as a bitmask
+  of ap_message ids for each channel. A message that is already
+  deferred isn't queued again, as it is sent with the latest data when
+  it goes. The deferred messages are sent most important first, so
+  text, heartbeats and mission transfers get through a busy link
+ */
+#define MAX_DEFERRED_MESSAGES MSG_RETRY_DEFERRED
+#define MSG_BIT(id) (1UL<<(id))
+
+// fails to compile if there are too many ap_message ids for the bitmask
+typedef char mavlink_deferred_ids_fit[(MSG_RETRY_DEFERRED < 32) ? 1 : -1];
+#define MSG_PRIORITY_CLASSES 3
+static const uint32_t mavlink_priority_mask[MSG_PRIORITY_CLASSES] PROGMEM = {
+    // critical
+    MSG_BIT(MSG_HEARTBEAT) | MSG_BIT(MSG_STATUSTEXT) | MSG_BIT(MSG_NEXT_WAYPOINT),
+    // navigation and status
+    MSG_BIT(MSG_EXTENDED_STATUS1) | MSG_BIT(MSG_LOCATION) | MSG_BIT(MSG_CURRENT_WAYPOINT) |
+    MSG_BIT(MSG_NAV_CONTROLLER_OUTPUT) | MSG_BIT(MSG_GPS_RAW) | MSG_BIT(MSG_ATTITUDE) |
+    MSG_BIT(MSG_VFR_HUD) | MSG_BIT(MSG_EXTENDED_STATUS2) | MSG_BIT(MSG_NEXT_PARAM),
+    // everything else
+    0xFFFFFFFFUL
+};
+
+static struct mavlink_queue {
+    uint32_t pending;
+    // times each message has been deferred, and times it was asked
+    // for again while already deferred. Those requests are merged
+    // with the pending one, so nothing is lost
+    uint16_t deferred[MAX_DEFERRED_MESSAGES];
+    uint16_t coalesced[MAX_DEFERRED_MESSAGES];
+} mavlink_queue[2];
+
+// the priority class of a message, 0 being the most important
+static uint8_t mavlink_message_priority(enum ap_message id)
+{
+    uint8_t p;
+    for (p=0; p<MSG_PRIORITY_CLASSES-1; p++) {
+        if (pgm_read_dword(&mavlink_priority_mask[p]) & MSG_BIT(id)) {
+            break;
+        }
+    }
+    return p;
+}
+
+/*
+  deferred message counts of one message id, sent as the data of a
+  DATA16 message
+ */
+struct PACKED defer_stats_data {
+    uint8_t  id;
+    uint8_t  num_ids;
+    uint8_t  priority;
+    uint8_t  pending;
+    uint16_t deferred;
+    uint16_t coalesced;
+};
+
+// send the deferred message counts of one message id, moving on to
+// the next id each time it is called
+static void NOINLINE send_defer_stats(mavlink_channel_t chan)
+{
+    static uint8_t next_id[2];
+    const struct mavlink_queue *q = &mavlink_queue[(uint8_t)chan];
+    uint8_t i = next_id[(uint8_t)chan];
+    if (i >= MAX_DEFERRED_MESSAGES) {
+        i = 0;
+    }
+    struct defer_stats_data d;
+    d.id       = i;
+    d.num_ids  = MAX_DEFERRED_MESSAGES;
+    d.priority = mavlink_message_priority((enum ap_message)i);
+    d.pending  = (q->pending & MSG_BIT(i)) ? 1 : 0;
+    d.deferred = q->deferred[i];
+    d.coalesced = q->coalesced[i];
+    uint8_t buf[16] = {};
+    memcpy(buf, &d, sizeof(d));
+    mavlink_msg_data16_send(chan, DATAMSG_TYPE_DEFER_STATS, sizeof(d), buf);
+    next_id[(uint8_t)chan] = i + 1;
+}
+
 // try to send a message, return false if it won't fit in the serial tx buffer
 static bool mavlink_try_send_message(mavlink_channel_t chan, enum ap_message id, uint16_t packet_drops)
 {
@@ -588,10 +711,29 @@ static bool mavlink_try_send_message(mavlink_channel_t chan, enum ap_message id,
         }
         break;
 
-    case MSG_STATUSTEXT:
+    case MSG_NEXT_LOG:
+        CHECK_PAYLOAD_SIZE(DATA96);
+        if (chan == MAVLINK_COMM_0) {
+            gcs0.queued_log_send();
+        } else if (gcs3.initialised) {
+            gcs3.queued_log_send();
+        }
+        break;
+
+    case MSG_STATUSTEXT: {
         CHECK_PAYLOAD_SIZE(STATUSTEXT);
-        send_statustext(chan);
+        bool more = false;
+        if (chan == MAVLINK_COMM_0) {
+            more = gcs0.send_queued_text();
+        } else if (gcs3.initialised) {
+            more = gcs3.send_queued_text();
+        }
+        if (more) {
+            // the rest wait for the next turn of the deferred messages
+            mavlink_queue[(uint8_t)chan].pending |= MSG_BIT(MSG_STATUSTEXT);
+        }
         break;
+    }
 
     case MSG_AHRS:
         CHECK_PAYLOAD_SIZE(AHRS);
@@ -613,6 +755,30 @@ static bool mavlink_try_send_message(mavlink_channel_t chan, enum ap_message id,
         send_rangefinder(chan);
         break;
 
+    case MSG_SCHED_STATS:
+        CHECK_PAYLOAD_SIZE(DATA32);
+        send_sched_stats(chan);
+        break;
+
+    case MSG_PERF_SUMMARY:
+        CHECK_PAYLOAD_SIZE(DATA32);
+        send_perf_summary(chan);
+        break;
+
+    case MSG_STREAM_STATS:
+        CHECK_PAYLOAD_SIZE(DATA32);
+        if (chan == MAVLINK_COMM_0) {
+            gcs0.send_stream_stats();
+        } else if (gcs3.initialised) {
+            gcs3.send_stream_stats();
+        }
+        break;
+
+    case MSG_DEFER_STATS:
+        CHECK_PAYLOAD_SIZE(DATA16);
+        send_defer_stats(chan);
+        break;
+
     case MSG_RETRY_DEFERRED:
         break; // just here to prevent a warning
 	}
@@ -620,63 +786,62 @@ static bool mavlink_try_send_message(mavlink_channel_t chan, enum ap_message id,
 }
 
 
-#define MAX_DEFERRED_MESSAGES MSG_RETRY_DEFERRED
-static struct mavlink_queue {
-    enum ap_message deferred_messages[MAX_DEFERRED_MESSAGES];
-    uint8_t next_deferred_message;
-    uint8_t num_deferred_messages;
-} mavlink_queue[2];
+// send as many deferred messages as will fit, most important first.
+// Returns the priority class of the message that didn't fit, or
+// MSG_PRIORITY_CLASSES if they all went
+static uint8_t mavlink_send_deferred(mavlink_channel_t chan, uint16_t packet_drops)
+{
+    struct mavlink_queue *q = &mavlink_queue[(uint8_t)chan];
+
+    for (uint8_t p=0; p<MSG_PRIORITY_CLASSES && q->pending != 0; p++) {
+        uint32_t m = q->pending & pgm_read_dword(&mavlink_priority_mask[p]);
+        for (uint8_t id=0; m != 0; id++, m >>= 1) {
+            if (!(m & 1)) {
+                continue;
+            }
+            // clear it first, as sending it may defer it again
+            q->pending &= ~MSG_BIT(id);
+            if (!mavlink_try_send_message(chan, (enum ap_message)id, packet_drops)) {
+                // keep the rest waiting behind it
+                q->pending |= MSG_BIT(id);
+                return p;
+            }
+        }
+    }
+    return MSG_PRIORITY_CLASSES;
+}
 
 // send a message using mavlink
 static void mavlink_send_message(mavlink_channel_t chan, enum ap_message id, uint16_t packet_drops)
 {
-    uint8_t i, nextid;
     struct mavlink_queue *q = &mavlink_queue[(uint8_t)chan];
 
     // see if we can send the deferred messages, if any
-    while (q->num_deferred_messages != 0) {
-        if (!mavlink_try_send_message(chan,
-                                      q->deferred_messages[q->next_deferred_message],
-                                      packet_drops)) {
-            break;
-        }
-        q->next_deferred_message++;
-        if (q->next_deferred_message == MAX_DEFERRED_MESSAGES) {
-            q->next_deferred_message = 0;
-        }
-        q->num_deferred_messages--;
+    uint8_t blocked = MSG_PRIORITY_CLASSES;
+    if (q->pending != 0) {
+        blocked = mavlink_send_deferred(chan, packet_drops);
     }
 
     if (id == MSG_RETRY_DEFERRED) {
         return;
     }
 
-    // this message id might already be deferred
-    for (i=0, nextid = q->next_deferred_message; i < q->num_deferred_messages; i++) {
-        if (q->deferred_messages[nextid] == id) {
-            // its already deferred, discard
-            return;
-        }
-        nextid++;
-        if (nextid == MAX_DEFERRED_MESSAGES) {
-            nextid = 0;
-        }
+    if (q->pending & MSG_BIT(id)) {
+        // its already deferred, and will be sent with the latest data
+        q->coalesced[id]++;
+        return;
     }
 
-    if (q->num_deferred_messages != 0 ||
-        !mavlink_try_send_message(chan, id, packet_drops)) {
-        // can't send it now, so defer it
-        if (q->num_deferred_messages == MAX_DEFERRED_MESSAGES) {
-            // the defer buffer is full, discard
-            return;
-        }
-        nextid = q->next_deferred_message + q->num_deferred_messages;
-        if (nextid >= MAX_DEFERRED_MESSAGES) {
-            nextid -= MAX_DEFERRED_MESSAGES;
-        }
-        q->deferred_messages[nextid] = id;
-        q->num_deferred_messages++;
+    // send it now unless something at least as important is still
+    // waiting for space
+    if (mavlink_message_priority(id) < blocked &&
+        mavlink_try_send_message(chan, id, packet_drops)) {
+        return;
     }
+
+    // can't send it now, so defer it
+    q->pending |= MSG_BIT(id);
+    q->deferred[id]++;
 }
 
 void mavlink_send_text(mavlink_channel_t chan, gcs_severity severity, const char *str)
@@ -687,9 +852,11 @@ void mavlink_send_text(mavlink_channel_t chan, gcs_severity severity, const char
 
     if (severity == SEVERITY_LOW) {
         // send via the deferred queuing system
-        mavlink_statustext_t *s = (chan == MAVLINK_COMM_0?&gcs0.pending_status:&gcs3.pending_status);
-        s->severity = (uint8_t)severity;
-        strncpy((char *)s->text, str, sizeof(s->text));
+        if (chan == MAVLINK_COMM_0) {
+            gcs0.queue_text(severity, str);
+        } else {
+            gcs3.queue_text(severity, str);
+        }
         mavlink_send_message(chan, MSG_STATUSTEXT, 0);
     } else {
         // send immediately
@@ -712,9 +879,21 @@ const AP_Param::GroupInfo GCS_MAVLINK::var_info[] PROGMEM = {
 
 
 GCS_MAVLINK::GCS_MAVLINK() :
+    _log_list_next(0),
+    _log_num(0),
+    _log_num_ranges(0),
+    _log_request_time_ms(0),
     packet_drops(0),
     waypoint_send_timeout(1000), // 1 second
-    waypoint_receive_timeout(1000) // 1 second
+    waypoint_receive_timeout(1000), // 1 second
+    _stream_share(0),
+    _link_capacity(0),
+    _stream_budget_ms(0),
+    _text_next(0),
+    _text_count(0),
+    _text_dropped(0),
+    _text_credit(0),
+    _text_send_time_ms(0)
 {
 }
 
@@ -741,41 +920,49 @@ GCS_MAVLINK::update(void)
     mavlink_status_t status;
 	status.packet_rx_drop_count = 0;
 
-    // process received bytes
-    while (comm_get_available(chan))
-    {
-        uint8_t c = comm_receive_ch(chan);
+    // process received bytes, a buffer at a time
+    uint8_t buf[32];
+    size_t nbytes;
+    while ((nbytes = _port->read(buf, sizeof(buf))) != 0) {
+        for (size_t i = 0; i < nbytes; i++) {
+            uint8_t c = buf[i];
 
 #if CLI_ENABLED == ENABLED
-        /* allow CLI to be started by hitting enter 3 times, if no
-         *  heartbeat packets have been received */
-        if (mavlink_active == 0 && (millis() - _cli_timeout) < 20000 && 
-            comm_is_idle(chan)) {
-            if (c == '\n' || c == '\r') {
-                crlf_count++;
-            } else {
-                crlf_count = 0;
-            }
-            if (crlf_count == 3) {
-                run_cli(_port);
+            /* allow CLI to be started by hitting enter 3 times, if no
+             *  heartbeat packets have been received */
+            if (mavlink_active == 0 && (millis() - _cli_timeout) < 20000 && 
+                comm_is_idle(chan)) {
+                if (c == '\n' || c == '\r') {
+                    crlf_count++;
+                } else {
+                    crlf_count = 0;
+                }
+                if (crlf_count == 3) {
+                    run_cli(_port);
+                }
             }
-        }
 #endif
 
-        // Try to get a new message
-        if (mavlink_parse_char(chan, c, &msg, &status)) {
-            // we exclude radio packets to make it possible to use the
-            // CLI over the radio
-            if (msg.msgid != MAVLINK_MSG_ID_RADIO) {
-                mavlink_active = true;
+            // Try to get a new message
+            if (mavlink_parse_char(chan, c, &msg, &status)) {
+                // we exclude radio packets to make it possible to use the
+                // CLI over the radio
+                if (msg.msgid != MAVLINK_MSG_ID_RADIO) {
+                    mavlink_active = true;
+                }
+                handleMessage(&msg);
             }
-            handleMessage(&msg);
         }
     }
 
     // Update packet drops counter
     packet_drops += status.packet_rx_drop_count;
 
+    if (_log_request_time_ms != 0 && !log_sending() &&
+        millis() - _log_request_time_ms > LOG_DOWNLOAD_TIMEOUT_MS) {
+        log_download_end();
+    }
+
     if (!waypoint_receiving) {
         return;
     }
@@ -795,28 +982,147 @@ GCS_MAVLINK::update(void)
     }
 }
 
-// see if we should send a stream now. Called at 50Hz
-bool GCS_MAVLINK::stream_trigger(enum streams stream_num)
+// bytes sent on the link by each stream every time it triggers
+#define STREAM_PACKET(id) (MAVLINK_MSG_ID_ ## id ## _LEN + MAVLINK_NUM_NON_PAYLOAD_BYTES)
+static const uint16_t stream_packet_bytes[GCS_MAVLINK::NUM_STREAMS] PROGMEM = {
+    STREAM_PACKET(RAW_IMU) + STREAM_PACKET(SENSOR_OFFSETS),
+    STREAM_PACKET(SYS_STATUS) + STREAM_PACKET(MEMINFO) + STREAM_PACKET(MISSION_CURRENT) +
+    STREAM_PACKET(GPS_RAW_INT) + STREAM_PACKET(NAV_CONTROLLER_OUTPUT),
+    STREAM_PACKET(SERVO_OUTPUT_RAW) + STREAM_PACKET(RC_CHANNELS_RAW),
+    STREAM_PACKET(RC_CHANNELS_SCALED),
+    STREAM_PACKET(GLOBAL_POSITION_INT),
+    STREAM_PACKET(ATTITUDE) + STREAM_PACKET(SIMSTATE),
+    STREAM_PACKET(VFR_HUD),
+    STREAM_PACKET(AHRS) + STREAM_PACKET(HWSTATUS) + STREAM_PACKET(RANGEFINDER) +
+    3 * STREAM_PACKET(DATA32) + STREAM_PACKET(DATA16),
+    STREAM_PACKET(PARAM_VALUE)
+};
+
+// the order the streams get their share of the link in, so that
+// position and status are never starved by the bulkier streams. The
+// parameter stream isn't here as queued_param_send() limits itself
+static const uint8_t stream_priority[] PROGMEM = {
+    GCS_MAVLINK::STREAM_POSITION,
+    GCS_MAVLINK::STREAM_EXTENDED_STATUS,
+    GCS_MAVLINK::STREAM_EXTRA1,
+    GCS_MAVLINK::STREAM_EXTRA2,
+    GCS_MAVLINK::STREAM_RC_CHANNELS,
+    GCS_MAVLINK::STREAM_RAW_CONTROLLER,
+    GCS_MAVLINK::STREAM_EXTRA3,
+    GCS_MAVLINK::STREAM_RAW_SENSORS
+};
+
+// at N kbaud the port carries N*100 bytes per second
+uint16_t GCS_MAVLINK::link_nominal_rate(void) const
 {
-    AP_Int16 *stream_rates = &streamRateRawSensors;
-    float rate = (uint8_t)stream_rates[stream_num].get();
+    uint8_t kbaud = (chan == MAVLINK_COMM_0) ? (uint8_t)g.serial0_baud.get() : (uint8_t)g.serial3_baud.get();
+    return kbaud * 100U;
+}
+
+/*
+  share the link out between the streams. This is done once a second,
+  and straight away when a transfer starts or ends or the GCS asks for
+  new rates
+ */
+void GCS_MAVLINK::stream_budget_update(void)
+{
+    uint32_t tnow = millis();
 
     // send at a much lower rate while handling waypoints and
-    // parameter sends
+    // parameter sends, and share the link with a log download
+    uint8_t share = 100;
     if (waypoint_receiving || _queued_parameter != NULL) {
-        rate *= 0.25;
+        share = 25;
+    } else if (log_sending()) {
+        share = 100 - LOG_DOWNLOAD_BANDWIDTH_PCT;
+    }
+
+    bool new_second = (tnow - _stream_budget_ms >= 1000);
+    if (!new_second && share == _stream_share) {
+        return;
+    }
+    _stream_share = share;
+
+    uint16_t nominal = link_nominal_rate();
+    uint16_t txspace = comm_get_txspace(chan);
+    if (txspace > _txspace_max) {
+        _txspace_max = txspace;
+    }
+
+    if (_link_capacity == 0) {
+        _link_capacity = nominal;
+    } else if (new_second) {
+        uint32_t dt = tnow - _stream_budget_ms;
+        uint32_t written = mavlink_comm_tx_bytes[chan] - _tx_bytes_last;
+        if (txspace < _txspace_max / 2 && dt < 5000) {
+            // the tx buffer is backing up, so the link is carrying
+            // less than its nominal rate, for example a radio with
+            // flow control. Use what actually drained from the buffer
+            int32_t drained = (int32_t)written + txspace - _txspace_last;
+            drained = drained * 1000 / (int32_t)dt;
+            _link_capacity = constrain_int32(drained, nominal / 16, nominal);
+        } else {
+            // creep back up to the nominal rate while it keeps up
+            _link_capacity = min(_link_capacity + nominal / 16, (uint32_t)nominal);
+        }
+
+        // the number of times each stream was sent over the second
+        for (uint8_t i=0; i<NUM_STREAMS; i++) {
+            stream_achieved[i] = min(stream_count[i] * 1000UL / dt, 255UL);
+            stream_count[i] = 0;
+        }
+    }
+    if (new_second) {
+        // the next capacity estimate covers the whole interval, even
+        // when the share changes part way through it
+        _stream_budget_ms = tnow;
+        _txspace_last = txspace;
+        _tx_bytes_last = mavlink_comm_tx_bytes[chan];
     }
 
-    if (rate <= 0) {
+    uint32_t budget = (uint32_t)_link_capacity * TELEM_BANDWIDTH_PCT / 100;
+    budget = budget * share / 100;
+    _stream_budget = budget;
+
+    // give each stream the rate it asked for, in priority order,
+    // until the budget is used up
+    AP_Int16 *stream_rates = &streamRateRawSensors;
+    for (uint8_t i=0; i<sizeof(stream_priority); i++) {
+        uint8_t s = pgm_read_byte(&stream_priority[i]);
+        uint16_t bytes = pgm_read_word(&stream_packet_bytes[s]);
+        uint8_t rate = min((uint8_t)stream_rates[s].get(), 50);
+        uint32_t want = min((uint32_t)rate * bytes, budget);
+        stream_interval[s] = 0;
+        if (want == 0) {
+            continue;
+        }
+        uint32_t ticks = (50UL * bytes + want - 1) / want;
+        if (ticks > 255) {
+            // not enough left for this stream at all
+            continue;
+        }
+        stream_interval[s] = ticks;
+        budget -= 50UL * bytes / ticks;
+    }
+
+    uint8_t rate = min((uint8_t)streamRateParams.get(), 50);
+    stream_interval[STREAM_PARAMS] = rate ? 50 / rate : 0;
+}
+
+// see if we should send a stream now. Called at 50Hz
+bool GCS_MAVLINK::stream_trigger(enum streams stream_num)
+{
+    uint8_t interval = stream_interval[stream_num];
+    if (interval == 0) {
         return false;
     }
 
     if (stream_ticks[stream_num] == 0) {
         // we're triggering now, setup the next trigger point
-        if (rate > 50) {
-            rate = 50;
+        stream_ticks[stream_num] = min(interval - 1 + stream_slowdown, 255);
+        if (stream_count[stream_num] < 255) {
+            stream_count[stream_num]++;
         }
-        stream_ticks[stream_num] = (50 / rate) + stream_slowdown;
         return true;
     }
 
@@ -825,6 +1131,33 @@ bool GCS_MAVLINK::stream_trigger(enum streams stream_num)
     return false;
 }
 
+/*
+  the telemetry stream rates, sent as the data of a DATA32 message
+ */
+struct PACKED stream_stats_data {
+    uint16_t link_capacity; // bytes per second
+    uint16_t budget;        // bytes per second shared by the streams
+    uint8_t  slowdown;      // extra 50Hz ticks asked for by the radio
+    uint8_t  requested[GCS_MAVLINK::NUM_STREAMS]; // Hz
+    uint8_t  interval[GCS_MAVLINK::NUM_STREAMS];  // 50Hz ticks, 0 if not sent
+    uint8_t  achieved[GCS_MAVLINK::NUM_STREAMS];  // sends in the last second
+};
+
+void GCS_MAVLINK::send_stream_stats(void)
+{
+    AP_Int16 *stream_rates = &streamRateRawSensors;
+    struct stream_stats_data d;
+    d.link_capacity = _link_capacity;
+    d.budget        = _stream_budget;
+    d.slowdown      = stream_slowdown;
+    for (uint8_t i=0; i<NUM_STREAMS; i++) {
+        d.requested[i] = (uint8_t)stream_rates[i].get();
+    }
+    memcpy(d.interval, stream_interval, sizeof(d.interval));
+    memcpy(d.achieved, stream_achieved, sizeof(d.achieved));
+    mavlink_msg_data32_send(chan, DATAMSG_TYPE_STREAM_STATS, sizeof(d), (const uint8_t *)&d);
+}
+
 void
 GCS_MAVLINK::data_stream_send(void)
 {
@@ -832,11 +1165,20 @@ GCS_MAVLINK::data_stream_send(void)
         if (streamRateParams.get() <= 0) {
             streamRateParams.set(50);
         }
+    }
+
+    stream_budget_update();
+
+    if (_queued_parameter != NULL) {
         if (stream_trigger(STREAM_PARAMS)) {
             send_message(MSG_NEXT_PARAM);
         }
     }
 
+    if (log_sending()) {
+        send_message(MSG_NEXT_LOG);
+    }
+
     if (in_mavlink_delay) {
 #if HIL_MODE != HIL_MODE_DISABLED
         // in HIL we need to keep sending servo values to ensure
@@ -893,6 +1235,10 @@ GCS_MAVLINK::data_stream_send(void)
         send_message(MSG_AHRS);
         send_message(MSG_HWSTATUS);
         send_message(MSG_RANGEFINDER);
+        send_message(MSG_SCHED_STATS);
+        send_message(MSG_PERF_SUMMARY);
+        send_message(MSG_STREAM_STATS);
+        send_message(MSG_DEFER_STATS);
     }
 }
 
@@ -919,6 +1265,73 @@ GCS_MAVLINK::send_text_P(gcs_severity severity, const prog_char_t *str)
     mavlink_send_text(chan, severity, (const char *)m.text);
 }
 
+void
+GCS_MAVLINK::queue_text(gcs_severity severity, const char *str)
+{
+    if (_text_count != 0) {
+        struct queued_text &t = _text_queue[(_text_next + _text_count - 1) % MAVLINK_TEXT_QUEUE_LEN];
+        if (t.s.severity == (uint8_t)severity &&
+            strncmp((const char *)t.s.text, str, sizeof(t.s.text)) == 0) {
+            if (t.repeats < 255) {
+                t.repeats++;
+            }
+            return;
+        }
+    }
+    if (_text_count == MAVLINK_TEXT_QUEUE_LEN) {
+        // drop the oldest
+        _text_dropped += 1 + _text_queue[_text_next].repeats;
+        _text_next = (_text_next + 1) % MAVLINK_TEXT_QUEUE_LEN;
+        _text_count--;
+    }
+    struct queued_text &t = _text_queue[(_text_next + _text_count) % MAVLINK_TEXT_QUEUE_LEN];
+    t.s.severity = (uint8_t)severity;
+    strncpy((char *)t.s.text, str, sizeof(t.s.text));
+    t.repeats = 0;
+    _text_count++;
+}
+
+/**
+* @brief Send the queued text messages, called from deferred message
+* handling code. A count of any dropped texts goes first, and repeats
+* of a text are sent once with the count on the end
+*/
+bool
+GCS_MAVLINK::send_queued_text()
+{
+    const uint16_t pkt_len = MAVLINK_MSG_ID_STATUSTEXT_LEN + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+
+    // use the part of the link left free by the streams
+    uint32_t tnow = millis();
+    uint32_t dt = min(tnow - _text_send_time_ms, 1000UL);
+    _text_send_time_ms = tnow;
+    uint16_t capacity = _link_capacity ? _link_capacity : link_nominal_rate();
+    _text_credit = min(_text_credit + (uint32_t)capacity * dt * (100 - TELEM_BANDWIDTH_PCT) / 100000UL,
+                       (uint32_t)MAVLINK_TEXT_QUEUE_LEN * pkt_len);
+
+    while (_text_count != 0 && _text_credit >= pkt_len && comm_get_txspace(chan) >= pkt_len) {
+        mavlink_statustext_t m;
+        if (_text_dropped != 0) {
+            memset(&m, 0, sizeof(m));
+            m.severity = (uint8_t)SEVERITY_LOW;
+            hal.util->snprintf_P((char *)m.text, sizeof(m.text), PSTR("%u texts dropped"), (unsigned)_text_dropped);
+            _text_dropped = 0;
+        } else {
+            const struct queued_text &t = _text_queue[_text_next];
+            m = t.s;
+            if (t.repeats != 0) {
+                uint8_t len = strnlen((const char *)m.text, sizeof(m.text));
+                hal.util->snprintf_P((char *)&m.text[len], sizeof(m.text) - len, PSTR(" x%u"), (unsigned)t.repeats + 1);
+            }
+            _text_next = (_text_next + 1) % MAVLINK_TEXT_QUEUE_LEN;
+            _text_count--;
+        }
+        mavlink_msg_statustext_send(chan, m.severity, m.text);
+        _text_credit -= pkt_len;
+    }
+    return _text_count != 0;
+}
+
 void GCS_MAVLINK::handleMessage(mavlink_message_t* msg)
 {
     struct Location tell_command = {};                // command for telemetry
@@ -997,6 +1410,8 @@ void GCS_MAVLINK::handleMessage(mavlink_message_t* msg)
                 default:
                     break;
             }
+            // share the link out again for the new rates
+            _stream_share = 0;
             break;
         }
 
@@ -1087,6 +1502,22 @@ void GCS_MAVLINK::handleMessage(mavlink_message_t* msg)
         }
 
 
+    case MAVLINK_MSG_ID_DATA16:
+        {
+            mavlink_data16_t packet;
+            mavlink_msg_data16_decode(msg, &packet);
+            if (packet.type == DATAMSG_TYPE_SCHED_STATS) {
+                scheduler.reset_stats();
+                send_text_P(SEVERITY_LOW,PSTR("scheduler stats reset"));
+            } else if (packet.type == DATAMSG_TYPE_LOG_LIST ||
+                       packet.type == DATAMSG_TYPE_LOG_DATA ||
+                       packet.type == DATAMSG_TYPE_LOG_SEEK ||
+                       packet.type == DATAMSG_TYPE_LOG_END) {
+                handle_log_request(packet);
+            }
+            break;
+        }
+
     case MAVLINK_MSG_ID_SET_MODE:
 		{
             // decode
@@ -1845,6 +2276,203 @@ GCS_MAVLINK::queued_waypoint_send()
     }
 }
 
+/*
+  log download over DATA16 and DATA96 messages, as common.xml doesn't
+  have the LOG_* messages yet. The GCS asks for the list of logs with
+  a DATA16 of type DATAMSG_TYPE_LOG_LIST holding a log_list_request,
+  and gets a DATA16 log_entry back for each log in the range, or one
+  with an id of 0 if there are none. It then asks for ranges of a log
+  with DATA16 log_data_requests, which queue up so that several can be
+  outstanding, and gets the data in DATA96 log_data messages. A
+  log_data with less than a full load of data marks the end of the
+  log. Anything lost is asked for again by range, and a DATA16 of
+  type DATAMSG_TYPE_LOG_END finishes the download.
+
+  To download only part of a log the GCS sends a DATA16 log_seek of
+  type DATAMSG_TYPE_LOG_SEEK, and gets it back with the offset from
+  DataFlash::find_msg() filled in. An offset of -2 means the log index
+  is still being built, and the GCS asks again
+ */
+struct PACKED log_list_request {
+    uint16_t start;
+    uint16_t end;
+};
+
+struct PACKED log_entry {
+    uint16_t id;
+    uint16_t num_logs;
+    uint16_t last_log_num;
+    uint32_t size;
+};
+
+struct PACKED log_data_request {
+    uint16_t id;
+    uint32_t ofs;
+    uint32_t count;     // 0xFFFFFFFF for the rest of the log
+};
+
+struct PACKED log_data {
+    uint16_t id;
+    uint32_t ofs;
+    uint8_t data[90];
+};
+
+struct PACKED log_seek {
+    uint16_t id;
+    uint8_t msg_type;       // 0 for any type
+    uint32_t gps_time_ms;   // 0 for the start of the log
+    int32_t ofs;
+};
+
+void GCS_MAVLINK::handle_log_request(const mavlink_data16_t &packet)
+{
+    if (packet.type == DATAMSG_TYPE_LOG_END) {
+        log_download_end();
+        return;
+    }
+
+    // the backend may have to stop logging to read
+    DataFlash.prepare_download();
+    _log_request_time_ms = millis();
+
+    if (packet.type == DATAMSG_TYPE_LOG_LIST) {
+        struct log_list_request req;
+        if (packet.len < sizeof(req)) {
+            return;
+        }
+        memcpy(&req, packet.data, sizeof(req));
+        uint16_t num_logs = DataFlash.get_num_logs();
+        uint16_t last_log = DataFlash.find_last_log();
+        _log_list_first = last_log - num_logs + 1;
+        _log_list_last = min(req.end, last_log);
+        _log_list_next = max(req.start, _log_list_first);
+        if (num_logs == 0 || _log_list_next > _log_list_last) {
+            // nothing to list
+            struct log_entry e = { 0, num_logs, last_log, 0 };
+            uint8_t buf[16] = {};
+            memcpy(buf, &e, sizeof(e));
+            mavlink_msg_data16_send(chan, DATAMSG_TYPE_LOG_LIST, sizeof(e), buf);
+            _log_list_next = 0;
+        }
+        return;
+    }
+
+    if (packet.type == DATAMSG_TYPE_LOG_SEEK) {
+        struct log_seek req;
+        if (packet.len < sizeof(req)) {
+            return;
+        }
+        memcpy(&req, packet.data, sizeof(req));
+        req.ofs = DataFlash.find_msg(req.id, req.msg_type, req.gps_time_ms);
+        uint8_t buf[16] = {};
+        memcpy(buf, &req, sizeof(req));
+        mavlink_msg_data16_send(chan, DATAMSG_TYPE_LOG_SEEK, sizeof(req), buf);
+        return;
+    }
+
+    struct log_data_request req;
+    if (packet.len < sizeof(req)) {
+        return;
+    }
+    memcpy(&req, packet.data, sizeof(req));
+    if (req.id != _log_num) {
+        _log_num = req.id;
+        _log_num_ranges = 0;
+    }
+    // the log may still be growing
+    _log_size = DataFlash.get_log_size(_log_num);
+    if (_log_num_ranges == LOG_DOWNLOAD_MAX_RANGES) {
+        // the GCS will ask again for what it doesn't get
+        return;
+    }
+    struct log_range &r = _log_ranges[_log_num_ranges++];
+    r.ofs = req.ofs;
+    if (req.ofs >= _log_size) {
+        // past the end, which is answered with an empty log_data
+        r.count = 0;
+    } else {
+        r.count = min(req.count, _log_size - req.ofs);
+    }
+}
+
+// finish a download, restarting logging if it was stopped for it
+void GCS_MAVLINK::log_download_end(void)
+{
+    _log_list_next = 0;
+    _log_num = 0;
+    _log_num_ranges = 0;
+    _log_request_time_ms = 0;
+    DataFlash.end_download();
+    if (g.log_bitmask != 0 && !DataFlash.logging_started()) {
+        start_logging();
+    }
+}
+
+/**
+* @brief Send the next log list entries or log data, called from
+* deferred message handling code
+*/
+void
+GCS_MAVLINK::queued_log_send()
+{
+    // use at most LOG_DOWNLOAD_BANDWIDTH_PCT of what this link is
+    // carrying, as measured by stream_budget_update()
+    uint32_t tnow = millis();
+    uint32_t dt = min(tnow - _log_send_time_ms, 100UL);
+    _log_send_time_ms = tnow;
+    uint16_t capacity = _link_capacity ? _link_capacity : link_nominal_rate();
+    _log_credit = min(_log_credit + (uint32_t)capacity * dt * LOG_DOWNLOAD_BANDWIDTH_PCT / 100000UL, 1024UL);
+
+    const uint16_t pkt_len = MAVLINK_MSG_ID_DATA96_LEN + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+    while (_log_credit >= pkt_len && comm_get_txspace(chan) >= pkt_len) {
+        if (_log_list_next != 0) {
+            struct log_entry e;
+            e.id = _log_list_next;
+            e.num_logs = _log_list_last - _log_list_first + 1;
+            e.last_log_num = _log_list_last;
+            e.size = DataFlash.get_log_size(_log_list_next);
+            uint8_t buf[16] = {};
+            memcpy(buf, &e, sizeof(e));
+            mavlink_msg_data16_send(chan, DATAMSG_TYPE_LOG_LIST, sizeof(e), buf);
+            _log_credit -= MAVLINK_MSG_ID_DATA16_LEN + MAVLINK_NUM_NON_PAYLOAD_BYTES;
+            if (_log_list_next == _log_list_last) {
+                _log_list_next = 0;
+            } else {
+                _log_list_next++;
+            }
+            continue;
+        }
+        if (_log_num_ranges == 0) {
+            break;
+        }
+
+        struct log_range &r = _log_ranges[0];
+        struct log_data d;
+        d.id = _log_num;
+        d.ofs = r.ofs;
+        uint16_t n = min(r.count, sizeof(d.data));
+        int16_t ret = 0;
+        if (n != 0) {
+            ret = DataFlash.get_log_data(_log_num, r.ofs, n, d.data);
+        }
+        if (ret < 0) {
+            // can't read it. A short log_data would look like the end
+            // of the log, so drop the range and let the GCS ask again
+            r.count = 0;
+        } else {
+            memset(&d.data[ret], 0, sizeof(d.data) - ret);
+            mavlink_msg_data96_send(chan, DATAMSG_TYPE_LOG_DATA, 6 + ret, (const uint8_t *)&d);
+            _log_credit -= pkt_len;
+            r.ofs += ret;
+            r.count -= ret;
+        }
+        if (r.count == 0 || ret < n) {
+            _log_num_ranges--;
+            memmove(&_log_ranges[0], &_log_ranges[1], _log_num_ranges * sizeof(_log_ranges[0]));
+        }
+    }
+}
+
 void GCS_MAVLINK::reset_cli_timeout() {
       _cli_timeout = millis();
 }
@@ -1925,22 +2553,20 @@ static void gcs_send_text_P(gcs_severity severity, const prog_char_t *str)
 
 /*
  *  send a low priority formatted message to the GCS
- *  only one fits in the queue, so if you send more than one before the
- *  last one gets into the serial buffer then the old one will be lost
+ *  it is queued with the other low priority texts, see
+ *  GCS_MAVLINK::queue_text()
  */
 void gcs_send_text_fmt(const prog_char_t *fmt, ...)
 {
     va_list arg_list;
-    gcs0.pending_status.severity = (uint8_t)SEVERITY_LOW;
+    mavlink_statustext_t m;
     va_start(arg_list, fmt);
-    hal.util->vsnprintf_P((char *)gcs0.pending_status.text,
-            sizeof(gcs0.pending_status.text), fmt, arg_list);
+    hal.util->vsnprintf_P((char *)m.text, sizeof(m.text), fmt, arg_list);
     va_end(arg_list);
-    DataFlash.Log_Write_Message(gcs0.pending_status.text);
-    gcs3.pending_status = gcs0.pending_status;
-    mavlink_send_message(MAVLINK_COMM_0, MSG_STATUSTEXT, 0);
+    DataFlash.Log_Write_Message(m.text);
+    mavlink_send_text(MAVLINK_COMM_0, SEVERITY_LOW, m.text);
     if (gcs3.initialised) {
-        mavlink_send_message(MAVLINK_COMM_1, MSG_STATUSTEXT, 0);
+        mavlink_send_text(MAVLINK_COMM_1, SEVERITY_LOW, m.text);
     }
 }
 
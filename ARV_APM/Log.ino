@@ -50,6 +50,7 @@ print_log_menu(void)
 		PLOG(CURRENT);
 		PLOG(SONAR);
 		PLOG(COMPASS);
+		PLOG(CTD);
 		#undef PLOG
 	}
 
@@ -59,6 +60,9 @@ print_log_menu(void)
 	return(true);
 }
 
+// dump <log> [<type>|all [<gps time ms>]] dumps a whole log, or seeks
+// with the log index to the messages of one type, or of all types,
+// from a GPS time of week on
 static int8_t
 dump_log(uint8_t argc, const Menu::arg *argv)
 {
@@ -78,13 +82,26 @@ dump_log(uint8_t argc, const Menu::arg *argv)
         cliSerial->printf_P(PSTR("dumping all\n"));
         Log_Read(0, 1, 0);
         return(-1);
-    } else if ((argc != 2)
+    } else if ((argc < 2)
                || ((uint16_t)dump_log > last_log_num))
     {
         cliSerial->printf_P(PSTR("bad log number\n"));
         return(-1);
     }
 
+    if (argc > 2) {
+        uint8_t msg_type = 0;
+        if (strcasecmp_P(argv[2].str, PSTR("all"))) {
+            msg_type = log_msg_type(argv[2].str);
+            if (msg_type == 0) {
+                cliSerial->printf_P(PSTR("bad message type\n"));
+                return(-1);
+            }
+        }
+        Log_Read_Seek((uint16_t)dump_log, msg_type, argc > 3 ? argv[3].i : 0);
+        return 0;
+    }
+
     DataFlash.get_log_boundaries(dump_log, dump_log_start, dump_log_end);
     Log_Read((uint16_t)dump_log, dump_log_start, dump_log_end);
     return 0;
@@ -141,6 +158,7 @@ select_logs(uint8_t argc, const Menu::arg *argv)
 		TARG(CURRENT);
 		TARG(SONAR);
 		TARG(COMPASS);
+		TARG(CTD);
 		#undef TARG
 	}
 
@@ -172,9 +190,11 @@ struct PACKED log_Performance {
     int16_t  gyro_drift_z;
     int16_t  pm_test;
     uint8_t  i2c_lockup_count;
+    uint32_t log_dropped;
+    uint8_t  log_buf_max;
 };
 
-// Write a performance monitoring packet. Total length : 19 bytes
+// Write a performance monitoring packet. Total length : 28 bytes
 static void Log_Write_Performance()
 {
     struct log_Performance pkt = {
@@ -189,7 +209,59 @@ static void Log_Write_Performance()
         gyro_drift_y    : (int16_t)(ahrs.get_gyro_drift().y * 1000),
         gyro_drift_z    : (int16_t)(ahrs.get_gyro_drift().z * 1000),
         pm_test         : pmTest1,
-        i2c_lockup_count: hal.i2c->lockup_count()
+        i2c_lockup_count: hal.i2c->lockup_count(),
+        log_dropped     : DataFlash.dropped_bytes(),
+        log_buf_max     : DataFlash.max_buffer_fill_pct()
+    };
+    DataFlash.WriteBlock(&pkt, sizeof(pkt));
+}
+
+struct PACKED log_Sched {
+    LOG_PACKET_HEADER;
+    uint8_t  task;
+    uint32_t runs;
+    uint16_t skips;
+    uint16_t slips;
+    uint16_t overruns;
+    uint16_t min_micros;
+    uint16_t mean_micros;
+    uint16_t max_micros;
+    uint16_t hist[AP_SCHEDULER_HIST_BINS];
+};
+
+// Write the timing statistics of each scheduler task. These count
+// from boot or the last reset from the GCS
+static void Log_Write_Sched()
+{
+    for (uint8_t i=0; i<scheduler.num_tasks(); i++) {
+        const AP_Scheduler::TaskStats &s = scheduler.task_stats(i);
+        struct log_Sched pkt = {
+            LOG_PACKET_HEADER_INIT(LOG_SCHED_MSG),
+            task        : i,
+            runs        : s.runs,
+            skips       : s.skips,
+            slips       : s.slips,
+            overruns    : s.overruns,
+            min_micros  : (uint16_t)(s.runs?s.min_micros:0),
+            mean_micros : scheduler.task_mean_micros(i),
+            max_micros  : s.max_micros
+        };
+        memcpy(pkt.hist, s.hist, sizeof(pkt.hist));
+        DataFlash.WriteBlock(&pkt, sizeof(pkt));
+    }
+}
+
+struct PACKED log_Perf2 {
+    LOG_PACKET_HEADER;
+    struct perf_summary perf;
+};
+
+// Write the main loop timing of the last performance monitoring interval
+static void Log_Write_Perf2()
+{
+    struct log_Perf2 pkt = {
+        LOG_PACKET_HEADER_INIT(LOG_PERF2_MSG),
+        perf : perf_summary
     };
     DataFlash.WriteBlock(&pkt, sizeof(pkt));
 }
@@ -280,6 +352,8 @@ struct PACKED log_Nav_Tuning {
     int8_t   throttle;
 };
 
+static DataFlash_Delta<struct log_Nav_Tuning> ntun_delta;
+
 // Write a navigation tuning packet. Total length : 18 bytes
 static void Log_Write_Nav_Tuning()
 {
@@ -292,7 +366,7 @@ static void Log_Write_Nav_Tuning()
         nav_gain_scalar     : (int16_t)(nav_gain_scaler*1000),
         throttle            : (int8_t)(100 * channel_throttle->norm_output())
     };
-    DataFlash.WriteBlock(&pkt, sizeof(pkt));
+    DataFlash.WriteDelta(ntun_delta, pkt, (g.log_delta & MASK_LOG_NTUN) != 0);
 }
 
 struct PACKED log_Attitude {
@@ -302,6 +376,7 @@ struct PACKED log_Attitude {
     uint16_t yaw;
 };
 
+static DataFlash_Delta<struct log_Attitude> att_delta;
 
 // Write an attitude packet
 static void Log_Write_Attitude()
@@ -312,8 +387,60 @@ static void Log_Write_Attitude()
         pitch : (int16_t)ahrs.pitch_sensor,
         yaw   : (uint16_t)ahrs.yaw_sensor
     };
-    DataFlash.WriteBlock(&pkt, sizeof(pkt));
+    DataFlash.WriteDelta(att_delta, pkt, (g.log_delta & MASK_LOG_ATTITUDE_FAST) != 0);
+}
+
+#if BLACKBOX == ENABLED
+struct PACKED log_Servo {
+    LOG_PACKET_HEADER;
+    uint16_t steer;
+    uint16_t throttle;
+    uint16_t throttle2;
+    uint16_t winch_motor;
+    uint16_t winch_clutch;
+};
+
+// Write the 50Hz records into the black box, and write out
+// any flush of it that is under way
+static void Log_Write_BlackBox()
+{
+    if (!blackbox.enabled()) {
+        return;
+    }
+    blackbox.update();
+
+    struct log_Attitude att = {
+        LOG_PACKET_HEADER_INIT(LOG_BLACKBOX_ATT_MSG),
+        roll  : (int16_t)ahrs.roll_sensor,
+        pitch : (int16_t)ahrs.pitch_sensor,
+        yaw   : (uint16_t)ahrs.yaw_sensor
+    };
+    blackbox.WriteBlock(&att, sizeof(att));
+
+    blackbox.Log_Write_IMU(&ins);
+
+    struct log_Servo servo = {
+        LOG_PACKET_HEADER_INIT(LOG_SERVO_MSG),
+        steer        : channel_steer->radio_out,
+        throttle     : channel_throttle->radio_out,
+        throttle2    : channel_throttle2->radio_out,
+        winch_motor  : g.channel_winch_motor.radio_out,
+        winch_clutch : g.channel_winch_clutch.radio_out
+    };
+    blackbox.WriteBlock(&servo, sizeof(servo));
+}
+
+// write the black box to the log if the event is in BBOX_EVENTS
+static void blackbox_trigger(uint8_t event)
+{
+    if (!(g.bbox_events & event) || g.log_bitmask == 0) {
+        return;
+    }
+    blackbox.trigger(event,
+                     constrain_int16(g.bbox_pre, 0, 60) * 1000U,
+                     constrain_int16(g.bbox_post, 0, 60) * 1000U);
 }
+#endif // BLACKBOX
 
 struct log_Mode {
     LOG_PACKET_HEADER;
@@ -421,13 +548,72 @@ static void Log_Write_Compass()
     DataFlash.WriteBlock(&pkt, sizeof(pkt));
 }
 
+struct PACKED log_Ctd {
+    LOG_PACKET_HEADER;
+    uint8_t  event;
+    uint8_t  wp_index;
+    uint16_t depth_m;
+    uint32_t elapsed_ms;
+    uint32_t expected_ms;
+    int32_t  lat;
+    int32_t  lng;
+};
+
+// Write a CTD cast event, one of the CTD_EVENT_* values
+static void Log_Write_Ctd(uint8_t event)
+{
+    struct log_Ctd pkt = {
+        LOG_PACKET_HEADER_INIT(LOG_CTD_MSG),
+        event       : event,
+        wp_index    : nav_command_index,
+        depth_m     : ctd.cast_depth_m,
+        elapsed_ms  : millis() - ctd.cast_start_time_ms,
+        expected_ms : ctd.cast_end_time_ms - ctd.cast_start_time_ms,
+        lat         : current_loc.lat,
+        lng         : current_loc.lng
+    };
+    DataFlash.WriteBlock(&pkt, sizeof(pkt));
+}
+
+struct PACKED log_Winch {
+    LOG_PACKET_HEADER;
+    uint32_t elapsed_ms;
+    uint16_t motor;
+    uint16_t clutch;
+    uint8_t  aft_state;
+    uint8_t  aft_count;
+    uint8_t  for_state;
+    uint8_t  for_count;
+    uint8_t  stall;
+    int32_t  lat;
+    int32_t  lng;
+};
+
+// Write the winch and A-frame state during a CTD cast. Total length : 24 bytes
+static void Log_Write_Winch()
+{
+    struct log_Winch pkt = {
+        LOG_PACKET_HEADER_INIT(LOG_WINCH_MSG),
+        elapsed_ms  : millis() - ctd.cast_start_time_ms,
+        motor       : (uint16_t)g.channel_winch_motor.radio_out,
+        clutch      : (uint16_t)g.channel_winch_clutch.radio_out,
+        aft_state   : aframe.aft_sensor_state,
+        aft_count   : aframe.aft_sensor_count,
+        for_state   : aframe.for_sensor_state,
+        for_count   : aframe.for_sensor_count,
+        stall       : ctd.cast_snagged,
+        lat         : current_loc.lat,
+        lng         : current_loc.lng
+    };
+    DataFlash.WriteBlock(&pkt, sizeof(pkt));
+}
 
 static const struct LogStructure log_structure[] PROGMEM = {
     LOG_COMMON_STRUCTURES,
     { LOG_ATTITUDE_MSG, sizeof(log_Attitude),       
       "ATT", "ccC",        "Roll,Pitch,Yaw" },
     { LOG_PERFORMANCE_MSG, sizeof(log_Performance), 
-      "PM",  "IHhBBBhhhhB", "LTime,MLC,gDt,RNCnt,RNBl,GPScnt,GDx,GDy,GDz,PMT,I2CErr" },
+      "PM",  "IHhBBBhhhhBIB", "LTime,MLC,gDt,RNCnt,RNBl,GPScnt,GDx,GDy,GDz,PMT,I2CErr,Drop,Buf" },
     { LOG_CMD_MSG, sizeof(log_Cmd),                 
       "CMD", "BBBBBeLL",   "CTot,CNum,CId,COpt,Prm1,Alt,Lat,Lng" },
     { LOG_STARTUP_MSG, sizeof(log_Startup),         
@@ -444,6 +630,22 @@ static const struct LogStructure log_structure[] PROGMEM = {
       "MODE", "MB",          "Mode,ModeNum" },
     { LOG_COMPASS_MSG, sizeof(log_Compass),             
       "MAG", "hhhhhhhhh",   "MagX,MagY,MagZ,OfsX,OfsY,OfsZ,MOfsX,MOfsY,MOfsZ" },
+    { LOG_SCHED_MSG, sizeof(log_Sched),
+      "SCHD", "BIHHHHHHHHHHHH", "Task,Runs,Skip,Slip,Ovr,Min,Mean,Max,H0,H1,H2,H3,H4,H5" },
+    { LOG_PERF2_MSG, sizeof(log_Perf2),
+      "PM2", "HHHHHHHHHHHHH", "N,J50,J99,JMax,F50,F99,FMax,S50,S99,SMax,I50,I1,IMin" },
+#if BLACKBOX == ENABLED
+    { LOG_SERVO_MSG, sizeof(log_Servo),
+      "RCOU", "HHHHH",      "Steer,Thr,Thr2,Winch,Clutch" },
+    { LOG_BLACKBOX_ATT_MSG, sizeof(log_Attitude),
+      "ATTB", "ccC",        "Roll,Pitch,Yaw" },
+#endif
+    { LOG_CTD_MSG, sizeof(log_Ctd),
+      "CTD", "BBHIILL",    "Event,WP,Depth,Elapsed,Expected,Lat,Lng" },
+    { LOG_WINCH_MSG, sizeof(log_Winch),
+      "WNCH", "IHHBBBBBLL", "Elapsed,Motor,Clutch,Aft,AftCnt,For,ForCnt,Stall,Lat,Lng" },
+    LOG_DELTA_STRUCTURE(LOG_ATTITUDE_MSG, "ATTD"),
+    LOG_DELTA_STRUCTURE(LOG_NTUN_MSG, "NTND"),
 };
 
 
@@ -463,6 +665,31 @@ static void Log_Read(uint16_t log_num, uint16_t start_page, uint16_t end_page)
                              cliSerial);
 }
 
+// find a log message type by its name, or 0 if there isn't one
+static uint8_t log_msg_type(const char *name)
+{
+    for (uint8_t i=0; i<sizeof(log_structure)/sizeof(log_structure[0]); i++) {
+        if (pgm_read_byte(&log_structure[i].format[0]) != '*' &&
+            !strcasecmp_P(name, (const prog_char_t *)log_structure[i].name)) {
+            return pgm_read_byte(&log_structure[i].msg_type);
+        }
+    }
+    return 0;
+}
+
+// Print a log from the first message of msg_type, or of any type if
+// it is 0, in or after the index bucket holding GPS time gps_time_ms
+static void Log_Read_Seek(uint16_t log_num, uint8_t msg_type, uint32_t gps_time_ms)
+{
+    if (!DataFlash.LogReadSeek(log_num, msg_type, gps_time_ms,
+                               sizeof(log_structure)/sizeof(log_structure[0]),
+                               log_structure,
+                               print_mode,
+                               cliSerial)) {
+        cliSerial->printf_P(PSTR("logs can't be searched\n"));
+    }
+}
+
 // start a new log
 static void start_logging() 
 {
@@ -477,13 +704,21 @@ static void Log_Write_Cmd(uint8_t num, const struct Location *wp) {}
 static void Log_Write_Current() {}
 static void Log_Write_Nav_Tuning() {}
 static void Log_Write_Performance() {}
+static void Log_Write_Sched() {}
+static void Log_Write_Perf2() {}
 static int8_t process_logs(uint8_t argc, const Menu::arg *argv) { return 0; }
 static void Log_Write_Control_Tuning() {}
 static void Log_Write_Sonar() {}
 static void Log_Write_Mode() {}
 static void Log_Write_Attitude() {}
 static void Log_Write_Compass() {}
+static void Log_Write_Ctd(uint8_t event) {}
+static void Log_Write_Winch() {}
 static void start_logging() {}
 
 #endif // LOGGING_ENABLED
 
+#if BLACKBOX == DISABLED
+static void blackbox_trigger(uint8_t event) {}
+#endif
+
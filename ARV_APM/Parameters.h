@@ -33,6 +33,11 @@ public:
         k_param_reset_switch_chan,
         k_param_initial_mode,
         k_param_scheduler,
+        k_param_loop_rate,
+        k_param_log_delta,
+        k_param_bbox_events,
+        k_param_bbox_pre,
+        k_param_bbox_post,
 
         // IO pins
         k_param_rssi_pin = 20,
@@ -169,6 +174,13 @@ public:
     AP_Int16    num_resets;
     AP_Int8	    reset_switch_chan;
     AP_Int8     initial_mode;
+    AP_Int16    loop_rate;
+    AP_Int16    log_delta;
+#if BLACKBOX == ENABLED
+    AP_Int8     bbox_events;
+    AP_Int8     bbox_pre;
+    AP_Int8     bbox_post;
+#endif
 
     // IO pins
     AP_Int8     rssi_pin;
@@ -21,7 +21,7 @@ const AP_Param::Info var_info[] PROGMEM = {
     // @Param: LOG_BITMASK
     // @DisplayName: Log bitmask
     // @Description: Two byte bitmap of log types to enable in dataflash
-    // @Values: 0:Disabled,3950:Default,4078:Default+IMU
+    // @Values: 0:Disabled,8046:Default,8174:Default+IMU
     // @User: Advanced
 	GSCALAR(log_bitmask,            "LOG_BITMASK",      DEFAULT_LOG_BITMASK),
 	GSCALAR(num_resets,             "SYS_NUM_RESETS",   0),
@@ -39,6 +39,46 @@ const AP_Param::Info var_info[] PROGMEM = {
     // @User: Advanced
 	GSCALAR(initial_mode,        "INITIAL_MODE",     MANUAL),
 
+    // @Param: LOOP_RATE
+    // @DisplayName: Main loop rate
+    // @Description: The rate the IMU is sampled and the steering and throttle are updated at. The scheduler tasks and the fast ATT and IMU logging still run at the same rates. A reboot is needed after changing this
+    // @Units: Hz
+    // @Values: 50:50Hz,100:100Hz,200:200Hz
+    // @User: Advanced
+	GSCALAR(loop_rate,           "LOOP_RATE",        LOOP_RATE_HZ),
+
+    // @Param: LOG_DELTA
+    // @DisplayName: Log delta encoding bitmask
+    // @Description: Log types from LOG_BITMASK to write as deltas against the previous record, with a full record every 50. This makes ATT, GPS, NTUN and IMU records smaller, but they can only be read with a reader that understands the encoding
+    // @Values: 0:Disabled,1:ATT,4:GPS,32:NTUN,128:IMU,165:All
+    // @User: Advanced
+	GSCALAR(log_delta,           "LOG_DELTA",        DEFAULT_LOG_DELTA),
+
+#if BLACKBOX == ENABLED
+    // @Param: BBOX_EVENTS
+    // @DisplayName: Black box trigger events
+    // @Description: Events that write the black box of 50Hz attitude, IMU and servo output records to the log as ATTB, IMUB and RCOU, starting BBOX_PRE seconds before the event and ending BBOX_POST seconds after it. The records are kept in RAM whatever LOG_BITMASK is set to, but nothing is written unless logging is enabled. A reboot is needed after changing this from 0
+    // @Values: 0:Disabled,1:Snag,2:CTD timeout,4:Failsafe,8:Mode change,7:Default,15:All
+    // @User: Advanced
+	GSCALAR(bbox_events,         "BBOX_EVENTS",      DEFAULT_BBOX_EVENTS),
+
+    // @Param: BBOX_PRE
+    // @DisplayName: Black box pre-trigger time
+    // @Description: How much of the black box from before an event is written to the log. This is limited by the size of the buffer, which holds about 12 seconds. The records are written at 50Hz whatever LOOP_RATE is set to
+    // @Units: seconds
+    // @Range: 0 60
+    // @User: Advanced
+	GSCALAR(bbox_pre,            "BBOX_PRE",         DEFAULT_BBOX_PRE),
+
+    // @Param: BBOX_POST
+    // @DisplayName: Black box post-trigger time
+    // @Description: How long 50Hz records are written to the log after an event
+    // @Units: seconds
+    // @Range: 0 60
+    // @User: Advanced
+	GSCALAR(bbox_post,           "BBOX_POST",        DEFAULT_BBOX_POST),
+#endif
+
     // @Param: RSSI_PIN
     // @DisplayName: Receiver RSSI sensing pin
     // @Description: This selects an analog pin for the receiver RSSI voltage. It assumes the voltage is 5V for max rssi, 0V for minimum
@@ -199,9 +199,12 @@ static bool verify_nav_wp()
     update_crosstrack();
 
     if ((wp_distance > 0) && (wp_distance <= g.waypoint_radius)) {
-        gcs_send_text_fmt(PSTR("Reached Waypoint #%i dist %um"),
-                          (unsigned)nav_command_index,
-                          (unsigned)get_distance(&current_loc, &next_WP));
+        if (ctd.cast_end_time_ms == 0) {
+            // only once, not every check while a cast is under way
+            gcs_send_text_fmt(PSTR("Reached Waypoint #%i dist %um"),
+                              (unsigned)nav_command_index,
+                              (unsigned)get_distance(&current_loc, &next_WP));
+        }
         // Waypoint has been reached, do we perform a CTD cast and is it complete?
         return verify_ctd_cast();
 //        return true;
@@ -209,9 +212,12 @@ static bool verify_nav_wp()
 
     // have we gone past the waypoint?
     if (location_passed_point(current_loc, prev_WP, next_WP)) {
-        gcs_send_text_fmt(PSTR("Passed Waypoint #%i dist %um"),
-                          (unsigned)nav_command_index,
-                          (unsigned)get_distance(&current_loc, &next_WP));
+        if (ctd.cast_end_time_ms == 0) {
+            // only once, not every check while a cast is under way
+            gcs_send_text_fmt(PSTR("Passed Waypoint #%i dist %um"),
+                              (unsigned)nav_command_index,
+                              (unsigned)get_distance(&current_loc, &next_WP));
+        }
         // Waypoint has been passed, is the CTD cast complete?
         return verify_ctd_cast();
 //        return true;
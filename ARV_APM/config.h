@@ -134,6 +134,14 @@
 # define CONFIG_INS_TYPE CONFIG_INS_OILPAN
 #endif
 
+//////////////////////////////////////////////////////////////////////////////
+// Main loop rate in Hz, one of 50, 100 or 200. This is the default for
+// the LOOP_RATE parameter
+//
+#ifndef LOOP_RATE_HZ
+# define LOOP_RATE_HZ 50
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 // HIL_MODE                                 OPTIONAL
 
@@ -174,6 +182,31 @@
 # define SERIAL3_BAUD			 57600
 #endif
 
+// share of the telemetry link the data streams are allocated, the rest
+// being left for heartbeats, text messages, acks and forwarded packets
+#ifndef TELEM_BANDWIDTH_PCT
+# define TELEM_BANDWIDTH_PCT 80
+#endif
+
+// low priority text messages that can wait to go out on each link
+#ifndef MAVLINK_TEXT_QUEUE_LEN
+# define MAVLINK_TEXT_QUEUE_LEN 4
+#endif
+
+// share of the telemetry link used by a log download, and how many
+// requested ranges of a log can be outstanding
+#ifndef LOG_DOWNLOAD_BANDWIDTH_PCT
+# define LOG_DOWNLOAD_BANDWIDTH_PCT 50
+#endif
+#ifndef LOG_DOWNLOAD_MAX_RANGES
+# define LOG_DOWNLOAD_MAX_RANGES 8
+#endif
+// a download with nothing left to send ends after this long without
+// a request, so a lost GCS can't leave logging stopped
+#ifndef LOG_DOWNLOAD_TIMEOUT_MS
+# define LOG_DOWNLOAD_TIMEOUT_MS 10000
+#endif
+
 #ifndef CH7_OPTION
 # define CH7_OPTION		          CH7_SAVE_WP
 #endif
@@ -380,8 +413,40 @@
     MASK_LOG_CMD | \
     MASK_LOG_SONAR | \
     MASK_LOG_COMPASS | \
-    MASK_LOG_CURRENT
+    MASK_LOG_CURRENT | \
+    MASK_LOG_CTD
 
+// log types written as deltas, see the LOG_DELTA parameter. Only
+// MASK_LOG_ATTITUDE_FAST, MASK_LOG_GPS, MASK_LOG_NTUN and MASK_LOG_IMU
+// are supported
+#ifndef DEFAULT_LOG_DELTA
+# define DEFAULT_LOG_DELTA 0
+#endif
+
+// the black box keeps the last few seconds of ATT, IMU and servo
+// output records in RAM, to log around the events in BBOX_EVENTS.
+// The records are written at 50Hz whatever LOOP_RATE is, and the
+// buffer holds about 12 seconds of them. The AVR boards don't have
+// the RAM for it
+#ifndef BLACKBOX
+# if LOGGING_ENABLED == DISABLED || CONFIG_HAL_BOARD == HAL_BOARD_APM1 || CONFIG_HAL_BOARD == HAL_BOARD_APM2
+#  define BLACKBOX DISABLED
+# else
+#  define BLACKBOX ENABLED
+# endif
+#endif
+#ifndef BLACKBOX_BUFFER_SIZE
+# define BLACKBOX_BUFFER_SIZE 32768
+#endif
+#ifndef DEFAULT_BBOX_EVENTS
+# define DEFAULT_BBOX_EVENTS (BBOX_EVENT_SNAG | BBOX_EVENT_CTD_TIMEOUT | BBOX_EVENT_FAILSAFE)
+#endif
+#ifndef DEFAULT_BBOX_PRE
+# define DEFAULT_BBOX_PRE 10
+#endif
+#ifndef DEFAULT_BBOX_POST
+# define DEFAULT_BBOX_POST 5
+#endif
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -83,6 +83,28 @@ enum mode {
 
 #define MAV_CMD_CONDITION_YAW 23
 
+// DATA16/DATA32 type used for scheduler statistics. The GCS sends a
+// DATA16 of this type to reset them
+#define DATAMSG_TYPE_SCHED_STATS 0xFD
+
+// DATA32 type used for the main loop timing summary
+#define DATAMSG_TYPE_PERF_SUMMARY 0xFC
+
+// DATA16/DATA96 types used for log download, see
+// GCS_MAVLINK::handle_log_request()
+#define DATAMSG_TYPE_LOG_LIST 0xFB
+#define DATAMSG_TYPE_LOG_DATA 0xFA
+#define DATAMSG_TYPE_LOG_END  0xF9
+#define DATAMSG_TYPE_LOG_SEEK 0xF6
+
+// DATA32 type used for the telemetry stream rates, see
+// GCS_MAVLINK::send_stream_stats()
+#define DATAMSG_TYPE_STREAM_STATS 0xF8
+
+// DATA16 type used for the deferred message counts, see
+// send_defer_stats()
+#define DATAMSG_TYPE_DEFER_STATS 0xF7
+
 //  GCS Message ID's
 /// NOTE: to ensure we never block on sending MAVLink messages
 /// please keep each MSG_ to a single MAVLink message. If need be
@@ -110,7 +132,12 @@ enum ap_message {
     MSG_SIMSTATE,
     MSG_HWSTATUS,
     MSG_RANGEFINDER,
-    MSG_RETRY_DEFERRED // this must be last
+    MSG_SCHED_STATS,
+    MSG_PERF_SUMMARY,
+    MSG_NEXT_LOG,
+    MSG_STREAM_STATS,
+    MSG_DEFER_STATS,
+    MSG_RETRY_DEFERRED // this must be last, and below 32
 };
 
 //  Logging parameters
@@ -124,6 +151,12 @@ enum ap_message {
 #define LOG_ATTITUDE_MSG        0x08
 #define LOG_MODE_MSG            0x09
 #define LOG_COMPASS_MSG         0x0A
+#define LOG_SCHED_MSG           0x0B
+#define LOG_PERF2_MSG           0x0C
+#define LOG_SERVO_MSG           0x0D
+#define LOG_CTD_MSG             0x0E
+#define LOG_WINCH_MSG           0x0F
+#define LOG_BLACKBOX_ATT_MSG    0x10    // an ATT packet from a black box flush
 
 #define TYPE_AIRSTART_MSG		0x00
 #define TYPE_GROUNDSTART_MSG	0x01
@@ -141,6 +174,19 @@ enum ap_message {
 #define MASK_LOG_CURRENT		(1<<9)
 #define MASK_LOG_SONAR   		(1<<10)
 #define MASK_LOG_COMPASS   		(1<<11)
+#define MASK_LOG_CTD            (1<<12)
+
+// CTD cast events in the CTD log message
+#define CTD_EVENT_START         1
+#define CTD_EVENT_DONE          2
+#define CTD_EVENT_TIMEOUT       3
+#define CTD_EVENT_SAFETY_STOP   4
+
+// black box trigger events, see BBOX_EVENTS
+#define BBOX_EVENT_SNAG         (1<<0)
+#define BBOX_EVENT_CTD_TIMEOUT  (1<<1)
+#define BBOX_EVENT_FAILSAFE     (1<<2)
+#define BBOX_EVENT_MODE         (1<<3)
 
 // Waypoint Modes
 // ----------------
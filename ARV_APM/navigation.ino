@@ -38,12 +38,29 @@ static void navigate()
 }
 
 
+/*
+  the bearing error is filtered with an 8Hz cutoff. The filter
+  coefficients depend on the sample rate, so there is one filter for
+  each loop rate
+ */
 static void calc_bearing_error()
 {    
-    static butter10hz1_6 butter;
+    static butter50hz8_0 butter50;
+    static butter100hz8_0 butter100;
+    static butter200hz8_0 butter200;
 
 	bearing_error_cd = wrap_180_cd(nav_bearing - ahrs.yaw_sensor);
-    bearing_error_cd = butter.filter(bearing_error_cd);
+    switch (ins_sample_rate) {
+    case AP_InertialSensor::RATE_200HZ:
+        bearing_error_cd = butter200.filter(bearing_error_cd);
+        break;
+    case AP_InertialSensor::RATE_100HZ:
+        bearing_error_cd = butter100.filter(bearing_error_cd);
+        break;
+    default:
+        bearing_error_cd = butter50.filter(bearing_error_cd);
+        break;
+    }
 }
 
 static void update_crosstrack(void)
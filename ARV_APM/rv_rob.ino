@@ -51,10 +51,14 @@ static void read_winch(void)
     
     if (g.winch_stall_pin != -1) {
         // Read in stall pin from SDC1130 RoboTeq Motor Controller
+        bool was_snagged = ctd.cast_snagged;
         if (check_digital_pin(g.winch_stall_pin) == 0) ctd.cast_snagged = true;
         else ctd.cast_snagged = false;
           // SDC1130 set to have pin float if Safety Stop is OFF, pulled to GND if ON
           // This should correspond to cast_snagged = 1 if S.S. if OFF, or 0 if S.S. is ON
+        if (ctd.cast_snagged && !was_snagged) {
+            blackbox_trigger(BBOX_EVENT_SNAG);
+        }
     }
 }
 
@@ -68,6 +72,7 @@ static void set_winch(void) {
         g.channel_winch_motor.radio_out  = hal.rcin->read(CH_WINCH_MOTOR);     // Read winch motor commands through
     } //else let the ctd_cast_do function set the a-frame/winch servos
     
+    bool casting = (ctd.cast_end_time_ms > 0 && !ctd.cast_done);
     ctd_cast_do();  // Check to see if we need to be casting the CTD
   
     // Limit motor speed depending on A-frame position
@@ -88,6 +93,9 @@ static void set_winch(void) {
         g.channel_camera_servo.radio_out = g.channel_camera_servo.radio_min;           // Point camera aft                                                                                                                                                                                             
     }
 
+    if (casting && fast_loop_phase == 0 && (g.log_bitmask & MASK_LOG_CTD)) {
+        Log_Write_Winch();   // includes the tick that finishes the cast
+    }
 }  
 
 /*****************************************
@@ -97,8 +105,11 @@ static bool verify_ctd_cast()
 {
     if (ctd.cast_depth_m > 0) {   // There is a CTD cast at this waypoint
         if (ctd.cast_end_time_ms == 0) {    // The cast has not yet been started happened, lets start it
-            ctd.cast_end_time_ms = millis() + CTD_DEPLOY_TIME_MS  + (ctd.cast_depth_m * g.ctd_depth_to_time_ms); 
+            ctd.cast_start_time_ms = millis();
+            ctd.cast_end_time_ms = ctd.cast_start_time_ms + CTD_DEPLOY_TIME_MS  + (ctd.cast_depth_m * g.ctd_depth_to_time_ms); 
             gcs_send_text_fmt(PSTR("Started CTD, %im, %ims"), ctd.cast_depth_m, (ctd.cast_end_time_ms - millis()));                          
+            if (g.log_bitmask & MASK_LOG_CTD)
+                Log_Write_Ctd(CTD_EVENT_START);
             return false;
         } else {                            // The cast has been started
             //gcs_send_text_fmt(PSTR("Current CTD, remaining %ims"), (ctd.cast_end_time_ms - millis()));                          
@@ -127,6 +138,8 @@ static void ctd_cast_do()
                     ctd.cast_done = true;
                     gcs_send_text_fmt(PSTR("CTD Successful, elapsed %ims"), (ctd.cast_end_time_ms - millis()));
                       //Note: for true elapsed time, add started ms time to -1*elapsed                   
+                    if (g.log_bitmask & MASK_LOG_CTD)
+                        Log_Write_Ctd(CTD_EVENT_DONE);
                 }                  
             } 
             
@@ -141,6 +154,9 @@ static void ctd_cast_do()
         } else {
             if (ctd.cast_snagged) gcs_send_text_fmt(PSTR("CTD Safety Stop")); //JMS - need to do more here. Do we try again once?
             else gcs_send_text_fmt(PSTR("CTD Exceeded Time"));
+            if (g.log_bitmask & MASK_LOG_CTD)
+                Log_Write_Ctd(ctd.cast_snagged ? CTD_EVENT_SAFETY_STOP : CTD_EVENT_TIMEOUT);
+            blackbox_trigger(BBOX_EVENT_CTD_TIMEOUT);
             ctd.cast_done = true;
         }
     // } else { // CTD cast is complete or not required, don't need to do anything here
@@ -174,6 +190,7 @@ static void winch_retract(uint16_t winch_speed)
 *****************************************/
 static void ctd_cast_set_for_next()
 {
+    ctd.cast_start_time_ms = 0;
     ctd.cast_end_time_ms = 0;  // reset the cast timer 
     ctd.cast_done = false;     // reset the bool completed flag
         
@@ -116,12 +116,22 @@ static void init_ardupilot()
 						 "\n\nFree RAM: %u\n"),
                     memcheck_available_memory());
                     
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+    // name the EEPROM areas, so the SITL -E report shows which of
+    // them is being read and written
+    AVR_SITL::SITLEEPROMStorage::set_region(0, "params", 0);
+    AVR_SITL::SITLEEPROMStorage::set_region(1, "commands", WP_START_BYTE);
+    AVR_SITL::SITLEEPROMStorage::set_region(2, "spare", WP_START_BYTE + (MAX_WAYPOINTS+1)*WP_SIZE);
+#endif
+
 	//
 	// Check the EEPROM format version before loading any parameters from EEPROM.
 	//
 	
     load_parameters();
 
+    init_loop_rate();
+
     set_control_channels();
 
     // after parameter load setup correct baud rate on uartA
@@ -166,6 +176,12 @@ static void init_ardupilot()
 	}
 #endif
 
+#if BLACKBOX == ENABLED
+    if (g.bbox_events != 0 && !blackbox.init(BLACKBOX_BUFFER_SIZE)) {
+        gcs_send_text_P(SEVERITY_LOW, PSTR("No memory for black box"));
+    }
+#endif
+
 #if CONFIG_HAL_BOARD == HAL_BOARD_APM1
     adc.Init();      // APM ADC library initialization
 #endif
@@ -306,6 +322,7 @@ static void set_mode(enum mode mode)
 	}
 	control_mode = mode;
     throttle_last = 0;
+    blackbox_trigger(BBOX_EVENT_MODE);
     throttle = 500;
 
     if (control_mode != AUTO) {
@@ -367,6 +384,7 @@ static void failsafe_trigger(uint8_t failsafe_type, bool on)
         control_mode != HOLD) {
         failsafe.triggered = failsafe.bits;
         gcs_send_text_fmt(PSTR("Failsafe trigger 0x%x"), (unsigned)failsafe.triggered);
+        blackbox_trigger(BBOX_EVENT_FAILSAFE);
         switch (g.fs_action) {
         case 0:
             break;
@@ -438,6 +456,60 @@ static void update_GPS_light(void)
 }
 
 
+/*
+  set up the main loop timing from the LOOP_RATE parameter
+ */
+static void init_loop_rate(void)
+{
+    switch (g.loop_rate) {
+    case 200:
+        ins_sample_rate = AP_InertialSensor::RATE_200HZ;
+        break;
+    case 100:
+        ins_sample_rate = AP_InertialSensor::RATE_100HZ;
+        break;
+    default:
+        g.loop_rate.set(50);
+        ins_sample_rate = AP_InertialSensor::RATE_50HZ;
+        break;
+    }
+    fast_loop_period_ms = 1000 / g.loop_rate;
+    loops_per_tick      = g.loop_rate / 50;
+    G_Dt                = fast_loop_period_ms * 0.001f;
+}
+
+// histogram times saturate at the top of a uint16_t
+static uint16_t perf_usec(uint32_t usec)
+{
+    return usec > 0xFFFF ? 0xFFFF : usec;
+}
+
+/*
+  summarise the main loop timing histograms into perf_summary and
+  start them again for the next interval
+ */
+static void update_perf_summary(void)
+{
+    perf_summary.loops         = perf_usec(perf_jitter.count());
+    perf_summary.jitter_p50    = perf_usec(perf_jitter.percentile(50));
+    perf_summary.jitter_p99    = perf_usec(perf_jitter.percentile(99));
+    perf_summary.jitter_max    = perf_usec(perf_jitter.max_usec());
+    perf_summary.fast_loop_p50 = perf_usec(perf_fast_loop.percentile(50));
+    perf_summary.fast_loop_p99 = perf_usec(perf_fast_loop.percentile(99));
+    perf_summary.fast_loop_max = perf_usec(perf_fast_loop.max_usec());
+    perf_summary.scheduler_p50 = perf_usec(perf_scheduler.percentile(50));
+    perf_summary.scheduler_p99 = perf_usec(perf_scheduler.percentile(99));
+    perf_summary.scheduler_max = perf_usec(perf_scheduler.max_usec());
+    perf_summary.idle_p50      = perf_usec(perf_idle.percentile(50));
+    perf_summary.idle_p1       = perf_usec(perf_idle.percentile(1));
+    perf_summary.idle_min      = perf_usec(perf_idle.min_usec());
+
+    perf_jitter.reset();
+    perf_fast_loop.reset();
+    perf_scheduler.reset();
+    perf_idle.reset();
+}
+
 static void resetPerfData(void) {
 	mainLoop_count 			= 0;
 	G_Dt_max 				= 0;
@@ -445,6 +517,7 @@ static void resetPerfData(void) {
 	ahrs.renorm_blowup_count = 0;
 	gps_fix_count 			= 0;
 	pmTest1					= 0;
+    DataFlash.reset_buffer_stats();
 	perf_mon_timer 			= millis();
 }
 
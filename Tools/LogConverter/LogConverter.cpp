@@ -0,0 +1,806 @@
+// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+/*
+  convert binary DataFlash logs to columnar files
+
+  Usage: LogConverter [-o outdir] [-c] [-j jobs] [-p page_size] [-f fmtlog] LOG...
+
+  Each LOG is either a log file from DataFlash_File, or a dataflash
+  image such as the dataflash.bin from SITL, which may hold several
+  logs. The messages are described by the FMT messages in the log,
+  and delta encoded messages are expanded. The start of a log that
+  has wrapped round a dataflash image is lost, so -f gives a log to
+  take the FMT messages from as well.
+
+  For each log a directory OUTDIR/NAME (OUTDIR/NAME/LOGNUM for an
+  image) is made holding NAME.col for each message type. A .col file
+  starts with a text header:
+
+    DFCOL 1
+    name GPS
+    rows 1234
+    column Seq uint32 1 4096
+    column Status uint8 1 9032
+    column Time uint32 1 10272
+    ...
+    end
+
+  then the columns, each rows values of the given type stored little
+  endian at the given byte offset, which is a multiple of 8. The
+  number after the type is the scale to multiply by to get the value
+  in the units of the CLI dump; string columns have a type of
+  charN. Seq is the number of the message in the log, to put the
+  message types in order. With -c a .csv file is also written for
+  each message type.
+
+  Logs are converted in parallel, one per thread, including the
+  logs of one image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <LogStructure.h>
+
+// page header of a dataflash image, see DataFlash_Block
+struct PACKED page_header {
+    uint16_t file_number;
+    uint16_t file_page;
+};
+
+#define DEFAULT_PAGE_SIZE 512
+
+// options
+static const char *out_dir = ".";
+static const char *fmt_log = NULL;
+static bool write_csv = false;
+static uint32_t page_size = DEFAULT_PAGE_SIZE;
+
+/*
+  a column of a message type, collected in memory until the log has
+  been read
+ */
+struct Column {
+    std::string label;
+    char fmt;
+    uint8_t size;
+    std::vector<uint8_t> data;
+};
+
+/*
+  a message type, from its FMT message
+ */
+struct MsgType {
+    bool defined;
+    bool delta;
+    uint8_t length;
+    std::string name;
+    std::string format;
+    std::vector<Column> columns;
+    std::vector<uint8_t> prev;
+    bool have_prev;
+    uint32_t rows;
+    FILE *csv;
+};
+
+struct LogStats {
+    uint32_t messages;
+    uint32_t skipped_bytes;
+    uint32_t undecoded;
+};
+
+// FMT messages from the -f log
+static std::vector<struct log_Format> extra_formats;
+
+static bool format_is_string(char fmt)
+{
+    return fmt == 'n' || fmt == 'N' || fmt == 'Z';
+}
+
+/*
+  the column type name and scale of a format character
+ */
+static const char *column_type(char fmt, uint8_t size, char *buf, size_t buflen)
+{
+    switch (fmt) {
+    case 'b': return "int8";
+    case 'B': case 'M': return "uint8";
+    case 'h': case 'c': return "int16";
+    case 'H': case 'C': return "uint16";
+    case 'i': case 'e': case 'L': return "int32";
+    case 'I': case 'E': return "uint32";
+    case 'f': return "float32";
+    }
+    snprintf(buf, buflen, "char%u", (unsigned)size);
+    return buf;
+}
+
+static const char *column_scale(char fmt)
+{
+    switch (fmt) {
+    case 'c': case 'C': case 'e': case 'E':
+        return "0.01";
+    case 'L':
+        return "1e-7";
+    }
+    return "1";
+}
+
+/*
+  print a field as CSV text
+ */
+static void csv_field(FILE *f, char fmt, const uint8_t *p, uint8_t size)
+{
+    int8_t i8; int16_t i16; uint16_t u16; int32_t i32; uint32_t u32; float fl;
+    switch (fmt) {
+    case 'b': memcpy(&i8, p, 1); fprintf(f, "%d", i8); break;
+    case 'B': case 'M': fprintf(f, "%u", p[0]); break;
+    case 'h': memcpy(&i16, p, 2); fprintf(f, "%d", i16); break;
+    case 'H': memcpy(&u16, p, 2); fprintf(f, "%u", u16); break;
+    case 'c': memcpy(&i16, p, 2); fprintf(f, "%.2f", i16*0.01); break;
+    case 'C': memcpy(&u16, p, 2); fprintf(f, "%.2f", u16*0.01); break;
+    case 'i': memcpy(&i32, p, 4); fprintf(f, "%d", i32); break;
+    case 'I': memcpy(&u32, p, 4); fprintf(f, "%u", u32); break;
+    case 'e': memcpy(&i32, p, 4); fprintf(f, "%.2f", i32*0.01); break;
+    case 'E': memcpy(&u32, p, 4); fprintf(f, "%.2f", u32*0.01); break;
+    case 'L': memcpy(&i32, p, 4); fprintf(f, "%.7f", i32*1.0e-7); break;
+    case 'f': memcpy(&fl, p, 4); fprintf(f, "%g", fl); break;
+    default: {
+        // strings, quoted
+        fputc('"', f);
+        for (uint8_t i=0; i<size && p[i] != 0; i++) {
+            if (p[i] == '"') {
+                fputc('"', f);
+            }
+            fputc(p[i], f);
+        }
+        fputc('"', f);
+        break;
+    }
+    }
+}
+
+/*
+  set up a message type from a FMT message
+ */
+static void define_type(MsgType &t, const struct log_Format *f)
+{
+    char name[sizeof(f->name)+1], format[sizeof(f->format)+1], labels[sizeof(f->labels)+1];
+    memcpy(name, f->name, sizeof(f->name)); name[sizeof(f->name)] = 0;
+    memcpy(format, f->format, sizeof(f->format)); format[sizeof(f->format)] = 0;
+    memcpy(labels, f->labels, sizeof(f->labels)); labels[sizeof(f->labels)] = 0;
+
+    t.defined = true;
+    t.length = f->length;
+    t.name = name;
+    t.format = format;
+    t.delta = (format[0] == '*');
+    t.columns.clear();
+    t.prev.assign(t.length > 3 ? t.length - 3 : 0, 0);
+    t.have_prev = false;
+    t.rows = 0;
+    t.csv = NULL;
+    if (t.delta) {
+        return;
+    }
+
+    Column seq;
+    seq.label = "Seq";
+    seq.fmt = 'I';
+    seq.size = 4;
+    t.columns.push_back(seq);
+
+    const char *label = labels;
+    uint16_t ofs = 3;
+    for (uint8_t i=0; format[i] != 0; i++) {
+        Column c;
+        const char *comma = strchr(label, ',');
+        if (comma == NULL) {
+            c.label = label;
+            label += strlen(label);
+        } else {
+            c.label = std::string(label, comma - label);
+            label = comma + 1;
+        }
+        if (c.label.empty()) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "F%u", (unsigned)i);
+            c.label = buf;
+        }
+        c.fmt = format[i];
+        c.size = log_format_size(format[i]);
+        if (c.size == 0 || ofs + c.size > t.length) {
+            break;
+        }
+        ofs += c.size;
+        t.columns.push_back(c);
+    }
+}
+
+/*
+  apply a delta encoded body to the last packet of its type. Returns
+  the bytes used, or -1 if it runs past avail
+ */
+static int32_t apply_delta(MsgType &base, const uint8_t *data, uint32_t avail)
+{
+    uint32_t n = 0;
+    uint16_t ofs = 0;
+    for (uint8_t i=0; i<base.format.size(); i++) {
+        char fmt = base.format[i];
+        uint8_t size = log_format_size(fmt);
+        if (size == 0 || ofs + size > base.prev.size()) {
+            break;
+        }
+        if (format_is_string(fmt)) {
+            if (n >= avail) {
+                return -1;
+            }
+            if (data[n++]) {
+                if (n + size > avail) {
+                    return -1;
+                }
+                memcpy(&base.prev[ofs], &data[n], size);
+                n += size;
+            }
+        } else {
+            uint32_t z = 0;
+            for (uint8_t shift=0; ; shift += 7) {
+                if (n >= avail) {
+                    return -1;
+                }
+                uint8_t b = data[n++];
+                z |= (uint32_t)(b & 0x7F) << shift;
+                if (!(b & 0x80) || shift >= 28) {
+                    break;
+                }
+            }
+            int32_t d = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+            uint32_t v = 0;
+            for (uint8_t j=size; j>0; j--) {
+                v = (v << 8) | base.prev[ofs+j-1];
+            }
+            v += d;
+            for (uint8_t j=0; j<size; j++) {
+                base.prev[ofs+j] = v & 0xFF;
+                v >>= 8;
+            }
+        }
+        ofs += size;
+    }
+    return n;
+}
+
+/*
+  add a packet body to the columns of its type
+ */
+static void add_row(MsgType &t, const uint8_t *body, uint32_t seq, const std::string &dir)
+{
+    Column &s = t.columns[0];
+    s.data.insert(s.data.end(), (const uint8_t *)&seq, (const uint8_t *)&seq + 4);
+    uint16_t ofs = 0;
+    for (size_t i=1; i<t.columns.size(); i++) {
+        Column &c = t.columns[i];
+        c.data.insert(c.data.end(), &body[ofs], &body[ofs+c.size]);
+        ofs += c.size;
+    }
+    t.rows++;
+
+    if (!write_csv) {
+        return;
+    }
+    if (t.csv == NULL) {
+        std::string fname = dir + "/" + t.name + ".csv";
+        t.csv = fopen(fname.c_str(), "w");
+        if (t.csv == NULL) {
+            return;
+        }
+        for (size_t i=0; i<t.columns.size(); i++) {
+            fprintf(t.csv, "%s%s", i?",":"", t.columns[i].label.c_str());
+        }
+        fputc('\n', t.csv);
+    }
+    fprintf(t.csv, "%u", seq);
+    ofs = 0;
+    for (size_t i=1; i<t.columns.size(); i++) {
+        Column &c = t.columns[i];
+        fputc(',', t.csv);
+        csv_field(t.csv, c.fmt, &body[ofs], c.size);
+        ofs += c.size;
+    }
+    fputc('\n', t.csv);
+}
+
+/*
+  write the columns of a message type
+ */
+static bool write_columns(MsgType &t, const std::string &dir)
+{
+    if (t.csv != NULL) {
+        fclose(t.csv);
+        t.csv = NULL;
+    }
+    if (t.rows == 0) {
+        return true;
+    }
+
+    // the header is padded so the first column starts on a page, and
+    // each column is padded to 8 bytes
+    std::string hdr;
+    char line[128];
+    hdr = "DFCOL 1\nname " + t.name + "\n";
+    snprintf(line, sizeof(line), "rows %u\n", t.rows);
+    hdr += line;
+    uint64_t hdr_len = 4096;
+    size_t est = hdr.size() + t.columns.size() * 64 + 8;
+    while (hdr_len < est) {
+        hdr_len += 4096;
+    }
+    uint64_t ofs = hdr_len;
+    for (size_t i=0; i<t.columns.size(); i++) {
+        Column &c = t.columns[i];
+        char tbuf[16];
+        snprintf(line, sizeof(line), "column %s %s %s %llu\n",
+                 c.label.c_str(),
+                 column_type(c.fmt, c.size, tbuf, sizeof(tbuf)),
+                 column_scale(c.fmt),
+                 (unsigned long long)ofs);
+        hdr += line;
+        ofs += (c.data.size() + 7) & ~7ULL;
+    }
+    hdr += "end\n";
+    hdr.resize(hdr_len, 0);
+
+    std::string fname = dir + "/" + t.name + ".col";
+    FILE *f = fopen(fname.c_str(), "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to create %s: %s\n", fname.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(hdr.data(), 1, hdr.size(), f) == hdr.size();
+    static const uint8_t zeros[8] = {};
+    for (size_t i=0; ok && i<t.columns.size(); i++) {
+        Column &c = t.columns[i];
+        ok = fwrite(&c.data[0], 1, c.data.size(), f) == c.data.size();
+        size_t pad = ((c.data.size() + 7) & ~7ULL) - c.data.size();
+        if (ok && pad != 0) {
+            ok = fwrite(zeros, 1, pad, f) == pad;
+        }
+        // release the memory as we go
+        std::vector<uint8_t>().swap(c.data);
+    }
+    if (fclose(f) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write %s\n", fname.c_str());
+    }
+    return ok;
+}
+
+/*
+  make a directory and its parents
+ */
+static bool make_dirs(const std::string &dir)
+{
+    for (size_t i=1; i<=dir.size(); i++) {
+        if (i == dir.size() || dir[i] == '/') {
+            std::string d = dir.substr(0, i);
+            if (mkdir(d.c_str(), 0777) != 0 && errno != EEXIST) {
+                fprintf(stderr, "Failed to create %s: %s\n", d.c_str(), strerror(errno));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+  convert the messages of one log
+ */
+static bool convert_log(const uint8_t *data, uint32_t len, const std::string &dir, LogStats &stats)
+{
+    if (!make_dirs(dir)) {
+        return false;
+    }
+    std::vector<MsgType> types(256);
+    for (uint16_t i=0; i<256; i++) {
+        types[i].defined = false;
+        types[i].csv = NULL;
+    }
+    // FMT describes itself
+    struct log_Format fmt_fmt;
+    memset(&fmt_fmt, 0, sizeof(fmt_fmt));
+    fmt_fmt.type = LOG_FORMAT_MSG;
+    fmt_fmt.length = sizeof(struct log_Format);
+    memcpy(fmt_fmt.name, "FMT", 3);
+    memcpy(fmt_fmt.format, "BBnNZ", 5);
+    memcpy(fmt_fmt.labels, "Type,Length,Name,Format,Labels", 30);
+    define_type(types[LOG_FORMAT_MSG], &fmt_fmt);
+    for (size_t i=0; i<extra_formats.size(); i++) {
+        define_type(types[extra_formats[i].type], &extra_formats[i]);
+    }
+
+    uint32_t ofs = 0;
+    uint32_t seq = 0;
+    while (ofs + 3 <= len) {
+        if (data[ofs] != HEAD_BYTE1 || data[ofs+1] != HEAD_BYTE2 || !types[data[ofs+2]].defined) {
+            ofs++;
+            stats.skipped_bytes++;
+            continue;
+        }
+        uint8_t msg_type = data[ofs+2];
+        MsgType &t = types[msg_type];
+        if (t.delta) {
+            MsgType &base = types[msg_type & ~LOG_DELTA_FLAG];
+            if (!base.defined || base.delta || base.columns.empty()) {
+                ofs++;
+                stats.skipped_bytes++;
+                continue;
+            }
+            int32_t n = apply_delta(base, &data[ofs+3], len - (ofs+3));
+            if (n < 0) {
+                break;
+            }
+            ofs += 3 + n;
+            if (base.have_prev) {
+                add_row(base, &base.prev[0], seq++, dir);
+                stats.messages++;
+            } else {
+                // no full packet to apply it to yet
+                stats.undecoded++;
+            }
+            continue;
+        }
+        if (t.length < 3 || ofs + t.length > len) {
+            break;
+        }
+        const uint8_t *body = &data[ofs+3];
+        if (msg_type == LOG_FORMAT_MSG) {
+            const struct log_Format *f = (const struct log_Format *)&data[ofs];
+            if (f->type != LOG_FORMAT_MSG && f->length >= 3) {
+                if (types[f->type].defined && types[f->type].rows != 0) {
+                    write_columns(types[f->type], dir);
+                }
+                define_type(types[f->type], f);
+            }
+        }
+        if (!t.columns.empty()) {
+            add_row(t, body, seq++, dir);
+            stats.messages++;
+        }
+        if (!(msg_type & LOG_DELTA_FLAG) && t.prev.size() == (size_t)(t.length - 3)) {
+            memcpy(&t.prev[0], body, t.prev.size());
+            t.have_prev = true;
+        }
+        ofs += t.length;
+    }
+    stats.skipped_bytes += len - ofs;
+
+    bool ok = true;
+    for (uint16_t i=0; i<256; i++) {
+        if (types[i].defined && !write_columns(types[i], dir)) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/*
+  split a dataflash image into its logs, as the offsets of their
+  pages in page order
+ */
+static void image_logs(const uint8_t *data, uint32_t len,
+                       std::map<uint16_t, std::vector<uint32_t> > &logs)
+{
+    std::map<uint16_t, std::map<uint16_t, uint32_t> > pages;
+    for (uint32_t ofs=0; ofs + page_size <= len; ofs += page_size) {
+        struct page_header h;
+        memcpy(&h, &data[ofs], sizeof(h));
+        // erased pages are 0xFF, or holes of zeros in a sparse image
+        if (h.file_number == 0 || h.file_number == 0xFFFF || h.file_page == 0xFFFF) {
+            continue;
+        }
+        pages[h.file_number][h.file_page] = ofs;
+    }
+    std::map<uint16_t, std::map<uint16_t, uint32_t> >::iterator it;
+    for (it=pages.begin(); it != pages.end(); it++) {
+        std::vector<uint32_t> &log = logs[it->first];
+        std::map<uint16_t, uint32_t>::iterator p;
+        for (p=it->second.begin(); p != it->second.end(); p++) {
+            log.push_back(p->second);
+        }
+    }
+}
+
+/*
+  an input file, mapped into memory until all of its logs have been
+  converted
+ */
+struct InputFile {
+    const char *name;
+    const uint8_t *data;
+    uint32_t len;
+    uint16_t num_logs;
+    uint16_t pending;
+    bool ok;
+    LogStats stats;
+};
+
+/*
+  a log to convert. For an image the log is gathered from its pages
+  by the worker converting it
+ */
+struct Job {
+    InputFile *file;
+    std::string dir;
+    std::vector<uint32_t> pages;
+};
+
+static pthread_mutex_t next_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timeval start_time;
+
+/*
+  map an input file and add a job for each of its logs
+ */
+static bool open_file(const char *fname, std::vector<Job> &jobs)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Empty log %s\n", fname);
+        close(fd);
+        return false;
+    }
+    uint32_t len = st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", fname, strerror(errno));
+        return false;
+    }
+    const uint8_t *data = (const uint8_t *)map;
+
+    // name the output after the file, less its directory and extension
+    std::string base = fname;
+    size_t slash = base.rfind('/');
+    if (slash != std::string::npos) {
+        base = base.substr(slash+1);
+    }
+    size_t dot = base.rfind('.');
+    if (dot != std::string::npos && dot != 0) {
+        base = base.substr(0, dot);
+    }
+    std::string dir = std::string(out_dir) + "/" + base;
+
+    InputFile *file = new InputFile;
+    file->name = fname;
+    file->data = data;
+    file->len = len;
+    file->ok = true;
+    memset(&file->stats, 0, sizeof(file->stats));
+
+    if (len >= 3 && data[0] == HEAD_BYTE1 && data[1] == HEAD_BYTE2) {
+        // a log file
+        madvise(map, len, MADV_SEQUENTIAL);
+        Job job;
+        job.file = file;
+        job.dir = dir;
+        jobs.push_back(job);
+        file->num_logs = 1;
+    } else {
+        // a dataflash image with page headers, one job per log
+        std::map<uint16_t, std::vector<uint32_t> > logs;
+        image_logs(data, len, logs);
+        std::map<uint16_t, std::vector<uint32_t> >::iterator it;
+        for (it=logs.begin(); it != logs.end(); it++) {
+            char num[8];
+            snprintf(num, sizeof(num), "/%u", (unsigned)it->first);
+            Job job;
+            job.file = file;
+            job.dir = dir + num;
+            jobs.push_back(job);
+            jobs.back().pages.swap(it->second);
+        }
+        file->num_logs = logs.size();
+    }
+    file->pending = file->num_logs;
+    if (file->pending == 0) {
+        printf("%s: no logs\n", fname);
+        munmap(map, len);
+        delete file;
+    }
+    return true;
+}
+
+/*
+  convert one log, and when it is the last of its file print the
+  totals for the file
+ */
+static void convert_job(Job &job)
+{
+    InputFile *file = job.file;
+    LogStats stats;
+    memset(&stats, 0, sizeof(stats));
+    bool ok;
+    if (job.pages.empty()) {
+        ok = convert_log(file->data, file->len, job.dir, stats);
+    } else {
+        const uint32_t body = page_size - sizeof(struct page_header);
+        std::vector<uint8_t> log(job.pages.size() * body);
+        for (size_t i=0; i<job.pages.size(); i++) {
+            memcpy(&log[i*body], &file->data[job.pages[i] + sizeof(struct page_header)], body);
+        }
+        ok = convert_log(&log[0], log.size(), job.dir, stats);
+    }
+
+    pthread_mutex_lock(&next_lock);
+    file->stats.messages      += stats.messages;
+    file->stats.skipped_bytes += stats.skipped_bytes;
+    file->stats.undecoded     += stats.undecoded;
+    if (!ok) {
+        file->ok = false;
+    }
+    bool done = (--file->pending == 0);
+    pthread_mutex_unlock(&next_lock);
+    if (!done) {
+        return;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    double dt = (tv.tv_sec - start_time.tv_sec) + (tv.tv_usec - start_time.tv_usec)*1.0e-6;
+    printf("%s: %u logs %u messages %u skipped bytes %u undecoded deltas, %.1f MB done at %.2fs\n",
+           file->name, (unsigned)file->num_logs, file->stats.messages, file->stats.skipped_bytes,
+           file->stats.undecoded, file->len/1.0e6, dt);
+    munmap((void *)file->data, file->len);
+}
+
+/*
+  load the FMT messages of a log for -f
+ */
+static bool load_formats(const char *fname)
+{
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+        return false;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(f);
+    for (size_t ofs=0; ofs + sizeof(struct log_Format) <= data.size(); ofs++) {
+        struct log_Format fmt;
+        memcpy(&fmt, &data[ofs], sizeof(fmt));
+        if (fmt.head1 == HEAD_BYTE1 && fmt.head2 == HEAD_BYTE2 &&
+            fmt.msgid == LOG_FORMAT_MSG && fmt.type != LOG_FORMAT_MSG && fmt.length >= 3) {
+            extra_formats.push_back(fmt);
+            ofs += sizeof(fmt) - 1;
+        }
+    }
+    if (extra_formats.empty()) {
+        fprintf(stderr, "No FMT messages in %s\n", fname);
+        return false;
+    }
+    return true;
+}
+
+/*
+  the worker threads take the next log from the list of jobs, so the
+  logs of one image are converted in parallel as well
+ */
+static size_t next_job;
+static bool all_ok = true;
+
+static void *worker(void *arg)
+{
+    std::vector<Job> &jobs = *(std::vector<Job> *)arg;
+    while (true) {
+        pthread_mutex_lock(&next_lock);
+        size_t i = next_job++;
+        pthread_mutex_unlock(&next_lock);
+        if (i >= jobs.size()) {
+            break;
+        }
+        convert_job(jobs[i]);
+    }
+    return NULL;
+}
+
+static void usage(void)
+{
+    printf("Usage: LogConverter [-o outdir] [-c] [-j jobs] [-p page_size] [-f fmtlog] LOG...\n");
+    printf("  -o outdir     directory for the converted logs (default .)\n");
+    printf("  -c            also write a CSV file for each message type\n");
+    printf("  -j jobs       number of logs to convert at once (default number of CPUs)\n");
+    printf("  -p page_size  page size of dataflash images (default %u)\n", DEFAULT_PAGE_SIZE);
+    printf("  -f fmtlog     also take message formats from this log\n");
+}
+
+int main(int argc, char *argv[])
+{
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "o:cj:p:f:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 'c':
+            write_csv = true;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'p':
+            page_size = atoi(optarg);
+            break;
+        case 'f':
+            fmt_log = optarg;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc || page_size <= sizeof(struct page_header)) {
+        usage();
+        return 1;
+    }
+    if (!make_dirs(out_dir)) {
+        return 1;
+    }
+    if (fmt_log != NULL && !load_formats(fmt_log)) {
+        return 1;
+    }
+
+    gettimeofday(&start_time, NULL);
+    std::vector<Job> log_jobs;
+    for (int i=optind; i<argc; i++) {
+        if (!open_file(argv[i], log_jobs)) {
+            all_ok = false;
+        }
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > (long)log_jobs.size()) {
+        jobs = log_jobs.size();
+    }
+
+    std::vector<pthread_t> threads(jobs);
+    for (long i=0; i<jobs; i++) {
+        if (pthread_create(&threads[i], NULL, worker, &log_jobs) != 0) {
+            fprintf(stderr, "Failed to start thread\n");
+            return 1;
+        }
+    }
+    for (long i=0; i<jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (size_t i=0; i<log_jobs.size(); i++) {
+        if (!log_jobs[i].file->ok) {
+            all_ok = false;
+        }
+    }
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,335 @@
+#!/usr/bin/env python
+'''
+run the same mission many times in SITL with randomised water current,
+GPS noise, compass error and CTD winch snags, spread over all the cores of the machine,
+and produce a merged report of cross-track error, time on station and
+CTD success rate
+
+each run uses the built-in vessel model with the synthetic clock, so
+runs go much faster than realtime and do not need sim_rover.py. Each
+worker gets its own SITL instance number (and so its own block of
+ports) and each run gets its own directory holding its eeprom.bin,
+dataflash.bin and console output. With --record a failed run also
+keeps inputs.rec, which plays it back exactly with ARV_APM.elf -P.
+Loop timing is not reported, as under the synthetic clock it says
+nothing about the timing on a real board
+'''
+
+import os, sys, time, math, random, shutil, signal
+import optparse, subprocess, multiprocessing
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.realpath(__file__)), 'pysim'))
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.realpath(__file__)), '..', '..', '..', 'mavlink', 'pymavlink'))
+import util
+
+# vehicle modes, see enum mode in ARV_APM/defines.h
+MANUAL = 0
+HOLD   = 4
+AUTO   = 10
+
+# SIM_ parameters randomised for each run, as (name, low, high). The
+# high end of each range can be scaled with --severity
+RANDOM_PARAMS = [
+    ('SIM_CURR_SPD',  0.0, 0.5),
+    ('SIM_CURR_DIR',  0.0, 360.0),
+    ('SIM_GPS_NOISE', 0.0, 1.5),
+    ('SIM_MAG_ERROR', -5.0, 5.0),
+    ('SIM_WINCH_SNAG', 0.0, 0.3),
+]
+
+def run_params(seed, severity):
+    '''pick the randomised parameters for a run'''
+    rng = random.Random(seed)
+    params = {}
+    for (name, low, high) in RANDOM_PARAMS:
+        if name == 'SIM_CURR_DIR':
+            params[name] = rng.uniform(low, high)
+        else:
+            params[name] = rng.uniform(low, high) * severity
+    return params
+
+
+def upload_mission(mav, filename):
+    '''upload a QGC WPL mission file'''
+    import mavwp
+    wploader = mavwp.MAVWPLoader()
+    wploader.target_system = mav.target_system
+    wploader.target_component = mav.target_component
+    wploader.load(filename)
+    mav.waypoint_count_send(wploader.count())
+    while True:
+        m = mav.recv_match(type=['MISSION_REQUEST', 'MISSION_ACK'], blocking=True, timeout=10)
+        if m is None:
+            return False
+        if m.get_type() == 'MISSION_ACK':
+            return m.type == 0
+        mav.mav.send(wploader.wp(m.seq))
+
+
+def set_param(mav, name, value):
+    '''set a parameter, waiting for the vehicle to echo it back'''
+    for retry in range(5):
+        mav.param_set_send(name, value)
+        m = mav.recv_match(type='PARAM_VALUE', blocking=True, timeout=2)
+        while m is not None and m.param_id.rstrip('\0') != name:
+            m = mav.recv_match(type='PARAM_VALUE', blocking=True, timeout=2)
+        if m is not None and abs(m.param_value - value) < 0.001 * max(1, abs(value)):
+            return True
+    return False
+
+
+def wait_mode(mav, mode, timeout):
+    '''wait for the vehicle to report a mode'''
+    tstart = time.time()
+    while time.time() - tstart < timeout:
+        m = mav.recv_match(type='HEARTBEAT', blocking=True, timeout=1)
+        if m is not None and m.custom_mode == mode:
+            return True
+    return False
+
+
+class RunResult(object):
+    '''the measurements from one run'''
+    def __init__(self, run, seed, params):
+        self.run = run
+        self.seed = seed
+        self.params = params
+        self.completed = False
+        self.sim_time = 0
+        self.xtrack_rms = 0
+        self.xtrack_max = 0
+        self.casts = 0
+        self.casts_ok = 0
+        self.time_on_station = 0
+        self.error = None
+
+
+def fly_run(run, seed, instance, opts):
+    '''run one mission in its own directory on the given SITL instance'''
+    import mavutil
+    params = run_params(seed, opts.severity)
+    result = RunResult(run, seed, params)
+    run_dir = os.path.join(opts.outdir, 'run%04u' % run)
+    if os.path.exists(run_dir):
+        shutil.rmtree(run_dir)
+    os.makedirs(run_dir)
+
+    cmd = [opts.binary, '-S', '-w', '-M', 'vessel',
+           '-I', str(instance), '-R', str(seed)]
+    if opts.home:
+        cmd.extend(['-O', opts.home])
+    if opts.record:
+        cmd.extend(['-L', 'inputs.rec'])
+    console = open(os.path.join(run_dir, 'console.txt'), 'w')
+    sil = subprocess.Popen(cmd, cwd=run_dir, stdout=console, stderr=subprocess.STDOUT)
+    try:
+        port = 5760 + 10*instance
+        mav = None
+        tstart = time.time()
+        while mav is None and time.time() - tstart < 10:
+            try:
+                mav = mavutil.mavlink_connection('tcp:127.0.0.1:%u' % port, robust_parsing=True)
+            except Exception:
+                time.sleep(0.1)
+        if mav is None:
+            result.error = 'no connection on port %u' % port
+            return result
+        mav.wait_heartbeat()
+        if not wait_mode(mav, MANUAL, 60):
+            result.error = 'vehicle did not initialise'
+            return result
+        for name in sorted(params.keys()):
+            if not set_param(mav, name, params[name]):
+                result.error = 'failed to set %s' % name
+                return result
+        # the synthetic clock runs far faster than realtime, so slow it
+        # down while uploading or the vehicle times out the upload
+        set_param(mav, 'SIM_SPEEDUP', 5)
+        for retry in range(3):
+            if upload_mission(mav, opts.mission):
+                break
+        else:
+            result.error = 'mission upload failed'
+            return result
+        set_param(mav, 'SIM_SPEEDUP', opts.speedup)
+        # only start the telemetry streams once the mission is loaded,
+        # to keep the link quiet during the upload
+        mav.mav.request_data_stream_send(mav.target_system, mav.target_component,
+                                         mavutil.mavlink.MAV_DATA_STREAM_ALL, opts.rate, 1)
+        mav.mav.set_mode_send(mav.target_system,
+                              mavutil.mavlink.MAV_MODE_FLAG_CUSTOM_MODE_ENABLED, AUTO)
+
+        # follow the mission, measuring in simulated time
+        in_auto = False
+        xtrack_sum = 0.0
+        xtrack_count = 0
+        cast_start = None
+        boot_ms = 0
+        start_ms = None
+        tstart = time.time()
+        while time.time() - tstart < opts.timeout:
+            m = mav.recv_match(blocking=True, timeout=1)
+            if m is None:
+                if sil.poll() is not None:
+                    result.error = 'SITL exited with %d' % sil.returncode
+                    break
+                continue
+            mtype = m.get_type()
+            if hasattr(m, 'time_boot_ms'):
+                boot_ms = m.time_boot_ms
+                if start_ms is None and in_auto:
+                    start_ms = boot_ms
+            if mtype == 'HEARTBEAT':
+                if m.custom_mode == AUTO:
+                    in_auto = True
+                elif in_auto:
+                    result.completed = (m.custom_mode == HOLD)
+                    break
+            elif mtype == 'NAV_CONTROLLER_OUTPUT' and in_auto and cast_start is None:
+                xtrack_sum += m.xtrack_error**2
+                xtrack_count += 1
+                result.xtrack_max = max(result.xtrack_max, abs(m.xtrack_error))
+            elif mtype == 'STATUSTEXT':
+                text = m.text.rstrip('\0')
+                if text.startswith('Started CTD'):
+                    result.casts += 1
+                    cast_start = boot_ms
+                elif text.startswith('CTD '):
+                    if text.startswith('CTD Successful'):
+                        result.casts_ok += 1
+                    if cast_start is not None:
+                        result.time_on_station += (boot_ms - cast_start) * 0.001
+                    cast_start = None
+        else:
+            result.error = 'timed out'
+        if start_ms is not None:
+            result.sim_time = (boot_ms - start_ms) * 0.001
+        if xtrack_count > 0:
+            result.xtrack_rms = math.sqrt(xtrack_sum / xtrack_count)
+    except Exception, e:
+        result.error = str(e)
+    finally:
+        if sil.poll() is None:
+            sil.terminate()
+            sil.wait()
+        console.close()
+
+    if not opts.keep and result.completed:
+        for f in ['eeprom.bin', 'inputs.rec']:
+            util.rmfile(os.path.join(run_dir, f))
+    return result
+
+
+# each worker process owns one SITL instance number for its lifetime
+worker_instance = None
+worker_opts = None
+
+def worker_init(instances, opts):
+    global worker_instance, worker_opts
+    signal.signal(signal.SIGINT, signal.SIG_IGN)
+    worker_instance = instances.get()
+    worker_opts = opts
+
+def worker_run(args):
+    (run, seed) = args
+    return fly_run(run, seed, worker_instance, worker_opts)
+
+
+def percentile(values, pct):
+    '''return a percentile of a list of numbers'''
+    if len(values) == 0:
+        return 0
+    values = sorted(values)
+    return values[min(len(values)-1, int(pct * 0.01 * len(values)))]
+
+
+def write_report(results, opts):
+    '''write the per-run CSV and print the merged summary'''
+    pnames = [p[0] for p in RANDOM_PARAMS]
+    csv = open(os.path.join(opts.outdir, 'report.csv'), 'w')
+    csv.write('run,seed,%s,completed,sim_time,xtrack_rms,xtrack_max,casts,casts_ok,time_on_station,error\n' %
+              ','.join(pnames))
+    for r in results:
+        csv.write('%u,%u,%s,%u,%.1f,%.2f,%.2f,%u,%u,%.1f,%s\n' % (
+            r.run, r.seed, ','.join(['%.3f' % r.params[p] for p in pnames]),
+            r.completed, r.sim_time, r.xtrack_rms, r.xtrack_max,
+            r.casts, r.casts_ok, r.time_on_station,
+            r.error or ''))
+    csv.close()
+
+    completed = [r for r in results if r.completed]
+    casts = sum([r.casts for r in results])
+    casts_ok = sum([r.casts_ok for r in results])
+    print("")
+    print("Runs:               %u (%u completed, %u failed)" % (
+        len(results), len(completed), len(results) - len(completed)))
+    for (label, values) in [('Cross-track RMS m', [r.xtrack_rms for r in completed]),
+                            ('Cross-track max m', [r.xtrack_max for r in completed]),
+                            ('Time on station s', [r.time_on_station for r in completed]),
+                            ('Mission time s',    [r.sim_time for r in completed])]:
+        if len(values) == 0:
+            continue
+        print("%-19s mean %7.2f  p50 %7.2f  p95 %7.2f  max %7.2f" % (
+            label + ':', sum(values) / len(values), percentile(values, 50),
+            percentile(values, 95), max(values)))
+    if casts > 0:
+        print("CTD success:        %u/%u (%.1f%%)" % (casts_ok, casts, 100.0 * casts_ok / casts))
+    for r in results:
+        if r.error is not None:
+            print("run %u (seed %u): %s" % (r.run, r.seed, r.error))
+    print("Report in %s" % os.path.join(opts.outdir, 'report.csv'))
+
+
+############## main program #############
+parser = optparse.OptionParser("montecarlo.py [options]")
+parser.add_option("--runs", type='int', default=100, help='number of runs')
+parser.add_option("-j", "--jobs", type='int', default=multiprocessing.cpu_count(),
+                  help='number of SITL instances to run at once')
+parser.add_option("--mission", default=os.path.join(util.reltopdir('Tools/autotest'), 'rover1.txt'),
+                  help='mission file to drive')
+parser.add_option("--binary", default='/tmp/ARV_APM.build/ARV_APM.elf', help='SITL executable')
+parser.add_option("--home", default=None, help='home location as lat,lng,alt,hdg')
+parser.add_option("--outdir", default='montecarlo', help='directory for run results')
+parser.add_option("--seed", type='int', default=1, help='seed of the first run')
+parser.add_option("--severity", type='float', default=1.0, help='scale the random disturbances')
+parser.add_option("--instance", type='int', default=0, help='first SITL instance number to use')
+parser.add_option("--timeout", type='float', default=600, help='wall clock timeout per run in seconds')
+parser.add_option("--rate", type='int', default=10, help='telemetry stream rate')
+parser.add_option("--speedup", type='float', default=0, help='limit on simulated time per wall clock time, 0 for none')
+parser.add_option("--keep", action='store_true', default=False, help='keep eeprom.bin and inputs.rec of good runs')
+parser.add_option("--record", action='store_true', default=False,
+                  help='record the inputs of each run to inputs.rec, for playback with ARV_APM.elf -P')
+
+opts, args = parser.parse_args()
+
+if not os.path.exists(opts.binary):
+    print("SITL binary %s not found, build it with 'make sitl' in ARV_APM" % opts.binary)
+    sys.exit(1)
+opts.mission = os.path.realpath(opts.mission)
+opts.binary = os.path.realpath(opts.binary)
+opts.outdir = os.path.realpath(opts.outdir)
+util.mkdir_p(opts.outdir)
+
+instances = multiprocessing.Queue()
+for i in range(opts.jobs):
+    instances.put(opts.instance + i)
+pool = multiprocessing.Pool(opts.jobs, worker_init, (instances, opts))
+
+print("Running %u runs of %s on %u instances" % (opts.runs, opts.mission, opts.jobs))
+tstart = time.time()
+results = []
+try:
+    for r in pool.imap_unordered(worker_run, [(i, opts.seed + i) for i in range(opts.runs)]):
+        results.append(r)
+        print("run %u: %s xtrack_rms %.2f casts %u/%u%s" % (
+            r.run, 'OK' if r.completed else 'FAILED', r.xtrack_rms,
+            r.casts_ok, r.casts, (' (%s)' % r.error) if r.error else ''))
+    pool.close()
+except KeyboardInterrupt:
+    pool.terminate()
+    print("Interrupted")
+pool.join()
+results.sort(key=lambda r: r.run)
+print("Finished in %.1f seconds" % (time.time() - tstart))
+write_report(results, opts)
+sys.exit(0 if len(results) > 0 and all([r.completed for r in results]) else 1)
@@ -63,7 +63,7 @@ class Rover(Aircraft):
         steer = 0.5 * lat_accel * mincircle / (speed**2)
         return steer * 35
 
-    def update(self, state):
+    def update(self, state, delta_time=None):
 
         # if in skid steering mode the steering and throttle values are used for motor1 and motor2
         if self.skid_steering:
@@ -75,9 +75,11 @@ class Rover(Aircraft):
             steering = state.steering
             throttle = state.throttle
 
-        # how much time has passed?
+        # how much time has passed? In lockstep mode the caller
+        # gives us a fixed time step instead
         t = time.time()
-        delta_time = t - self.last_time
+        if delta_time is None:
+            delta_time = t - self.last_time
         self.last_time = t
 
         # speed in m/s in body frame
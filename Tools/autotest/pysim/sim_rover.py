@@ -77,6 +77,7 @@ parser.add_option("--simout", dest="simout",  help="SIM output (IP:port)",
 parser.add_option("--home", dest="home",  type='string', default=None, help="home lat,lng,alt,hdg (required)")
 parser.add_option("--rate", dest="rate", type='int', help="SIM update rate", default=100)
 parser.add_option("--skid-steering", action='store_true', default=False, help="Use skid steering")
+parser.add_option("--lockstep", action='store_true', default=False, help="step once per SITL frame (for SITL -S)")
 
 (opts, args) = parser.parse_args()
 
@@ -93,7 +94,7 @@ sim_in_address  = interpret_address(opts.simin)
 # setup input from SITL
 sim_in = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
 sim_in.bind(sim_in_address)
-sim_in.setblocking(0)
+sim_in.setblocking(opts.lockstep)
 
 # setup output to SITL
 sim_out = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
@@ -131,6 +132,14 @@ print("Starting at lat=%f lon=%f alt=%f heading=%.1f" % (
 frame_time = 1.0/opts.rate
 sleep_overhead = 0
 
+if opts.lockstep:
+    # SITL blocks until we answer each frame, so step the model by a
+    # fixed amount per frame and never sleep
+    while True:
+        sim_recv(state)
+        a.update(state, frame_time)
+        sim_send(a)
+
 while True:
     frame_start = time.time()
     sim_recv(state)
@@ -0,0 +1,210 @@
+#!/usr/bin/env python
+
+'''
+download DataFlash logs from a rover over a MAVLink telemetry link
+
+This uses the DATA16/DATA96 log download messages of the ARV_APM
+firmware, see GCS_MAVLINK::handle_log_request(). Several ranges of the
+log are asked for at once, and any parts lost on the link are asked for
+again until the whole log has arrived. The firmware keeps the download
+to part of the link, so normal telemetry carries on while it runs.
+
+With --msg-type or --start-time only part of the log is downloaded,
+from an offset found with the firmware's log index. The FMT messages
+from the start of the log are put in front of it, so it can be read on
+its own
+'''
+
+import sys, time, struct
+
+from optparse import OptionParser
+parser = OptionParser("mavlink_log_download.py [options] <DEVICE>")
+parser.add_option("--baudrate", type='int', default=57600, help="serial baud rate")
+parser.add_option("--list", action='store_true', default=False, help="only list the logs")
+parser.add_option("--log", type='int', default=None, help="log number to download, default the last")
+parser.add_option("--output", default=None, help="output file, default log<N>.bin")
+parser.add_option("--window", type='int', default=8, help="number of ranges to ask for at once")
+parser.add_option("--chunk", type='int', default=4050, help="bytes in each range")
+parser.add_option("--timeout", type='float', default=2.0, help="seconds without data before asking again")
+parser.add_option("--msg-type", type='int', default=0, help="start at the first message of this type id")
+parser.add_option("--start-time", type='int', default=0, help="start at this GPS time of week in ms")
+
+(opts, args) = parser.parse_args()
+
+from pymavlink import mavutil
+
+if len(args) < 1:
+    print("Usage: mavlink_log_download.py [options] <DEVICE>")
+    sys.exit(1)
+
+# DATA16/DATA96 types, see ARV_APM/defines.h
+DATAMSG_TYPE_LOG_LIST = 0xFB
+DATAMSG_TYPE_LOG_DATA = 0xFA
+DATAMSG_TYPE_LOG_END  = 0xF9
+DATAMSG_TYPE_LOG_SEEK = 0xF6
+
+# the first message after the FMT messages, see LogStructure.h
+LOG_PARAMETER_MSG = 129
+
+# data bytes in a full DATA96 log_data
+BLOCK_SIZE = 90
+
+def send_data16(mav, type, payload):
+    '''send a DATA16 with the given payload'''
+    data = [ord(c) for c in payload] if isinstance(payload, str) else list(bytearray(payload))
+    mav.mav.data16_send(type, len(data), data + [0]*(16-len(data)))
+
+def data_bytes(m):
+    '''the payload of a DATA message as a byte string'''
+    return bytes(bytearray(m.data[:m.len]))
+
+def list_logs(mav):
+    '''return a dictionary of log number to size'''
+    send_data16(mav, DATAMSG_TYPE_LOG_LIST, struct.pack('<HH', 0, 0xFFFF))
+    logs = {}
+    num_logs = None
+    while num_logs is None or len(logs) < num_logs:
+        m = mav.recv_match(type='DATA16', blocking=True, timeout=5)
+        if m is None:
+            break
+        if m.type != DATAMSG_TYPE_LOG_LIST:
+            continue
+        (id, num_logs, last_log_num, size) = struct.unpack('<HHHI', data_bytes(m)[:10])
+        if id == 0:
+            break
+        logs[id] = size
+    return logs
+
+def seek_log(mav, log_num, msg_type, gps_time_ms):
+    '''return the offset in a log of the first message of msg_type, or
+    of any type if it is 0, from gps_time_ms on, or None'''
+    t_start = time.time()
+    while time.time() - t_start < 60:
+        send_data16(mav, DATAMSG_TYPE_LOG_SEEK, struct.pack('<HBIi', log_num, msg_type, gps_time_ms, 0))
+        m = mav.recv_match(type='DATA16', blocking=True, timeout=1)
+        if m is None or m.type != DATAMSG_TYPE_LOG_SEEK:
+            continue
+        (id, type, time_ms, ofs) = struct.unpack('<HBIi', data_bytes(m)[:11])
+        if id != log_num or type != msg_type or time_ms != gps_time_ms:
+            continue
+        if ofs == -2:
+            # the log index is still being built
+            continue
+        if ofs < 0:
+            return None
+        return ofs
+    return None
+
+def missing_ranges(have, size, max_ranges):
+    '''return up to max_ranges (ofs, count) ranges of blocks not yet received'''
+    ranges = []
+    nblocks = len(have)
+    i = 0
+    while i < nblocks and len(ranges) < max_ranges:
+        if have[i]:
+            i += 1
+            continue
+        start = i
+        while i < nblocks and not have[i] and (i - start) * BLOCK_SIZE < opts.chunk:
+            i += 1
+        ranges.append((start * BLOCK_SIZE, min(i * BLOCK_SIZE, size) - start * BLOCK_SIZE))
+    return ranges
+
+def download_log(mav, log_num, start, end):
+    '''download bytes start to end of a log, returning them'''
+    size = end - start
+    data = bytearray(size)
+    nblocks = (size + BLOCK_SIZE - 1) // BLOCK_SIZE
+    have = [False] * nblocks
+    received = 0
+    pending = {}
+    next_ofs = 0
+    last_data = time.time()
+    t_start = time.time()
+    while received < nblocks:
+        # keep the window full of requests working through the log,
+        # and once it has all been asked for, ask again for what is
+        # missing
+        while len(pending) < opts.window and next_ofs < size:
+            count = min(opts.chunk, size - next_ofs)
+            send_data16(mav, DATAMSG_TYPE_LOG_DATA, struct.pack('<HII', log_num, start + next_ofs, count))
+            pending[next_ofs + count] = True
+            next_ofs += count
+        if next_ofs >= size and len(pending) == 0:
+            for (ofs, count) in missing_ranges(have, size, opts.window):
+                send_data16(mav, DATAMSG_TYPE_LOG_DATA, struct.pack('<HII', log_num, start + ofs, count))
+                pending[ofs + count] = True
+            last_data = time.time()
+        m = mav.recv_match(type='DATA96', blocking=True, timeout=0.5)
+        if m is None or m.type != DATAMSG_TYPE_LOG_DATA:
+            if time.time() - last_data > opts.timeout:
+                # the rest of the ranges have been lost
+                pending = {}
+            continue
+        payload = data_bytes(m)
+        (id, ofs) = struct.unpack('<HI', payload[:6])
+        if id != log_num or ofs < start:
+            continue
+        ofs -= start
+        last_data = time.time()
+        block = payload[6:]
+        n = len(block)
+        if ofs + n > size:
+            n = size - ofs
+        if n > 0:
+            data[ofs:ofs+n] = block[:n]
+            for i in range(ofs // BLOCK_SIZE, (ofs + n + BLOCK_SIZE - 1) // BLOCK_SIZE):
+                if not have[i]:
+                    have[i] = True
+                    received += 1
+        if ofs + n in pending:
+            del pending[ofs + n]
+        if len(block) < BLOCK_SIZE and ofs + len(block) < size:
+            # the log is shorter than listed
+            size = ofs + len(block)
+            break
+    dt = time.time() - t_start
+    print("Downloaded log %u from %u: %u bytes in %.1fs, %.0f bytes/s" % (log_num, start, size, dt, size/max(dt, 0.001)))
+    return data[:size]
+
+mav = mavutil.mavlink_connection(args[0], baud=opts.baudrate)
+mav.wait_heartbeat()
+
+logs = list_logs(mav)
+if len(logs) == 0:
+    print("No logs")
+    send_data16(mav, DATAMSG_TYPE_LOG_END, '')
+    sys.exit(1)
+for n in sorted(logs.keys()):
+    print("Log %u size %u" % (n, logs[n]))
+
+if not opts.list:
+    log_num = opts.log
+    if log_num is None:
+        log_num = max(logs.keys())
+    if not log_num in logs:
+        print("No log %u" % log_num)
+        send_data16(mav, DATAMSG_TYPE_LOG_END, '')
+        sys.exit(1)
+    if opts.msg_type == 0 and opts.start_time == 0:
+        data = download_log(mav, log_num, 0, logs[log_num])
+    else:
+        start = seek_log(mav, log_num, opts.msg_type, opts.start_time)
+        if start is None:
+            print("No match in log %u" % log_num)
+            send_data16(mav, DATAMSG_TYPE_LOG_END, '')
+            sys.exit(1)
+        fmt_end = seek_log(mav, log_num, LOG_PARAMETER_MSG, 0)
+        if fmt_end is None or fmt_end > start:
+            fmt_end = 0
+        data = download_log(mav, log_num, 0, fmt_end)
+        data += download_log(mav, log_num, start, logs[log_num])
+    output = opts.output
+    if output is None:
+        output = 'log%u.bin' % log_num
+    f = open(output, 'wb')
+    f.write(data)
+    f.close()
+    print("Saved %s" % output)
+
+send_data16(mav, DATAMSG_TYPE_LOG_END, '')
@@ -3,6 +3,7 @@
 #define __AP_HAL_UART_DRIVER_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "AP_HAL_Namespace.h"
 #include "utility/BetterStream.h"
@@ -38,6 +39,30 @@ public:
     virtual bool is_initialized() = 0;
     virtual void set_blocking_writes(bool blocking) = 0;
     virtual bool tx_pending() = 0;
+
+    using AP_HAL::Stream::read;
+
+    /// Bulk read
+    ///
+    /// Reads up to len bytes of whatever is available without
+    /// waiting. Drivers that can do better than one read() call per
+    /// byte should override this.
+    ///
+    /// @param buffer		Where to put the bytes
+    /// @param len			Size of the buffer
+    /// @returns			Number of bytes read
+    ///
+    virtual size_t read(uint8_t *buffer, size_t len) {
+        size_t n = 0;
+        while (n < len) {
+            int16_t c = read();
+            if (c < 0) {
+                break;
+            }
+            buffer[n++] = (uint8_t)c;
+        }
+        return n;
+    }
 };
 
 #endif // __AP_HAL_UART_DRIVER_H__
@@ -13,6 +13,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include <avr/pgmspace.h>
 
@@ -197,6 +198,34 @@ size_t AVRUARTDriver::write(uint8_t c) {
 	return 1;
 }
 
+size_t AVRUARTDriver::write(const uint8_t *buffer, size_t size) {
+	if (!_open) // drop bytes if not open
+		return 0;
+
+	// if it doesn't all fit then take the byte at a time path, which
+	// waits for room or drops bytes as write(uint8_t) does
+	uint8_t head = _txBuffer->head;
+	uint16_t space = (_txBuffer->tail - head - 1) & _txBuffer->mask;
+	if (size > space) {
+		return AP_HAL::UARTDriver::write(buffer, size);
+	}
+
+	// copy into the ring in at most two pieces, then move the head
+	// once. The TX interrupt only moves the tail, so it can't see a
+	// partly copied buffer
+	uint16_t n = (_txBuffer->mask + 1U) - head;
+	if (n > size)
+		n = size;
+	memcpy(&_txBuffer->bytes[head], buffer, n);
+	memcpy(&_txBuffer->bytes[0], buffer + n, size - n);
+	_txBuffer->head = (head + size) & _txBuffer->mask;
+
+	// enable the data-ready interrupt, as it may be off if the buffer is empty
+	*_ucsrb |= _portTxBits;
+
+	return size;
+}
+
 // Buffer management ///////////////////////////////////////////////////////////
     
 
@@ -58,6 +58,7 @@ public:
 
     /* Implementations of Print virtual methods */
     size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
 
 	/// Transmit/receive buffer descriptor.
 	///
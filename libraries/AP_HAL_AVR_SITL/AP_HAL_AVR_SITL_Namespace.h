@@ -14,6 +14,10 @@ namespace AVR_SITL {
     class ADCSource;
     class RCInput;
     class SITLUtil;
+    class SITLVessel;
+    class SITLWinch;
+    class SITLGPIO;
+    class SITLDigitalSource;
 }
 
 #endif // __AP_HAL_AVR_SITL_NAMESPACE_H__
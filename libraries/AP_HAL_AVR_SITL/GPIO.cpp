@@ -0,0 +1,42 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+#include <AP_HAL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+
+#include "AP_HAL_AVR_SITL.h"
+#include "GPIO.h"
+#include "SITL_State.h"
+
+using namespace AVR_SITL;
+
+// digital pin number of analog pin A0
+#define SITL_ANALOG_PIN_BASE 54
+#define SITL_NUM_ANALOG_PINS 16
+
+int8_t SITLGPIO::analogPinToDigitalPin(uint8_t pin)
+{
+    if (pin >= SITL_NUM_ANALOG_PINS) {
+        return -1;
+    }
+    return pin + SITL_ANALOG_PIN_BASE;
+}
+
+uint8_t SITLGPIO::read(uint8_t pin)
+{
+    if (pin >= SITL_ANALOG_PIN_BASE &&
+        pin < SITL_ANALOG_PIN_BASE + SITL_NUM_ANALOG_PINS) {
+        int8_t value = _sitlState->analog_pin_read(pin - SITL_ANALOG_PIN_BASE);
+        if (value != -1) {
+            return value;
+        }
+    }
+    // nothing connected, the pullup holds it high
+    return 1;
+}
+
+AP_HAL::DigitalSource* SITLGPIO::channel(uint16_t n)
+{
+    return new SITLDigitalSource(this, n);
+}
+
+#endif // CONFIG_HAL_BOARD
@@ -0,0 +1,49 @@
+
+#ifndef __AP_HAL_AVR_SITL_GPIO_H__
+#define __AP_HAL_AVR_SITL_GPIO_H__
+
+#include <AP_HAL.h>
+#include "AP_HAL_AVR_SITL_Namespace.h"
+
+/*
+  digital inputs for SITL. The analog pins A0 to A15 map to digital
+  pins 54 to 69 as on the APM2, and read from the simulated hardware
+  in SITL_State. Pins with nothing simulated on them read high, as an
+  input with its pullup enabled would
+ */
+class AVR_SITL::SITLGPIO : public AP_HAL::GPIO {
+public:
+    SITLGPIO(SITL_State *sitlState) :
+        _sitlState(sitlState)
+    {}
+    void    init() {}
+    void    pinMode(uint8_t pin, uint8_t output) {}
+    int8_t  analogPinToDigitalPin(uint8_t pin);
+    uint8_t read(uint8_t pin);
+    void    write(uint8_t pin, uint8_t value) {}
+
+    /* Alternative interface: */
+    AP_HAL::DigitalSource* channel(uint16_t n);
+
+    /* Interrupt interface: */
+    bool    attach_interrupt(uint8_t interrupt_num, AP_HAL::Proc p,
+            uint8_t mode) { return false; }
+
+private:
+    SITL_State *_sitlState;
+};
+
+class AVR_SITL::SITLDigitalSource : public AP_HAL::DigitalSource {
+public:
+    SITLDigitalSource(SITLGPIO *gpio, uint8_t pin) :
+        _gpio(gpio), _pin(pin)
+    {}
+    void    mode(uint8_t output) {}
+    uint8_t read() { return _gpio->read(_pin); }
+    void    write(uint8_t value) {}
+private:
+    SITLGPIO *_gpio;
+    uint8_t _pin;
+};
+
+#endif // __AP_HAL_AVR_SITL_GPIO_H__
@@ -16,6 +16,7 @@
 #include "Console.h"
 #include "RCInput.h"
 #include "RCOutput.h"
+#include "GPIO.h"
 #include "SITL_State.h"
 #include "Util.h"
 
@@ -24,16 +25,16 @@
 
 using namespace AVR_SITL;
 
-static SITLScheduler sitlScheduler;
+static SITL_State sitlState;
+static SITLScheduler sitlScheduler(&sitlState);
 static SITLEEPROMStorage sitlEEPROMStorage;
 static SITLConsoleDriver consoleDriver;
-static SITL_State sitlState;
 static SITLRCInput  sitlRCInput(&sitlState);
 static SITLRCOutput sitlRCOutput(&sitlState);
 static SITLAnalogIn sitlAnalogIn(&sitlState);
+static SITLGPIO sitlGPIO(&sitlState);
 
 // use the Empty HAL for hardware we don't emulate
-static Empty::EmptyGPIO emptyGPIO;
 static Empty::EmptySemaphore emptyI2Csemaphore;
 static Empty::EmptyI2CDriver emptyI2C(&emptyI2Csemaphore);
 static Empty::EmptySPIDeviceManager emptySPI;
@@ -54,7 +55,7 @@ HAL_AVR_SITL::HAL_AVR_SITL() :
         &sitlAnalogIn, /* analogin */
         &sitlEEPROMStorage, /* storage */
         &consoleDriver, /* console */
-        &emptyGPIO, /* gpio */
+        &sitlGPIO, /* gpio */
         &sitlRCInput,  /* rcinput */
         &sitlRCOutput, /* rcoutput */
         &sitlScheduler, /* scheduler */
@@ -10,6 +10,7 @@
 #include "HAL_AVR_SITL_Class.h"
 #include "UARTDriver.h"
 #include "Scheduler.h"
+#include "Storage.h"
 
 #include <stdio.h>
 #include <signal.h>
@@ -18,6 +19,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <sys/time.h>
 
 #include <AP_Param.h>
 
@@ -27,6 +29,11 @@ using namespace AVR_SITL;
 
 enum SITL_State::vehicle_type SITL_State::_vehicle;
 uint16_t SITL_State::_framerate;
+bool SITL_State::_synthetic_clock_mode;
+SITLVessel *SITL_State::_vessel;
+SITLWinch *SITL_State::_winch;
+uint16_t SITL_State::_pin_mask;
+uint16_t SITL_State::_pin_levels;
 struct sockaddr_in SITL_State::_rcout_addr;
 pid_t SITL_State::_parent_pid;
 uint32_t SITL_State::_update_count;
@@ -43,6 +50,8 @@ SITL *SITL_State::_sitl;
 uint16_t SITL_State::pwm_output[11];
 uint16_t SITL_State::pwm_input[8];
 bool SITL_State::pwm_valid;
+uint16_t SITL_State::_rcout_port = 5502;
+uint16_t SITL_State::_simin_port = 5501;
 
 // catch floating point exceptions
 void SITL_State::_sig_fpe(int signum)
@@ -58,18 +67,30 @@ void SITL_State::_usage(void)
 	fprintf(stdout, "\t-r RATE     set SITL framerate\n");
 	fprintf(stdout, "\t-H HEIGHT   initial barometric height\n");
 	fprintf(stdout, "\t-C          use console instead of TCP ports\n");
+	fprintf(stdout, "\t-S          lockstep with the simulator using a synthetic clock\n");
+	fprintf(stdout, "\t-M MODEL    use a built-in simulator model (vessel)\n");
+	fprintf(stdout, "\t-O HOME     home location for built-in model (lat,lng,alt,hdg)\n");
+	fprintf(stdout, "\t-I INSTANCE instance number, moves all ports up by 10*INSTANCE\n");
+	fprintf(stdout, "\t-R SEED     seed for the simulated sensor noise\n");
+	fprintf(stdout, "\t-B          limit serial port output to the baud rate\n");
+	fprintf(stdout, "\t-E          report EEPROM reads and writes by region every second\n");
+	fprintf(stdout, "\t-L FILE     record the simulated hardware inputs to FILE\n");
+	fprintf(stdout, "\t-P FILE     play back the inputs recorded in FILE\n");
 }
 
 void SITL_State::_parse_command_line(int argc, char * const argv[])
 {
 	int opt;
+	uint16_t instance = 0;
+	const char *record_file = NULL;
+	const char *replay_file = NULL;
 
 	signal(SIGFPE, _sig_fpe);
 
     setvbuf(stdout, (char *)0, _IONBF, 0);
     setvbuf(stderr, (char *)0, _IONBF, 0);
 
-	while ((opt = getopt(argc, argv, "swhr:H:C")) != -1) {
+	while ((opt = getopt(argc, argv, "swhr:H:CSM:O:I:R:BEL:P:")) != -1) {
 		switch (opt) {
 		case 'w':
 			AP_Param::erase_all();
@@ -84,12 +105,56 @@ void SITL_State::_parse_command_line(int argc, char * const argv[])
 		case 'C':
 			AVR_SITL::SITLUARTDriver::_console = true;
 			break;
+		case 'S':
+			_synthetic_clock_mode = true;
+			break;
+		case 'B':
+			AVR_SITL::SITLUARTDriver::_baud_limit = true;
+			break;
+		case 'E':
+			AVR_SITL::SITLEEPROMStorage::_report = true;
+			break;
+		case 'M':
+			if (strcmp(optarg, "vessel") != 0) {
+				fprintf(stderr, "Unknown model '%s'\n", optarg);
+				exit(1);
+			}
+			_vessel = new SITLVessel();
+			break;
+		case 'O':
+			_home_str = optarg;
+			break;
+		case 'I':
+			instance = (uint16_t)atoi(optarg);
+			break;
+		case 'R':
+			srandom((unsigned)strtoul(optarg, NULL, 0));
+			break;
+		case 'L':
+			record_file = optarg;
+			_synthetic_clock_mode = true;
+			break;
+		case 'P':
+			replay_file = optarg;
+			_synthetic_clock_mode = true;
+			break;
 		default:
 			_usage();
 			exit(1);
 		}
 	}
 
+	// each instance gets its own block of 10 ports so several
+	// simulations can run side by side
+	_base_port   = 5760 + 10*instance;
+	_simin_port += 10*instance;
+	_rcout_port += 10*instance;
+
+	if (replay_file != NULL && (record_file != NULL || _vessel != NULL)) {
+		fprintf(stderr, "-P can't be used with -L or -M\n");
+		exit(1);
+	}
+
 	fprintf(stdout, "Starting sketch '%s'\n", SKETCH);
 
 	if (strcmp(SKETCH, "ArduCopter") == 0) {
@@ -97,13 +162,17 @@ void SITL_State::_parse_command_line(int argc, char * const argv[])
 		if (_framerate == 0) {
 			_framerate = 200;
 		}
-	} else if (strcmp(SKETCH, "APMrover2") == 0) {
+	} else if (strcmp(SKETCH, "APMrover2") == 0 ||
+	           strcmp(SKETCH, "ARV_APM") == 0) {
+		// ARV_APM is the APMrover2 sketch built from its own directory
 		_vehicle = APMrover2;
 		if (_framerate == 0) {
 			_framerate = 50;
 		}
 		// set right default throttle for rover (allowing for reverse)
         pwm_input[2] = 1500;
+        // the CTD A-frame and winch
+        _winch = new SITLWinch();
 	} else {
 		_vehicle = ArduPlane;
 		if (_framerate == 0) {
@@ -111,6 +180,15 @@ void SITL_State::_parse_command_line(int argc, char * const argv[])
 		}
 	}
 
+	// the recording starts from the EEPROM as it is now, after any
+	// wipe, and playback replaces it
+	if (record_file != NULL) {
+		_record_open(record_file);
+	}
+	if (replay_file != NULL) {
+		_replay_open(replay_file);
+	}
+
 	_sitl_setup();
 }
 
@@ -127,8 +205,15 @@ void SITL_State::_sitl_setup(void)
 	_rcout_addr.sin_port = htons(_rcout_port);
 	inet_pton(AF_INET, "127.0.0.1", &_rcout_addr.sin_addr);
 
-	_setup_timer();
-	_setup_fdm();
+	if (_synthetic_clock_mode) {
+		// start the clock at 1ms, as a zero clock means real time
+		_scheduler->stop_clock(1000);
+	} else {
+		_setup_timer();
+	}
+	if (!replaying()) {
+		_setup_fdm();
+	}
 	fprintf(stdout, "Starting SITL input\n");
 
 	// find the barometer object if it exists
@@ -137,6 +222,17 @@ void SITL_State::_sitl_setup(void)
 	_ins = (AP_InertialSensor_Stub *)AP_Param::find_object("INS_");
 	_compass = (AP_Compass_HIL *)AP_Param::find_object("COMPASS_");
 
+    if (replaying()) {
+        // all input comes from the recording, starting with the
+        // values the sensors were set up with
+        replay_input(REPLAY_STEP, 0);
+        return;
+    }
+
+    if (_vessel != NULL) {
+        _setup_vessel();
+    }
+
     if (_sitl != NULL) {
         // setup some initial values
         _update_barometer(_initial_height);
@@ -183,20 +279,43 @@ void SITL_State::_setup_fdm(void)
 }
 
 
+/*
+  setup the built-in vessel model at the home location
+ */
+void SITL_State::_setup_vessel(void)
+{
+	double lat = 40.071374969556928, lng = -105.22978898137808, alt = 1583.702759;
+	float hdg = 246;
+
+	if (_sitl == NULL) {
+		fprintf(stderr, "SITL: no SIM_ parameters for built-in model\n");
+		exit(1);
+	}
+	if (_home_str != NULL &&
+	    sscanf(_home_str, "%lf,%lf,%lf,%f", &lat, &lng, &alt, &hdg) != 4) {
+		fprintf(stderr, "SITL: home should be lat,lng,alt,hdg\n");
+		exit(1);
+	}
+	_vessel->set_home(lat, lng, alt, hdg);
+	_vessel->fill_fdm(_sitl->state);
+	fprintf(stdout, "Using built-in vessel model\n");
+}
+
 /*
   timer called at 1kHz
  */
 void SITL_State::_timer_handler(int signum)
 {
-	static uint32_t last_update_count;
-    static uint32_t last_pwm_input;
-
 	static bool in_timer;
 
 	if (in_timer || _scheduler->interrupts_are_blocked()){
 		return;
     }
 
+    // the serial output sent from here can fail, and the code this
+    // interrupted may be about to look at errno from its own call
+    int saved_errno = errno;
+
     _scheduler->sitl_begin_atomic();
 	in_timer = true;
 
@@ -218,30 +337,132 @@ void SITL_State::_timer_handler(int signum)
 	}
 #endif
 
+	/* check for packet from flight sim */
+	_fdm_input();
+
+	// send RC output to flight sim
+	_simulator_output(false);
+
+	_sim_update();
+
+    _scheduler->sitl_end_atomic();
+	in_timer = false;
+    errno = saved_errno;
+}
+
+/*
+  advance the synthetic clock by one timer tick. Whenever a new frame
+  of servo outputs goes to the simulator we block until it replies,
+  so simulated time only moves forward in step with the simulator
+ */
+void SITL_State::_synthetic_clock_step(void)
+{
+	static bool in_step;
+
+	_scheduler->stop_clock(_scheduler->stopped_clock_usec() + 1000);
+
+	if (_sitl != NULL && _sitl->speedup > 0 && !replaying()) {
+		_speedup_wait();
+	}
+
+	if (in_step || _scheduler->interrupts_are_blocked()) {
+		return;
+	}
+
+    _scheduler->sitl_begin_atomic();
+	in_step = true;
+
+	if (_simulator_output(false) && _vessel == NULL) {
+		_fdm_wait();
+	}
+
+	_sim_update();
+
+    _scheduler->sitl_end_atomic();
+	in_step = false;
+}
+
+/*
+  hold the synthetic clock back to SIM_SPEEDUP times wall clock time
+ */
+void SITL_State::_speedup_wait(void)
+{
+	static float last_speedup;
+	static uint64_t start_wall_usec, start_sim_usec;
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	uint64_t now = 1.0e6*tv.tv_sec + tv.tv_usec;
+	uint64_t sim_usec = _scheduler->stopped_clock_usec();
+
+	if (_sitl->speedup != last_speedup) {
+		// restart the measurement whenever the limit changes
+		last_speedup = _sitl->speedup;
+		start_wall_usec = now;
+		start_sim_usec = sim_usec;
+	}
+
+	uint64_t target = start_wall_usec + (uint64_t)((sim_usec - start_sim_usec) / last_speedup);
+	if (target > now) {
+		usleep(target - now);
+	}
+}
+
+/*
+  update the simulated sensors from the latest FDM state and run the
+  timer procs
+ */
+void SITL_State::_sim_update(void)
+{
+	static uint32_t last_update_count;
+    static uint32_t last_pwm_input;
+
+    // push out any queued serial output
+    ((SITLUARTDriver *)hal.uartA)->_timer_tick();
+    ((SITLUARTDriver *)hal.uartB)->_timer_tick();
+    ((SITLUARTDriver *)hal.uartC)->_timer_tick();
+
+    ((SITLEEPROMStorage *)hal.storage)->_timer_tick();
+
     // simulate RC input at 50Hz
     if (hal.scheduler->millis() - last_pwm_input >= 20) {
         last_pwm_input = hal.scheduler->millis();
         pwm_valid = true;
     }
 
-	/* check for packet from flight sim */
-	_fdm_input();
+    if (replaying()) {
+        // the recording stands in for the simulator
+        replay_input(REPLAY_STEP, 0);
+        _scheduler->timer_event();
+        return;
+    }
 
-	// send RC output to flight sim
-	_simulator_output();
+    if (_winch != NULL && _sitl != NULL) {
+        // winch motor on CH2 and clutch on CH6
+        _winch->update(pwm_output[1] == 0xFFFF ? 0 : pwm_output[1],
+                       pwm_output[5] == 0xFFFF ? 0 : pwm_output[5],
+                       _sitl, hal.scheduler->millis());
+        _pin_mask = _pin_levels = 0;
+        for (uint8_t pin=SITLWinch::PIN_AFT; pin<=SITLWinch::PIN_STALL; pin++) {
+            _pin_mask |= 1U<<pin;
+            if (_winch->read_pin(pin)) {
+                _pin_levels |= 1U<<pin;
+            }
+        }
+    }
+
+    if (recording()) {
+        _record_step();
+    }
 
 	if (_update_count == 0 && _sitl != NULL) {
 		_update_gps(0, 0, 0, 0, 0, 0, false);
 		_scheduler->timer_event();
-        _scheduler->sitl_end_atomic();
-		in_timer = false;
 		return;
 	}
 
 	if (_update_count == last_update_count) {
 		_scheduler->timer_event();
-        _scheduler->sitl_end_atomic();
-		in_timer = false;
 		return;
 	}
 	last_update_count = _update_count;
@@ -262,9 +483,18 @@ void SITL_State::_timer_handler(int signum)
 	// trigger all APM timers. We do this last as it can re-enable
 	// interrupts, which can lead to recursion
 	_scheduler->timer_event();
+}
 
-    _scheduler->sitl_end_atomic();
-	in_timer = false;
+/*
+  read the simulated hardware on an analog pin used as a digital
+  input, -1 if there is none
+ */
+int8_t SITL_State::analog_pin_read(uint8_t pin)
+{
+	if (pin >= 16 || !(_pin_mask & (1U<<pin))) {
+		return -1;
+	}
+	return (_pin_levels & (1U<<pin)) ? 1 : 0;
 }
 
 
@@ -329,11 +559,45 @@ void SITL_State::_fdm_input(void)
 }
 
 /*
-  send RC outputs to simulator
+  wait for the simulator to reply to the last frame of servo
+  outputs. This is used in synthetic clock mode, where the clock
+  must not move until the simulator has caught up
+ */
+void SITL_State::_fdm_wait(void)
+{
+	uint32_t start_count = _update_count;
+
+	while (_update_count == start_count) {
+		fd_set fds;
+		struct timeval tv;
+
+		FD_ZERO(&fds);
+		FD_SET(_sitl_fd, &fds);
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+
+		if (select(_sitl_fd+1, &fds, NULL, NULL, &tv) != 1) {
+#ifndef __CYGWIN__
+			/* make sure we die if our parent dies */
+			if (kill(_parent_pid, 0) != 0) {
+				exit(1);
+			}
+#endif
+			// the simulator may have missed our frame, send it again
+			_simulator_output(true);
+			continue;
+		}
+		_fdm_input();
+	}
+}
+
+/*
+  send RC outputs to simulator. Returns true if a frame was sent
  */
-void SITL_State::_simulator_output(void)
+bool SITL_State::_simulator_output(bool force)
 {
 	static uint32_t last_update;
+	float delta_t;
 	struct {
 		uint16_t pwm[11];
 		uint16_t speed, direction, turbulance;
@@ -358,15 +622,21 @@ void SITL_State::_simulator_output(void)
 	}
 
     if (_sitl == NULL) {
-        return;
+        return false;
     }
 
 	// output at chosen framerate
-	if (last_update != 0 && hal.scheduler->millis() - last_update < 1000/_framerate) {
-		return;
+	if (!force && last_update != 0 && hal.scheduler->millis() - last_update < 1000/_framerate) {
+		return false;
 	}
+	delta_t = last_update == 0 ? 0 : (hal.scheduler->millis() - last_update) * 1.0e-3f;
 	last_update = hal.scheduler->millis();
 
+	if (replaying()) {
+		// there is no simulator to send to
+		return false;
+	}
+
 	for (i=0; i<11; i++) {
 		if (pwm_output[i] == 0xFFFF) {
 			control.pwm[i] = 0;
@@ -415,12 +685,21 @@ void SITL_State::_simulator_output(void)
 	control.direction  = direction * 100;
 	control.turbulance = _sitl->wind_turbulance * 100;
 
+	if (_vessel != NULL) {
+		// step the built-in model instead of an external simulator
+		_vessel->update(control.pwm, _sitl, delta_t);
+		_vessel->fill_fdm(_sitl->state);
+		_update_count++;
+		return true;
+	}
+
 	// zero the wind for the first 15s to allow pitot calibration
 	if (hal.scheduler->millis() < 15000) {
 		control.speed = 0;
 	}
 
 	sendto(_sitl_fd, (void*)&control, sizeof(control), MSG_DONTWAIT, (const sockaddr *)&_rcout_addr, sizeof(_rcout_addr));
+	return true;
 }
 
 
@@ -474,9 +753,27 @@ void SITL_State::init(int argc, char * const argv[])
 	_parse_command_line(argc, argv);
 }
 
+/*
+  step the simulation until the synthetic clock reaches the given
+  time. Used by the scheduler delay functions, which would otherwise
+  spin forever on a stopped clock
+ */
+void SITL_State::wait_clock(uint32_t wait_time_usec)
+{
+    while ((int32_t)(wait_time_usec - _scheduler->micros()) > 0) {
+        _synthetic_clock_step();
+    }
+}
+
 // wait for serial input, or 100usec
 void SITL_State::loop_hook(void)
 {
+    if (_synthetic_clock_mode) {
+        // don't sleep, just move on to the next timer tick
+        _synthetic_clock_step();
+        return;
+    }
+
     struct timeval tv;
     fd_set fds;
     int fd, max_fd = 0;
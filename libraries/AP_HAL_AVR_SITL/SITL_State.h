@@ -9,6 +9,8 @@
 #include <AP_HAL_AVR_SITL.h>
 #include "AP_HAL_AVR_SITL_Namespace.h"
 #include "HAL_AVR_SITL_Class.h"
+#include "Vessel.h"
+#include "Winch.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -40,9 +42,30 @@ public:
     static bool pwm_valid;
     static void loop_hook(void);
 
+    // step the simulation until the synthetic clock reaches the given time
+    void wait_clock(uint32_t wait_time_usec);
+
     // simulated airspeed
     static uint16_t airspeed_pin_value;
 
+    // simulated hardware on an analog pin used as a digital input,
+    // -1 if there is none
+    int8_t analog_pin_read(uint8_t pin);
+
+    // TCP port of the first serial port, moved by the instance number
+    uint16_t base_port(void) const { return _base_port; }
+
+    // recording and playback of the simulated hardware, see
+    // sitl_replay.cpp
+    static bool recording(void);
+    static bool replaying(void);
+    static uint8_t uart_fill_index(uint8_t port);
+    static void record_uart(uint8_t port, uint8_t index,
+                            const uint8_t *data1, uint16_t len1,
+                            const uint8_t *data2, uint16_t len2);
+    enum { REPLAY_STEP = 0xFF };
+    static void replay_input(uint8_t port, uint8_t index);
+
 private:
     void _parse_command_line(int argc, char * const argv[]);
     void _usage(void);
@@ -50,6 +73,7 @@ private:
     void _setup_fdm(void);
     void _setup_timer(void);
     void _setup_adc(void);
+    void _setup_vessel(void);
 
     // these methods are static as they are called
     // from the timer
@@ -84,12 +108,27 @@ private:
 			    double xAccel, 	double yAccel, 	double zAccel,		// Local to plane
 			    float airspeed);
     static void _fdm_input(void);
-    static void _simulator_output(void);
+    static void _fdm_wait(void);
+    static bool _simulator_output(bool force);
+    static void _sim_update(void);
+    static void _synthetic_clock_step(void);
+    static void _speedup_wait(void);
     static uint16_t _airspeed_sensor(float airspeed);
     static float _gyro_drift(void);
     static float _rand_float(void);
     static Vector3f _rand_vec3f(void);
 
+    static void _record_open(const char *filename);
+    static void _record(uint8_t type, const void *data, uint16_t len);
+    static void _record_ins(void);
+    static void _record_baro(float altitude);
+    static void _record_compass(float roll, float pitch, float yaw);
+    static void _record_step(void);
+    static void _replay_open(const char *filename);
+    static bool _replay_read(void);
+    static void _replay_apply(void);
+    static void _replay_finish(void);
+
     // signal handlers
     static void _sig_fpe(int signum);
     static void _timer_handler(int signum);
@@ -97,6 +136,13 @@ private:
     // internal state
     static enum vehicle_type _vehicle;
     static uint16_t _framerate;
+    static bool _synthetic_clock_mode;
+    static SITLVessel *_vessel;
+    static SITLWinch *_winch;
+    // analog pins with simulated hardware on them, and their levels
+    static uint16_t _pin_mask;
+    static uint16_t _pin_levels;
+    const char *_home_str;
     float _initial_height;
     static struct sockaddr_in _rcout_addr;
     static pid_t _parent_pid;
@@ -110,8 +156,9 @@ private:
 
     static int _sitl_fd;
     static SITL *_sitl;
-    static const uint16_t _rcout_port = 5502;
-    static const uint16_t _simin_port = 5501;
+    uint16_t _base_port;
+    static uint16_t _rcout_port;
+    static uint16_t _simin_port;
 };
 
 #endif // CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
@@ -5,6 +5,7 @@
 
 #include "AP_HAL_AVR_SITL.h"
 #include "Scheduler.h"
+#include "SITL_State.h"
 #include <sys/time.h>
 #include <unistd.h>
 
@@ -26,8 +27,10 @@ uint8_t SITLScheduler::_num_io_procs = 0;
 bool SITLScheduler::_in_io_proc = false;
 
 struct timeval SITLScheduler::_sketch_start_time;
+uint64_t SITLScheduler::_stopped_clock_usec;
 
-SITLScheduler::SITLScheduler()
+SITLScheduler::SITLScheduler(SITL_State *sitlState) :
+    _sitlState(sitlState)
 {}
 
 void SITLScheduler::init(void *unused) 
@@ -37,6 +40,9 @@ void SITLScheduler::init(void *unused)
 
 uint32_t SITLScheduler::_micros() 
 {
+    if (_stopped_clock_usec) {
+        return _stopped_clock_usec;
+    }
 	struct timeval tp;
 	gettimeofday(&tp,NULL);
 	return 1.0e6*((tp.tv_sec + (tp.tv_usec*1.0e-6)) - 
@@ -51,6 +57,9 @@ uint32_t SITLScheduler::micros()
 
 uint32_t SITLScheduler::millis() 
 {
+    if (_stopped_clock_usec) {
+        return _stopped_clock_usec / 1000;
+    }
 	struct timeval tp;
 	gettimeofday(&tp,NULL);
 	return 1.0e3*((tp.tv_sec + (tp.tv_usec*1.0e-6)) - 
@@ -61,6 +70,11 @@ uint32_t SITLScheduler::millis()
 void SITLScheduler::delay_microseconds(uint16_t usec) 
 {
 	uint32_t start = micros();
+    if (_stopped_clock_usec) {
+        // the clock won't move unless we step the simulation
+        _sitlState->wait_clock(start + usec);
+        return;
+    }
 	while (micros() - start < usec) {
 		usleep(usec - (micros() - start));
 	}
@@ -71,6 +85,9 @@ void SITLScheduler::delay(uint16_t ms)
 	uint32_t start = micros();
     
     while (ms > 0) {
+        if (_stopped_clock_usec) {
+            _sitlState->wait_clock(start + 1000);
+        }
         while ((micros() - start) >= 1000) {
             ms--;
             if (ms == 0) break;
@@ -12,7 +12,7 @@
 /* Scheduler implementation: */
 class AVR_SITL::SITLScheduler : public AP_HAL::Scheduler {
 public:
-    SITLScheduler();
+    SITLScheduler(SITL_State *sitlState);
     /* AP_HAL::Scheduler methods */
 
     void     init(void *unused);
@@ -46,11 +46,18 @@ public:
     static uint32_t _micros();
     static void timer_event() { _run_timer_procs(true); _run_io_procs(true); }
 
+    // synthetic clock support. Once stop_clock() has been called the
+    // clock only moves when SITL_State advances it
+    static void stop_clock(uint64_t time_usec) { _stopped_clock_usec = time_usec; }
+    static uint64_t stopped_clock_usec(void) { return _stopped_clock_usec; }
+
 private:
+    SITL_State *_sitlState;
     uint8_t _nested_atomic_ctr;
     AP_HAL::Proc _delay_cb;
     uint16_t _min_delay_cb_ms;
     static struct timeval _sketch_start_time;
+    static uint64_t _stopped_clock_usec;
     static AP_HAL::TimedProc _failsafe;
 
     static void _run_timer_procs(bool called_from_isr);
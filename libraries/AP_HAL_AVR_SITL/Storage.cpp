@@ -2,82 +2,241 @@
 #if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "Storage.h"
 using namespace AVR_SITL;
 
+extern const AP_HAL::HAL& hal;
+
+bool SITLEEPROMStorage::_report;
+struct SITLEEPROMStorage::region SITLEEPROMStorage::_regions[SITL_EEPROM_REGIONS];
+
+/*
+  map eeprom.bin into memory, so reads and writes are plain loads and
+  stores. The kernel writes the pages back, with msync() from the
+  timer and at exit to bound how stale the file can be
+ */
 void SITLEEPROMStorage::_eeprom_open(void)
 {
-	if (_eeprom_fd == -1) {
-		_eeprom_fd = open("eeprom.bin", O_RDWR|O_CREAT, 0777);
-		assert(ftruncate(_eeprom_fd, 4096) == 0);
+	if (_eeprom != NULL) {
+		return;
+	}
+	_eeprom_fd = open("eeprom.bin", O_RDWR|O_CREAT, 0777);
+	if (_eeprom_fd == -1 || ftruncate(_eeprom_fd, SITL_EEPROM_SIZE) != 0) {
+		fprintf(stderr, "Failed to open eeprom.bin - %s\n", strerror(errno));
+		exit(1);
+	}
+	void *p = mmap(NULL, SITL_EEPROM_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, _eeprom_fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Failed to map eeprom.bin - %s\n", strerror(errno));
+		exit(1);
+	}
+	_eeprom = (uint8_t *)p;
+	atexit(_sync_at_exit);
+}
+
+void SITLEEPROMStorage::set_region(uint8_t i, const char *name, uint16_t start)
+{
+	assert(i < SITL_EEPROM_REGIONS);
+	_regions[i].name = name;
+	_regions[i].start = start;
+}
+
+/*
+  add an access to the totals, and to the region that holds its first
+  byte
+ */
+void SITLEEPROMStorage::_count(uint16_t loc, uint16_t n, bool write)
+{
+	struct region *r = NULL;
+	for (uint8_t i=0; i<SITL_EEPROM_REGIONS; i++) {
+		if (_regions[i].name != NULL && _regions[i].start <= loc &&
+		    (r == NULL || _regions[i].start > r->start)) {
+			r = &_regions[i];
+		}
+	}
+	if (write) {
+		_bytes_written += n;
+		if (r != NULL) {
+			r->bytes_written += n;
+		}
+	} else {
+		_bytes_read += n;
+		if (r != NULL) {
+			r->bytes_read += n;
+		}
 	}
 }
 
 uint8_t SITLEEPROMStorage::read_byte(uint16_t loc) 
 {
-	uint8_t value;
-	assert(loc < 4096);
+	assert(loc < SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pread(_eeprom_fd, &value, 1, loc) == 1);
-	return value;
+	_count(loc, 1, false);
+	return _eeprom[loc];
 }
 
 uint16_t SITLEEPROMStorage::read_word(uint16_t loc) 
 {
 	uint16_t value;
-	assert(loc < 4096);
+	assert(loc + 2 <= SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pread(_eeprom_fd, &value, 2, loc) == 2);
+	_count(loc, 2, false);
+	memcpy(&value, &_eeprom[loc], 2);
 	return value;
 }
 
 uint32_t SITLEEPROMStorage::read_dword(uint16_t loc) 
 {
 	uint32_t value;
-	assert(loc < 4096);
+	assert(loc + 4 <= SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pread(_eeprom_fd, &value, 4, loc) == 4);
+	_count(loc, 4, false);
+	memcpy(&value, &_eeprom[loc], 4);
 	return value;
 }
 
 void SITLEEPROMStorage::read_block(void *dst, uint16_t src, size_t n) 
 {
-	assert(src < 4096 && src + n < 4096);
+	assert(src < SITL_EEPROM_SIZE && src + n < SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pread(_eeprom_fd, dst, n, src) == (ssize_t)n);
+	_count(src, n, false);
+	memcpy(dst, &_eeprom[src], n);
 }
 
 void SITLEEPROMStorage::write_byte(uint16_t loc, uint8_t value) 
 {
-	assert(loc < 4096);
+	assert(loc < SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pwrite(_eeprom_fd, &value, 1, loc) == 1);
+	_count(loc, 1, true);
+	_eeprom[loc] = value;
+	_dirty = true;
 }
 
 void SITLEEPROMStorage::write_word(uint16_t loc, uint16_t value) 
 {
-	assert(loc < 4096);
+	assert(loc + 2 <= SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pwrite(_eeprom_fd, &value, 2, loc) == 2);
+	_count(loc, 2, true);
+	memcpy(&_eeprom[loc], &value, 2);
+	_dirty = true;
 }
 
 void SITLEEPROMStorage::write_dword(uint16_t loc, uint32_t value) 
 {
-	assert(loc < 4096);
+	assert(loc + 4 <= SITL_EEPROM_SIZE);
 	_eeprom_open();
-	assert(pwrite(_eeprom_fd, &value, 4, loc) == 4);
+	_count(loc, 4, true);
+	memcpy(&_eeprom[loc], &value, 4);
+	_dirty = true;
 }
 
 void SITLEEPROMStorage::write_block(uint16_t dst, const void *src, size_t n) 
 {
-	assert(dst < 4096);
+	assert(dst < SITL_EEPROM_SIZE && dst + n <= SITL_EEPROM_SIZE);
+	_eeprom_open();
+	_count(dst, n, true);
+	memcpy(&_eeprom[dst], src, n);
+	_dirty = true;
+}
+
+/*
+  copy the whole EEPROM out
+ */
+void SITLEEPROMStorage::save_image(uint8_t *image)
+{
 	_eeprom_open();
-	assert(pwrite(_eeprom_fd, src, n, dst) == (ssize_t)n);
+	memcpy(image, _eeprom, SITL_EEPROM_SIZE);
+}
+
+/*
+  replace the EEPROM with an image held in memory, leaving eeprom.bin
+  alone
+ */
+void SITLEEPROMStorage::load_image(const uint8_t *image)
+{
+	if (_eeprom == NULL) {
+		_eeprom = (uint8_t *)malloc(SITL_EEPROM_SIZE);
+	} else if (_eeprom_fd != -1) {
+		munmap(_eeprom, SITL_EEPROM_SIZE);
+		close(_eeprom_fd);
+		_eeprom_fd = -1;
+		_eeprom = (uint8_t *)malloc(SITL_EEPROM_SIZE);
+	}
+	memcpy(_eeprom, image, SITL_EEPROM_SIZE);
+	_dirty = false;
+}
+
+/*
+  called from the SITL timer. Starts writeback of any changes once a
+  second, and keeps the read and write rates up to date
+ */
+void SITLEEPROMStorage::_timer_tick(void)
+{
+	uint32_t now = hal.scheduler->millis();
+
+	if (_dirty && _eeprom_fd != -1 && now - _last_sync_ms >= 1000) {
+		_last_sync_ms = now;
+		_dirty = false;
+		msync(_eeprom, SITL_EEPROM_SIZE, MS_ASYNC);
+	}
+
+	if (now - _last_rate_ms >= 1000) {
+		_last_rate_ms = now;
+		_read_rate = _bytes_read - _last_bytes_read;
+		_write_rate = _bytes_written - _last_bytes_written;
+		_last_bytes_read = _bytes_read;
+		_last_bytes_written = _bytes_written;
+		uint32_t read[SITL_EEPROM_REGIONS], written[SITL_EEPROM_REGIONS];
+		uint32_t other_read = _read_rate, other_written = _write_rate;
+		for (uint8_t i=0; i<SITL_EEPROM_REGIONS; i++) {
+			struct region &r = _regions[i];
+			read[i] = r.bytes_read - r.last_bytes_read;
+			written[i] = r.bytes_written - r.last_bytes_written;
+			r.last_bytes_read = r.bytes_read;
+			r.last_bytes_written = r.bytes_written;
+			other_read -= read[i];
+			other_written -= written[i];
+		}
+		if (!_report || (_read_rate == 0 && _write_rate == 0)) {
+			return;
+		}
+		// the total, then read/written bytes for each busy region
+		fprintf(stdout, "EEPROM t=%lu read %lu B/s write %lu B/s",
+		        (unsigned long)now,
+		        (unsigned long)_read_rate, (unsigned long)_write_rate);
+		for (uint8_t i=0; i<SITL_EEPROM_REGIONS; i++) {
+			if (read[i] != 0 || written[i] != 0) {
+				fprintf(stdout, " %s %lu/%lu", _regions[i].name,
+				        (unsigned long)read[i], (unsigned long)written[i]);
+			}
+		}
+		if (other_read != 0 || other_written != 0) {
+			fprintf(stdout, " other %lu/%lu",
+			        (unsigned long)other_read, (unsigned long)other_written);
+		}
+		fprintf(stdout, "\n");
+	}
+}
+
+/*
+  make sure the image is on disk when we exit
+ */
+void SITLEEPROMStorage::_sync_at_exit(void)
+{
+	SITLEEPROMStorage *storage = (SITLEEPROMStorage *)hal.storage;
+	if (storage->_eeprom != NULL && storage->_eeprom_fd != -1) {
+		msync(storage->_eeprom, SITL_EEPROM_SIZE, MS_SYNC);
+	}
 }
 
 #endif
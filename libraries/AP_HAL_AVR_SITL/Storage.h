@@ -6,10 +6,23 @@
 #include <AP_HAL.h>
 #include "AP_HAL_AVR_SITL_Namespace.h"
 
+#define SITL_EEPROM_SIZE 4096
+
+// number of named areas the reads and writes are counted in
+#define SITL_EEPROM_REGIONS 4
+
 class AVR_SITL::SITLEEPROMStorage : public AP_HAL::Storage {
 public:
+    friend class AVR_SITL::SITL_State;
+
     SITLEEPROMStorage() {
 	    _eeprom_fd = -1;
+	    _eeprom = NULL;
+	    _dirty = false;
+	    _bytes_read = _bytes_written = 0;
+	    _last_bytes_read = _last_bytes_written = 0;
+	    _read_rate = _write_rate = 0;
+	    _last_sync_ms = _last_rate_ms = 0;
     }
     void init(void* machtnichts) {}
     uint8_t  read_byte(uint16_t loc);
@@ -22,9 +35,48 @@ public:
     void write_dword(uint16_t loc, uint32_t value);
     void write_block(uint16_t dst, const void* src, size_t n);
 
+    // total bytes read and written since startup
+    uint32_t bytes_read(void) const { return _bytes_read; }
+    uint32_t bytes_written(void) const { return _bytes_written; }
+
+    // bytes read and written over the last second
+    uint32_t read_rate(void) const { return _read_rate; }
+    uint32_t write_rate(void) const { return _write_rate; }
+
+    // copy the whole EEPROM out, or replace it with an image that is
+    // kept in memory and never written back to eeprom.bin
+    void save_image(uint8_t *image);
+    void load_image(const uint8_t *image);
+
+    // name the area of EEPROM from start up to the start of the next
+    // region, so the -E report shows which part is being read and
+    // written. Traffic below the lowest region is counted as "other"
+    static void set_region(uint8_t i, const char *name, uint16_t start);
+
+    // print the read and write rates every second
+    static bool _report;
+
 private:
+    struct region {
+        const char *name;
+        uint16_t start;
+        uint32_t bytes_read, bytes_written;
+        uint32_t last_bytes_read, last_bytes_written;
+    };
+    static struct region _regions[SITL_EEPROM_REGIONS];
+
     int _eeprom_fd;
+    uint8_t *_eeprom;
+    volatile bool _dirty;
+    uint32_t _bytes_read, _bytes_written;
+    uint32_t _last_bytes_read, _last_bytes_written;
+    uint32_t _read_rate, _write_rate;
+    uint32_t _last_sync_ms, _last_rate_ms;
+
     void _eeprom_open(void);
+    void _count(uint16_t loc, uint16_t n, bool write);
+    void _timer_tick(void);
+    static void _sync_at_exit(void);
 };
 
 #endif // __AP_HAL_AVR_SITL_STORAGE_H__
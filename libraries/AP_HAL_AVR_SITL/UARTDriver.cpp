@@ -22,18 +22,21 @@
 #include <sys/ioctl.h>
 #include <sys/types.h> 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
 #include "print_vprintf.h"
 #include "UARTDriver.h"
+#include "Scheduler.h"
 #include "SITL_State.h"
 
-using namespace AVR_SITL;
+extern const AP_HAL::HAL& hal;
 
-#define LISTEN_BASE_PORT 5760
+using namespace AVR_SITL;
 
 bool SITLUARTDriver::_console;
+bool SITLUARTDriver::_baud_limit;
 
 /* UARTDriver method implementations */
 
@@ -45,6 +48,26 @@ void SITLUARTDriver::begin(uint32_t baud, uint16_t rxSpace, uint16_t txSpace)
     if (rxSpace != 0) {
         _rxSpace = rxSpace;
     }
+    if (baud != 0) {
+        _baud = baud;
+    }
+
+    SITLScheduler *scheduler = (SITLScheduler *)hal.scheduler;
+    scheduler->sitl_begin_atomic();
+    // push out anything still queued before replacing the ring
+    _tx_send(_txMask, true);
+    if (_alloc_ring(&_txBuffer, &_txMask, _txSpace)) {
+        _txHead = _txTail = 0;
+    }
+    scheduler->sitl_end_atomic();
+    if (_alloc_ring(&_rxBuffer, &_rxMask, _rxSpace)) {
+        _rxHead = _rxTail = 0;
+    }
+    if (SITL_State::replaying()) {
+        // input comes from the recording, and output goes nowhere
+        _connected = true;
+        return;
+    }
     switch (_portNumber) {
     case 0:
         _tcp_start_connection(true);
@@ -73,90 +96,308 @@ int16_t SITLUARTDriver::available(void)
     if (!_connected) {
         return 0;
     }
-    
-    if (_select_check(_fd)) {
-#ifdef FIONREAD
-        // use FIONREAD to get exact value if possible
-        int num_ready;
-        if (ioctl(_fd, FIONREAD, &num_ready) == 0) {
-            if (num_ready > _rxSpace) {
-                return _rxSpace;
-            }
-            if (num_ready == 0) {
-                // EOF is reached
-                fprintf(stdout, "Closed connection on serial port %u\n", _portNumber);
-                close(_fd);
-                _connected = false;
-                return 0;
-            }
-            return num_ready;
-        }
-#endif
-        return 1; // best we can do is say 1 byte available
+
+    if (_rxHead == _rxTail) {
+        _rx_fill();
     }
-    return 0;
+    return (_rxHead - _rxTail) & _rxMask;
 }
 
-
-
 int16_t SITLUARTDriver::txspace(void) 
 {
-    // always claim there is space available
-    return _txSpace;
+    return _txMask - ((_txHead - _txTail) & _txMask);
 }
 
 int16_t SITLUARTDriver::read(void) 
 {
-    char c;
+    uint8_t c;
 
-    if (available() <= 0) {
+    if (read(&c, 1) != 1) {
         return -1;
     }
+    return c;
+}
 
-    if (_portNumber == 1) {
-        if (_sitlState->gps_read(_fd, &c, 1) == 1) {
-            return (uint8_t)c;
+size_t SITLUARTDriver::read(uint8_t *buffer, size_t len)
+{
+    size_t n = 0;
+
+    _check_connection();
+
+    while (n < len && _connected) {
+        uint16_t count = (_rxHead - _rxTail) & _rxMask;
+        if (count == 0) {
+            if (_rx_fill() == 0) {
+                break;
+            }
+            continue;
         }
-        return -1;
+        // copy out up to the end of the ring
+        if (count > _rxMask + 1 - _rxTail) {
+            count = _rxMask + 1 - _rxTail;
+        }
+        if (count > len - n) {
+            count = len - n;
+        }
+        memcpy(&buffer[n], &_rxBuffer[_rxTail], count);
+        _rxTail = (_rxTail + count) & _rxMask;
+        n += count;
     }
+    return n;
+}
 
-    if (_console) {
-        return ::read(0, &c, 1);
+/*
+  read whatever is waiting on the port into the receive ring with a
+  single system call. Returns the number of bytes added
+ */
+uint16_t SITLUARTDriver::_rx_fill(void)
+{
+    uint16_t space = _rxMask - ((_rxHead - _rxTail) & _rxMask);
+    struct iovec iov[2];
+    int iovcnt = 1;
+    ssize_t n;
+
+    if (space == 0 || !_connected) {
+        return 0;
     }
 
-    int n = recv(_fd, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-    if (n <= 0) {
-        // the socket has reached EOF
-        close(_fd);
-        _connected = false;
-        fprintf(stdout, "Closed connection on serial port %u\n", _portNumber);
-        fflush(stdout);
-        return -1;
+    // playback hands over each block of input on the same call that
+    // read it when recording, so count the calls the same way in both
+    uint8_t index = 0;
+    if (SITL_State::recording() || SITL_State::replaying()) {
+        index = SITL_State::uart_fill_index(_portNumber);
+    }
+    if (SITL_State::replaying()) {
+        uint16_t head = _rxHead;
+        SITL_State::replay_input(_portNumber, index);
+        return (_rxHead - head) & _rxMask;
+    }
+
+    iov[0].iov_base = &_rxBuffer[_rxHead];
+    iov[0].iov_len  = space;
+    if (_rxHead + space > _rxMask + 1) {
+        iov[0].iov_len  = _rxMask + 1 - _rxHead;
+        iov[1].iov_base = &_rxBuffer[0];
+        iov[1].iov_len  = space - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    if (_portNumber == 1) {
+        // the GPS pipe, read in one piece
+        n = _sitlState->gps_read(_fd, iov[0].iov_base, iov[0].iov_len);
+        if (n <= 0) {
+            return 0;
+        }
+    } else if (_console) {
+        if (!_select_check(_fd)) {
+            return 0;
+        }
+        n = readv(0, iov, iovcnt);
+        if (n <= 0) {
+            return 0;
+        }
+    } else {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        n = recvmsg(_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return 0;
+        }
+        if (n <= 0) {
+            // the socket has reached EOF
+            close(_fd);
+            _connected = false;
+            fprintf(stdout, "Closed connection on serial port %u\n", _portNumber);
+            fflush(stdout);
+            return 0;
+        }
     }
-    if (n == 1) {
-        return (uint8_t)c;
+    if (SITL_State::recording()) {
+        if (n > (ssize_t)iov[0].iov_len) {
+            SITL_State::record_uart(_portNumber, index,
+                                    (const uint8_t *)iov[0].iov_base, iov[0].iov_len,
+                                    (const uint8_t *)iov[1].iov_base, n - iov[0].iov_len);
+        } else {
+            SITL_State::record_uart(_portNumber, index,
+                                    (const uint8_t *)iov[0].iov_base, n, NULL, 0);
+        }
+    }
+    _rxHead = (_rxHead + n) & _rxMask;
+    return n;
+}
+
+/*
+  add played back input to the receive ring
+ */
+void SITLUARTDriver::_rx_inject(const uint8_t *data, uint16_t len)
+{
+    uint16_t space = _rxMask - ((_rxHead - _rxTail) & _rxMask);
+
+    if (len > space) {
+        len = space;
+    }
+    while (len--) {
+        _rxBuffer[_rxHead] = *data++;
+        _rxHead = (_rxHead + 1) & _rxMask;
     }
-    return -1;
 }
 
 void SITLUARTDriver::flush(void) 
 {
+    SITLScheduler *scheduler = (SITLScheduler *)hal.scheduler;
+    // keep the timer from draining the ring at the same time
+    scheduler->sitl_begin_atomic();
+    while (_connected && tx_pending()) {
+        _tx_send(_txMask, true);
+    }
+    scheduler->sitl_end_atomic();
 }
 
 size_t SITLUARTDriver::write(uint8_t c) 
 {
-    int flags = MSG_NOSIGNAL;
     _check_connection();
     if (!_connected) {
         return 0;
     }
-    if (_nonblocking_writes) {
-        flags |= MSG_DONTWAIT;
+    uint16_t head = _txHead;
+    uint16_t next = (head + 1) & _txMask;
+    if (next == _txTail) {
+        // the ring is full. With baud rate limiting only a blocking
+        // write may push it out early, as the timer would otherwise
+        // never get to run in the synthetic clock case
+        if (_baud_limit && _nonblocking_writes) {
+            return 0;
+        }
+        SITLScheduler *scheduler = (SITLScheduler *)hal.scheduler;
+        scheduler->sitl_begin_atomic();
+        _tx_send(_txMask, !_nonblocking_writes);
+        scheduler->sitl_end_atomic();
+        if (next == _txTail) {
+            return 0;
+        }
+    }
+    _txBuffer[head] = c;
+    _txHead = next;
+    return 1;
+}
+
+size_t SITLUARTDriver::write(const uint8_t *buffer, size_t size)
+{
+    _check_connection();
+    if (!_connected) {
+        return 0;
+    }
+    if (size > (size_t)txspace()) {
+        // the byte at a time path decides when to push the ring out
+        return AP_HAL::UARTDriver::write(buffer, size);
+    }
+    uint16_t head = _txHead;
+    uint16_t n = _txMask + 1 - head;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(&_txBuffer[head], buffer, n);
+    memcpy(&_txBuffer[0], buffer + n, size - n);
+    _txHead = (head + size) & _txMask;
+    return size;
+}
+
+/*
+  make sure a ring buffer can hold at least space bytes. The size is a
+  power of 2 with one byte always left free. Returns true if the
+  buffer was replaced
+ */
+bool SITLUARTDriver::_alloc_ring(uint8_t **buffer, uint16_t *mask, uint16_t space)
+{
+    uint16_t size = 16;
+    while (size <= space && size < _max_buffer_size) {
+        size <<= 1;
+    }
+    if (*buffer != NULL && size == *mask + 1) {
+        return false;
+    }
+    free(*buffer);
+    *buffer = (uint8_t *)malloc(size);
+    *mask = size - 1;
+    return true;
+}
+
+/*
+  send up to n bytes from the transmit ring in a single system
+  call. Returns the number of bytes sent
+ */
+uint16_t SITLUARTDriver::_tx_send(uint16_t n, bool blocking)
+{
+    uint16_t head = _txHead;
+    uint16_t tail = _txTail;
+    uint16_t pending = (head - tail) & _txMask;
+    struct iovec iov[2];
+    int iovcnt = 1;
+    ssize_t ret;
+
+    if (n > pending) {
+        n = pending;
+    }
+    if (n == 0 || !_connected) {
+        return 0;
+    }
+
+    // the queued data may wrap around the end of the ring
+    iov[0].iov_base = &_txBuffer[tail];
+    iov[0].iov_len  = n;
+    if (tail + n > _txMask + 1) {
+        iov[0].iov_len  = _txMask + 1 - tail;
+        iov[1].iov_base = &_txBuffer[0];
+        iov[1].iov_len  = n - iov[0].iov_len;
+        iovcnt = 2;
     }
+
     if (_console) {
-        return ::write(_fd, &c, 1);
+        ret = writev(_fd, iov, iovcnt);
+    } else {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ret = sendmsg(_fd, &msg, MSG_NOSIGNAL | (blocking ? 0 : MSG_DONTWAIT));
+    }
+    if (ret <= 0) {
+        if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            // nobody is listening, throw away what was queued
+            _txTail = head;
+        }
+        return 0;
+    }
+    _txTail = (tail + ret) & _txMask;
+    return ret;
+}
+
+/*
+  called from the SITL timer on each tick to push out queued bytes,
+  no faster than the baud rate if _baud_limit is set
+ */
+void SITLUARTDriver::_timer_tick(void)
+{
+    if (!_connected || !tx_pending()) {
+        _lastTxTick = hal.scheduler->micros();
+        return;
+    }
+    if (!_baud_limit || _baud == 0) {
+        _tx_send(_txMask, false);
+        return;
+    }
+
+    // 10 bits per byte on the wire, with the credit capped so an idle
+    // port can't save up a large burst
+    uint32_t now = hal.scheduler->micros();
+    _txCredit += (now - _lastTxTick) * 1.0e-7f * _baud;
+    _lastTxTick = now;
+    if (_txCredit > _txMask) {
+        _txCredit = _txMask;
     }
-    return send(_fd, &c, 1, flags);
+    _txCredit -= _tx_send((uint16_t)_txCredit, false);
 }
 
 // BetterStream method implementations /////////////////////////////////////////
@@ -228,7 +469,7 @@ void SITLUARTDriver::_tcp_start_connection(bool wait_for_connection)
 #ifdef HAVE_SOCK_SIN_LEN
             sockaddr.sin_len = sizeof(sockaddr);
 #endif
-            sockaddr.sin_port = htons(LISTEN_BASE_PORT + _portNumber);
+            sockaddr.sin_port = htons(_sitlState->base_port() + _portNumber);
             sockaddr.sin_family = AF_INET;
 
             _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -258,7 +499,7 @@ void SITLUARTDriver::_tcp_start_connection(bool wait_for_connection)
                 exit(1);
             }
 
-            fprintf(stderr, "Serial port %u on TCP port %u\n", _portNumber, LISTEN_BASE_PORT + _portNumber);
+            fprintf(stderr, "Serial port %u on TCP port %u\n", _portNumber, _sitlState->base_port() + _portNumber);
             fflush(stdout);
         }
 
@@ -21,6 +21,16 @@ public:
         
         _fd = -1;
         _listen_fd = -1;
+
+        _rxBuffer = NULL;
+        _rxMask = 0;
+        _rxHead = _rxTail = 0;
+        _txBuffer = NULL;
+        _txMask = 0;
+        _txHead = _txTail = 0;
+        _baud = 0;
+        _txCredit = 0;
+        _lastTxTick = 0;
 	}
 
     /* Implementations of UARTDriver virtual methods */
@@ -36,7 +46,7 @@ public:
     }
 
     bool tx_pending() {
-	    return false;
+	    return _txHead != _txTail;
     }
 
     /* Implementations of BetterStream virtual methods */
@@ -54,8 +64,12 @@ public:
     int16_t txspace();
     int16_t read();
 
+    /* Implementations of UARTDriver virtual methods */
+    size_t read(uint8_t *buffer, size_t len);
+
     /* Implementations of Print virtual methods */
     size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
 
     // file descriptor, exposed so SITL_State::loop_hook() can use it
 	int _fd;
@@ -70,6 +84,31 @@ private:
     uint16_t _rxSpace;
     uint16_t _txSpace;
 
+    // receive ring, filled from the socket or GPS pipe by _rx_fill()
+    uint8_t *_rxBuffer;
+    uint16_t _rxMask;
+    uint16_t _rxHead, _rxTail;
+
+    // transmit ring, filled by write() and emptied by _timer_tick()
+    // or when it fills up. The head is only moved by write() and the
+    // tail only by _tx_send(), so the timer can drain it safely
+    uint8_t *_txBuffer;
+    uint16_t _txMask;
+    volatile uint16_t _txHead, _txTail;
+
+    // baud rate limiting, see _baud_limit
+    uint32_t _baud;
+    float _txCredit;
+    uint32_t _lastTxTick;
+
+    // when set the ports send no faster than their baud rate
+    static bool _baud_limit;
+
+    static bool _alloc_ring(uint8_t **buffer, uint16_t *mask, uint16_t space);
+    uint16_t _rx_fill(void);
+    void _rx_inject(const uint8_t *data, uint16_t len);
+    void _timer_tick(void);
+    uint16_t _tx_send(uint16_t n, bool blocking);
     void _tcp_start_connection(bool wait_for_connection);
     void _check_connection(void);
     static bool _select_check(int );
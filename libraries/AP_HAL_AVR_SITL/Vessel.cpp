@@ -0,0 +1,208 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+/*
+  SITL handling
+
+  This is a built-in model of a twin thruster displacement hull. It
+  avoids the UDP round trip to an external simulator, so SITL can
+  run much faster than realtime.
+
+  The model is a simple 3 degree of freedom (surge, sway, yaw)
+  manoeuvring model with linear plus quadratic damping, a rudder that
+  works on the water flow plus prop wash, differential thrust, water
+  current and wind drag on the topsides.
+ */
+
+#include <AP_HAL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+
+#include <math.h>
+#include <AP_Math.h>
+#include "Vessel.h"
+
+using namespace AVR_SITL;
+
+// mass including added mass in surge and sway, kg
+static const float mass_x = 200.0f;
+static const float mass_y = 260.0f;
+// yaw moment of inertia including added inertia, kg m^2
+static const float inertia_z = 120.0f;
+
+// maximum forward thrust of each motor in N. Reverse thrust is weaker
+static const float max_thrust = 120.0f;
+static const float reverse_thrust_ratio = 0.6f;
+// distance of each thruster from the centreline, m
+static const float thruster_offset = 0.35f;
+
+// damping coefficients, linear then quadratic
+static const float surge_damping_lin  = 20.0f;
+static const float surge_damping_quad = 25.0f;
+static const float sway_damping_lin   = 150.0f;
+static const float sway_damping_quad  = 300.0f;
+static const float yaw_damping_lin    = 120.0f;
+static const float yaw_damping_quad   = 150.0f;
+
+// rudder lift per radian per (m/s)^2 of flow, its distance aft of
+// the centre of gravity and its maximum deflection
+static const float rudder_lift   = 8.0f;
+static const float rudder_arm    = 1.8f;
+static const float rudder_max    = 35 * DEG_TO_RAD;
+// equivalent (m/s)^2 of flow over the rudder per N of thrust
+static const float prop_wash     = 0.02f;
+
+// wind drag area times drag coefficient for the topsides, m^2
+static const float wind_area_x   = 0.5f;
+static const float wind_area_y   = 1.5f;
+static const float air_density   = 1.225f;
+
+// largest integration step, seconds
+static const float max_step      = 0.005f;
+
+/*
+  set the starting location
+ */
+void SITLVessel::set_home(double lat, double lng, double alt, float heading)
+{
+    _home_lat = lat;
+    _home_lng = lng;
+    _home_alt = alt;
+    _posN = _posE = 0;
+    _yaw = radians(heading);
+    _u = _v = _r = 0;
+}
+
+/*
+  convert a PWM value into -1 to 1
+ */
+static float pwm_to_norm(uint16_t pwm)
+{
+    if (pwm == 0) {
+        // no output on this channel
+        return 0;
+    }
+    return constrain_float((pwm - 1500) / 500.0f, -1.0f, 1.0f);
+}
+
+/*
+  thrust in N from one throttle channel
+ */
+static float thrust(uint16_t pwm)
+{
+    float t = pwm_to_norm(pwm);
+    if (t < 0) {
+        return t * max_thrust * reverse_thrust_ratio;
+    }
+    return t * max_thrust;
+}
+
+/*
+  advance the model by delta_t seconds
+ */
+void SITLVessel::update(const uint16_t *pwm, const SITL *sitl, float delta_t)
+{
+    float rudder      = pwm_to_norm(pwm[0]) * rudder_max;
+    float thrust_port = thrust(pwm[2]);
+    float thrust_stbd = thrust(pwm[3]);
+
+    // wind direction is where it is coming from, current direction
+    // is where it is going to
+    float wind_dir = radians(sitl->wind_direction);
+    float wind_N = -sitl->wind_speed * cosf(wind_dir);
+    float wind_E = -sitl->wind_speed * sinf(wind_dir);
+    float current_dir = radians(sitl->current_direction);
+    float current_N = sitl->current_speed * cosf(current_dir);
+    float current_E = sitl->current_speed * sinf(current_dir);
+
+    while (delta_t > 0) {
+        float dt = min(delta_t, max_step);
+        _step(rudder, thrust_port, thrust_stbd,
+              wind_N, wind_E, current_N, current_E, dt);
+        delta_t -= dt;
+    }
+}
+
+/*
+  one integration step of the manoeuvring model
+ */
+void SITLVessel::_step(float rudder, float thrust_port, float thrust_stbd,
+                       float wind_N, float wind_E, float current_N, float current_E,
+                       float dt)
+{
+    float cos_yaw = cosf(_yaw);
+    float sin_yaw = sinf(_yaw);
+
+    // velocity through the water in body frame
+    float u_r = _u - ( current_N * cos_yaw + current_E * sin_yaw);
+    float v_r = _v - (-current_N * sin_yaw + current_E * cos_yaw);
+
+    // apparent wind in body frame
+    float speedN = _u * cos_yaw - _v * sin_yaw;
+    float speedE = _u * sin_yaw + _v * cos_yaw;
+    float aw_N = wind_N - speedN;
+    float aw_E = wind_E - speedE;
+    float aw_x =  aw_N * cos_yaw + aw_E * sin_yaw;
+    float aw_y = -aw_N * sin_yaw + aw_E * cos_yaw;
+
+    // the rudder works on the flow past the hull plus the prop wash
+    float rudder_flow = u_r * fabsf(u_r) + prop_wash * (thrust_port + thrust_stbd);
+    float rudder_force = rudder_lift * rudder * rudder_flow;
+
+    float X = thrust_port + thrust_stbd
+        - surge_damping_lin * u_r - surge_damping_quad * fabsf(u_r) * u_r
+        + 0.5f * air_density * wind_area_x * fabsf(aw_x) * aw_x;
+    float Y = -rudder_force
+        - sway_damping_lin * v_r - sway_damping_quad * fabsf(v_r) * v_r
+        + 0.5f * air_density * wind_area_y * fabsf(aw_y) * aw_y;
+    float N = thruster_offset * (thrust_port - thrust_stbd)
+        + rudder_arm * rudder_force
+        - yaw_damping_lin * _r - yaw_damping_quad * fabsf(_r) * _r;
+
+    _accel_x = X / mass_x;
+    _accel_y = Y / mass_y;
+
+    _u += (_accel_x + (mass_y / mass_x) * _v * _r) * dt;
+    _v += (_accel_y - (mass_x / mass_y) * _u * _r) * dt;
+    _r += (N / inertia_z) * dt;
+
+    _yaw += _r * dt;
+    if (_yaw < 0) {
+        _yaw += 2*PI;
+    } else if (_yaw >= 2*PI) {
+        _yaw -= 2*PI;
+    }
+
+    _posN += (_u * cosf(_yaw) - _v * sinf(_yaw)) * dt;
+    _posE += (_u * sinf(_yaw) + _v * cosf(_yaw)) * dt;
+}
+
+/*
+  fill in a FDM packet from the current state
+ */
+void SITLVessel::fill_fdm(struct sitl_fdm &fdm) const
+{
+    float cos_yaw = cosf(_yaw);
+    float sin_yaw = sinf(_yaw);
+
+    // keep the position in double precision, a float only gives
+    // metre resolution in latitude
+    fdm.latitude  = _home_lat + (_posN / RADIUS_OF_EARTH) * (180.0 / M_PI);
+    fdm.longitude = _home_lng + (_posE / (RADIUS_OF_EARTH * cos(_home_lat * (M_PI / 180.0)))) * (180.0 / M_PI);
+    fdm.altitude  = _home_alt;
+    fdm.heading   = degrees(_yaw);
+    fdm.speedN    = _u * cos_yaw - _v * sin_yaw;
+    fdm.speedE    = _u * sin_yaw + _v * cos_yaw;
+    fdm.speedD    = 0;
+    // the accelerometers see the kinematic acceleration plus gravity
+    fdm.xAccel    = _accel_x;
+    fdm.yAccel    = _accel_y;
+    fdm.zAccel    = -GRAVITY_MSS;
+    fdm.rollRate  = 0;
+    fdm.pitchRate = 0;
+    fdm.yawRate   = degrees(_r);
+    fdm.rollDeg   = 0;
+    fdm.pitchDeg  = 0;
+    fdm.yawDeg    = degrees(_yaw);
+    fdm.airspeed  = pythagorous2(fdm.speedN, fdm.speedE);
+    fdm.magic     = 0x4c56414f;
+}
+
+#endif // CONFIG_HAL_BOARD
@@ -0,0 +1,56 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+#ifndef __AP_HAL_AVR_SITL_VESSEL_H__
+#define __AP_HAL_AVR_SITL_VESSEL_H__
+
+#include <AP_HAL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+
+#include "AP_HAL_AVR_SITL_Namespace.h"
+#include "../SITL/SITL.h"
+
+/*
+  a built-in model of a twin thruster displacement hull, used in place
+  of an external simulator. Inputs are the rudder on CH1 and the PORT
+  and STBD throttles on CH3 and CH4. The model is 3 degree of freedom
+  (surge, sway and yaw) with the water current and wind taken from
+  the SIM_ parameters
+ */
+class AVR_SITL::SITLVessel {
+public:
+    SITLVessel() :
+        _home_lat(0), _home_lng(0), _home_alt(0),
+        _posN(0), _posE(0), _yaw(0),
+        _u(0), _v(0), _r(0),
+        _accel_x(0), _accel_y(0)
+    {}
+
+    // set the starting location, heading in degrees
+    void set_home(double lat, double lng, double alt, float heading);
+
+    // advance the model by delta_t seconds
+    void update(const uint16_t *pwm, const SITL *sitl, float delta_t);
+
+    // fill in a FDM packet from the current state
+    void fill_fdm(struct sitl_fdm &fdm) const;
+
+private:
+    void _step(float rudder, float thrust_port, float thrust_stbd,
+               float wind_N, float wind_E, float current_N, float current_E,
+               float dt);
+
+    double _home_lat, _home_lng, _home_alt;
+
+    // position in metres from home, and heading in radians
+    double _posN, _posE;
+    float  _yaw;
+
+    // body frame surge and sway velocity in m/s, yaw rate in rad/s
+    float _u, _v, _r;
+
+    // last body frame acceleration, for the accelerometers
+    float _accel_x, _accel_y;
+};
+
+#endif // CONFIG_HAL_BOARD
+#endif // __AP_HAL_AVR_SITL_VESSEL_H__
@@ -0,0 +1,166 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+/*
+  SITL handling
+
+  This is a model of the CTD A-frame and winch, so the cast logic can
+  be run in SITL.
+
+  With the clutch released the weight of the CTD swings the A-frame
+  aft and then pulls line off the drum. With the clutch engaged the
+  motor hauls the line in, and once the CTD is at the block it pulls
+  the A-frame forward to its stowed position. The proximity sensors
+  at each end of the A-frame travel bounce for SIM_PIN_BOUNCE ms when
+  they change, and SIM_WINCH_SNAG is the chance that a cast catches
+  on the way up. A snag holds the line until the motor has pulled on
+  it for a few seconds, and the motor controller raises its safety
+  stop while the motor is stalled against it.
+ */
+
+#include <AP_HAL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+
+#include <stdlib.h>
+#include <AP_Math.h>
+#include "Winch.h"
+
+using namespace AVR_SITL;
+
+// PWM that is neither retracting nor paying out line, and the dead
+// band around it
+static const uint16_t motor_trim     = 1500;
+static const uint16_t motor_deadband = 25;
+
+// line speed at full motor output and in free fall, m/s
+static const float max_winch_speed = 3.5f;
+static const float freefall_speed  = 1.0f;
+
+// length of line on the drum, m
+static const float max_line = 100.0f;
+
+// seconds for the A-frame to swing aft under the CTD weight, and
+// metres of line the motor hauls in to bring it forward again
+static const float deploy_time = 1.5f;
+static const float aframe_line = 1.0f;
+
+// seconds of stall before the motor controller safety stop, and the
+// range of pulling time it takes to free a snag
+static const float stall_delay    = 0.3f;
+static const float snag_hold_min  = 3.0f;
+static const float snag_hold_max  = 15.0f;
+
+/*
+  a random float between 0 and 1
+ */
+static float rand_unit(void)
+{
+    return random() / (float)RAND_MAX;
+}
+
+/*
+  start the contact bounce of a sensor that has just changed
+ */
+void SITLWinch::_start_bounce(uint8_t sensor, const SITL *sitl, uint32_t now_ms)
+{
+    _sensor[sensor] = !_sensor[sensor];
+    _bounce_end_ms[sensor] = now_ms + sitl->pin_bounce;
+}
+
+/*
+  advance the model to the given time
+ */
+void SITLWinch::update(uint16_t motor_pwm, uint16_t clutch_pwm,
+                       const SITL *sitl, uint32_t now_ms)
+{
+    float dt = (now_ms - _last_update_ms) * 1.0e-3f;
+    _last_update_ms = now_ms;
+    if (dt <= 0 || dt > 1) {
+        return;
+    }
+
+    // line speed from the motor, positive pays out
+    float drive = 0;
+    if (motor_pwm != 0 && abs((int16_t)motor_pwm - (int16_t)motor_trim) > motor_deadband) {
+        drive = constrain_float(((int16_t)motor_pwm - (int16_t)motor_trim) / 500.0f, -1, 1) * max_winch_speed;
+    }
+    bool clutch_free = clutch_pwm > motor_trim;
+    bool stalled = false;
+
+    if (clutch_free || drive > 0) {
+        if (!_cast_started) {
+            // a new cast, decide now whether it will snag
+            _cast_started = true;
+            _snag_pending = rand_unit() < sitl->winch_snag;
+            _snag_depth = -1;
+        }
+        float speed = clutch_free ? freefall_speed : drive;
+        if (_aframe < 1) {
+            _aframe = min(_aframe + dt / deploy_time, 1.0f);
+        } else {
+            _line_out = min(_line_out + speed * dt, max_line);
+        }
+    } else if (drive < 0) {
+        float speed = -drive;
+        if (_snag_pending && _line_out > 0) {
+            // catch somewhere along the line that is out
+            _snag_pending = false;
+            _snag_depth = _line_out * rand_unit();
+            _snag_hold = snag_hold_min + rand_unit() * (snag_hold_max - snag_hold_min);
+            _stall_time = 0;
+        }
+        if (_snag_depth >= 0 && _line_out <= _snag_depth) {
+            _stall_time += dt;
+            stalled = _stall_time > stall_delay;
+            if (_stall_time > _snag_hold) {
+                // the line has worked free
+                _snag_depth = -1;
+            }
+        } else if (_line_out > 0) {
+            _line_out = max(_line_out - speed * dt, 0.0f);
+        } else {
+            _aframe = max(_aframe - speed * dt / aframe_line, 0.0f);
+            if (_aframe == 0) {
+                _cast_started = false;
+            }
+        }
+    }
+    _stalled = stalled;
+
+    // the proximity sensors pull their pins low at each end of travel
+    uint8_t aft = _aframe >= 0.98f ? 0 : 1;
+    uint8_t fwd = _aframe <= 0.02f ? 0 : 1;
+    if (aft != _sensor[0]) {
+        _start_bounce(0, sitl, now_ms);
+    }
+    if (fwd != _sensor[1]) {
+        _start_bounce(1, sitl, now_ms);
+    }
+
+    // the pins only change on a model step, so the firmware sees the
+    // same levels whenever it reads them within a step
+    for (uint8_t i=0; i<NUM_SENSORS; i++) {
+        if ((int32_t)(_bounce_end_ms[i] - now_ms) > 0) {
+            _level[i] = random() & 1;
+        } else {
+            _level[i] = _sensor[i];
+        }
+    }
+}
+
+/*
+  read one of the model pins. Returns -1 for a pin the model doesn't
+  drive
+ */
+int8_t SITLWinch::read_pin(uint8_t pin) const
+{
+    switch (pin) {
+    case PIN_AFT:
+        return _level[0];
+    case PIN_FOR:
+        return _level[1];
+    case PIN_STALL:
+        return _stalled ? 0 : 1;
+    }
+    return -1;
+}
+
+#endif // CONFIG_HAL_BOARD
@@ -0,0 +1,84 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+#ifndef __AP_HAL_AVR_SITL_WINCH_H__
+#define __AP_HAL_AVR_SITL_WINCH_H__
+
+#include <AP_HAL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+
+#include "AP_HAL_AVR_SITL_Namespace.h"
+#include "../SITL/SITL.h"
+
+/*
+  a model of the CTD A-frame and winch. Inputs are the winch motor on
+  CH2 (below trim retracts) and the winch clutch on CH6 (above trim
+  lets the line run free). Outputs are the A-frame proximity sensors
+  and the motor controller safety stop, on the analog pins the
+  AFRAME_AFT_PIN, AFRAME_FOR_PIN and WINCH_STALL_PIN defaults use
+ */
+class AVR_SITL::SITLWinch {
+public:
+    SITLWinch() :
+        _line_out(0), _aframe(0),
+        _last_update_ms(0),
+        _cast_started(false), _snag_pending(false),
+        _snag_depth(-1), _snag_hold(0), _stall_time(0),
+        _stalled(false)
+    {
+        // stowed, so off the aft sensor and on the forward one
+        _sensor[0] = _level[0] = 1;
+        _sensor[1] = _level[1] = 0;
+        _bounce_end_ms[0] = _bounce_end_ms[1] = 0;
+    }
+
+    // analog pins driven by the model
+    enum pins {
+        PIN_AFT   = 0, // A-frame fully deployed, low when there
+        PIN_FOR   = 1, // A-frame stowed, low when there
+        PIN_STALL = 2  // motor controller safety stop, low when on
+    };
+
+    // advance the model to the given time
+    void update(uint16_t motor_pwm, uint16_t clutch_pwm,
+                const SITL *sitl, uint32_t now_ms);
+
+    // read one of the model pins. Returns -1 for a pin the model
+    // doesn't drive
+    int8_t read_pin(uint8_t pin) const;
+
+private:
+    void _start_bounce(uint8_t sensor, const SITL *sitl, uint32_t now_ms);
+
+    // metres of line paid out
+    float _line_out;
+
+    // A-frame position, 0 is stowed forward and 1 is fully aft
+    float _aframe;
+
+    uint32_t _last_update_ms;
+
+    // set when the A-frame leaves its stowed position, and whether
+    // this cast will snag once the line starts coming in
+    bool _cast_started;
+    bool _snag_pending;
+
+    // depth at which the line snags on the way up, -1 for no snag,
+    // and how many seconds of pulling it takes to free
+    float _snag_depth;
+    float _snag_hold;
+
+    // seconds the motor has been pulling against a snag, and whether
+    // the motor controller safety stop is on
+    float _stall_time;
+    bool  _stalled;
+
+    // the aft and forward proximity sensors, with the time their
+    // contacts stop bouncing and the level on their pins
+    enum { NUM_SENSORS = 2 };
+    uint8_t  _sensor[NUM_SENSORS];
+    uint32_t _bounce_end_ms[NUM_SENSORS];
+    uint8_t  _level[NUM_SENSORS];
+};
+
+#endif // CONFIG_HAL_BOARD
+#endif // __AP_HAL_AVR_SITL_WINCH_H__
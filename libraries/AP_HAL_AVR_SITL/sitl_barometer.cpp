@@ -43,6 +43,7 @@ void SITL_State::_update_barometer(float altitude)
 	last_update = hal.scheduler->millis();
 
 	_barometer->setHIL(altitude);
+	_record_baro(altitude);
 }
 
 #endif
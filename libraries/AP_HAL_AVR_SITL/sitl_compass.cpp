@@ -43,6 +43,8 @@ void SITL_State::_update_compass(float rollDeg, float pitchDeg, float yawDeg)
 	_compass->mag_x += noise.x;
 	_compass->mag_y += noise.y;
 	_compass->mag_z += noise.z;
+
+	_record_compass(radians(rollDeg), radians(pitchDeg), radians(yawDeg));
 }
 
 #endif
@@ -449,6 +449,14 @@ void SITL_State::_update_gps(double latitude, double longitude, float altitude,
 	d.latitude = latitude;
 	d.longitude = longitude;
 	d.altitude = altitude;
+	if (_sitl->gps_noise > 0 && have_lock) {
+		// position noise, converted from metres to degrees
+		double noise_lat = _sitl->gps_noise * _rand_float() / RADIUS_OF_EARTH;
+		double noise_lng = _sitl->gps_noise * _rand_float() / RADIUS_OF_EARTH;
+		d.latitude  += noise_lat * (180.0 / M_PI);
+		d.longitude += noise_lng * (180.0 / M_PI) / cos(latitude * (M_PI / 180.0));
+		d.altitude  += _sitl->gps_noise * _rand_float();
+	}
 	d.speedN = speedN;
 	d.speedE = speedE;
 	d.speedD = speedD;
@@ -121,6 +121,8 @@ void SITL_State::_update_ins(float roll, 	float pitch, 	float yaw,		// Relative
 	_ins->set_accel(Vector3f(xAccel, yAccel, zAccel) + _ins->get_accel_offsets());
 
 	airspeed_pin_value = _airspeed_sensor(airspeed);
+
+	_record_ins();
 }
 
 #endif
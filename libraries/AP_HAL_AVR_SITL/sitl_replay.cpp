@@ -0,0 +1,555 @@
+// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+/*
+  SITL handling
+
+  This records everything the simulated hardware hands to the
+  firmware, and plays it back in place of the simulator.
+
+  A recording holds the EEPROM contents at startup followed by a
+  stream of timestamped records: the INS, barometer and compass
+  values, the RC inputs, the levels on the simulated digital pins and
+  every block of bytes read from a serial port (which covers the GPS
+  and the ground station). Played back with the synthetic clock, the
+  firmware sees exactly the same inputs at exactly the same times, so
+  it runs through exactly the same states as fast as the CPU allows.
+
+  The servo outputs are recorded as well, and checked on playback to
+  show where a changed firmware first behaves differently.
+ */
+
+#include <AP_HAL.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+
+#include <AP_HAL_AVR.h>
+#include <AP_HAL_AVR_SITL.h>
+#include "AP_HAL_AVR_SITL_Namespace.h"
+#include "HAL_AVR_SITL_Class.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "Scheduler.h"
+#include "Storage.h"
+#include "UARTDriver.h"
+
+using namespace AVR_SITL;
+extern const AP_HAL::HAL& hal;
+
+#define REPLAY_MAGIC   "SREC"
+#define REPLAY_VERSION 1
+
+// record types
+enum replay_type {
+    REPLAY_INS     = 1,
+    REPLAY_BARO    = 2,
+    REPLAY_COMPASS = 3,
+    REPLAY_RCIN    = 4,
+    REPLAY_PINS    = 5,
+    REPLAY_UART    = 6,
+    REPLAY_SERVO   = 7
+};
+
+struct PACKED replay_header {
+    char     magic[4];
+    uint8_t  version;
+    uint8_t  num_servos;
+    uint16_t eeprom_size;
+};
+
+struct PACKED replay_ins {
+    float    gyro[3];
+    float    accel[3];
+    uint16_t airspeed_pin_value;
+};
+
+struct PACKED replay_baro {
+    float altitude;
+};
+
+struct PACKED replay_compass {
+    float   roll, pitch, yaw;
+    int16_t mag[3];
+};
+
+struct PACKED replay_rcin {
+    uint16_t pwm[8];
+};
+
+struct PACKED replay_pins {
+    uint16_t mask;
+    uint16_t levels;
+};
+
+// followed by len bytes of data
+struct PACKED replay_uart {
+    uint8_t  port;
+    uint8_t  index;
+    uint16_t len;
+};
+
+struct PACKED replay_servo {
+    uint16_t pwm[11];
+};
+
+// the largest record, a full serial receive ring
+#define REPLAY_MAX_RECORD (sizeof(struct replay_uart) + 512)
+
+// number of serial ports
+#define REPLAY_NUM_PORTS 3
+
+// state of recording and playback
+static struct {
+    FILE *record;
+    FILE *replay;
+    uint64_t last_usec;
+
+    // what was last recorded, so only changes are written
+    struct replay_rcin  rcin;
+    struct replay_pins  pins;
+    struct replay_servo servo;
+    bool have_servo;
+
+    // the next record to play back
+    uint8_t  type;
+    uint64_t usec;
+    uint8_t  buf[REPLAY_MAX_RECORD];
+    uint32_t count;
+
+    // servo output check
+    uint32_t servo_checks;
+    uint32_t servo_mismatches;
+    uint64_t first_mismatch_usec;
+    uint8_t  first_mismatch_chan;
+    uint16_t first_mismatch_pwm[2];
+
+    // calls to fill each serial receive ring at the current time
+    uint64_t fill_usec[REPLAY_NUM_PORTS];
+    uint8_t  fill_count[REPLAY_NUM_PORTS];
+} replay_state;
+
+/*
+  payload length of a fixed size record, 0 for a serial record
+ */
+static uint16_t replay_length(uint8_t type)
+{
+    switch (type) {
+    case REPLAY_INS:     return sizeof(struct replay_ins);
+    case REPLAY_BARO:    return sizeof(struct replay_baro);
+    case REPLAY_COMPASS: return sizeof(struct replay_compass);
+    case REPLAY_RCIN:    return sizeof(struct replay_rcin);
+    case REPLAY_PINS:    return sizeof(struct replay_pins);
+    case REPLAY_SERVO:   return sizeof(struct replay_servo);
+    }
+    return 0;
+}
+
+static SITLUARTDriver *replay_port(uint8_t port)
+{
+    switch (port) {
+    case 0: return (SITLUARTDriver *)hal.uartA;
+    case 1: return (SITLUARTDriver *)hal.uartB;
+    case 2: return (SITLUARTDriver *)hal.uartC;
+    }
+    return NULL;
+}
+
+bool SITL_State::recording(void)
+{
+    return replay_state.record != NULL;
+}
+
+bool SITL_State::replaying(void)
+{
+    return replay_state.replay != NULL;
+}
+
+static void record_close(void)
+{
+    fclose(replay_state.record);
+}
+
+/*
+  start a recording, beginning with the current EEPROM contents
+ */
+void SITL_State::_record_open(const char *filename)
+{
+    struct replay_header hdr;
+    uint8_t eeprom[SITL_EEPROM_SIZE];
+
+    replay_state.record = fopen(filename, "wb");
+    if (replay_state.record == NULL) {
+        fprintf(stderr, "Failed to create %s - %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    setvbuf(replay_state.record, NULL, _IOFBF, 65536);
+
+    memcpy(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic));
+    hdr.version = REPLAY_VERSION;
+    hdr.num_servos = 11;
+    hdr.eeprom_size = SITL_EEPROM_SIZE;
+    ((SITLEEPROMStorage *)hal.storage)->save_image(eeprom);
+    fwrite(&hdr, sizeof(hdr), 1, replay_state.record);
+    fwrite(eeprom, sizeof(eeprom), 1, replay_state.record);
+    atexit(record_close);
+    fprintf(stdout, "Recording inputs to %s\n", filename);
+}
+
+/*
+  start playing back a recording, loading its EEPROM contents
+ */
+void SITL_State::_replay_open(const char *filename)
+{
+    struct replay_header hdr;
+    uint8_t eeprom[SITL_EEPROM_SIZE];
+
+    replay_state.replay = fopen(filename, "rb");
+    if (replay_state.replay == NULL) {
+        fprintf(stderr, "Failed to open %s - %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, replay_state.replay) != 1 ||
+        memcmp(hdr.magic, REPLAY_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != REPLAY_VERSION ||
+        hdr.eeprom_size != SITL_EEPROM_SIZE ||
+        fread(eeprom, sizeof(eeprom), 1, replay_state.replay) != 1) {
+        fprintf(stderr, "%s is not a SITL recording\n", filename);
+        exit(1);
+    }
+    ((SITLEEPROMStorage *)hal.storage)->load_image(eeprom);
+    fprintf(stdout, "Playing back inputs from %s\n", filename);
+
+    if (!_replay_read()) {
+        _replay_finish();
+    }
+}
+
+/*
+  write a record. The time is a variable length count of
+  microseconds since the last record, 7 bits per byte
+ */
+void SITL_State::_record(uint8_t type, const void *data, uint16_t len)
+{
+    uint8_t hdr[11];
+    uint8_t n = 0;
+    uint64_t now = _scheduler->stopped_clock_usec();
+    uint64_t delta = now - replay_state.last_usec;
+
+    replay_state.last_usec = now;
+    hdr[n++] = type;
+    while (delta >= 0x80) {
+        hdr[n++] = (delta & 0x7F) | 0x80;
+        delta >>= 7;
+    }
+    hdr[n++] = delta;
+    fwrite(hdr, n, 1, replay_state.record);
+    fwrite(data, len, 1, replay_state.record);
+}
+
+/*
+  read the next record to play back. Returns false at the end of the
+  recording
+ */
+bool SITL_State::_replay_read(void)
+{
+    FILE *f = replay_state.replay;
+    uint64_t delta = 0;
+    uint16_t len;
+    int c;
+
+    c = getc(f);
+    if (c == EOF) {
+        return false;
+    }
+    replay_state.type = c;
+    for (uint8_t shift=0; shift<64; shift += 7) {
+        if ((c = getc(f)) == EOF) {
+            return false;
+        }
+        delta |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            break;
+        }
+    }
+    replay_state.usec += delta;
+
+    len = replay_length(replay_state.type);
+    if (replay_state.type == REPLAY_UART) {
+        struct replay_uart *u = (struct replay_uart *)replay_state.buf;
+        if (fread(u, sizeof(*u), 1, f) != 1 ||
+            u->len > sizeof(replay_state.buf) - sizeof(*u)) {
+            return false;
+        }
+        return u->len == 0 || fread(u+1, u->len, 1, f) == 1;
+    }
+    if (len == 0) {
+        fprintf(stderr, "Unknown record type %u in recording\n", (unsigned)replay_state.type);
+        return false;
+    }
+    return fread(replay_state.buf, len, 1, f) == 1;
+}
+
+/*
+  hand a played back record to the firmware
+ */
+void SITL_State::_replay_apply(void)
+{
+    const uint8_t *buf = replay_state.buf;
+
+    switch (replay_state.type) {
+    case REPLAY_INS: {
+        const struct replay_ins *r = (const struct replay_ins *)buf;
+        if (_ins != NULL) {
+            _ins->set_gyro(Vector3f(r->gyro[0], r->gyro[1], r->gyro[2]));
+            _ins->set_accel(Vector3f(r->accel[0], r->accel[1], r->accel[2]));
+        }
+        airspeed_pin_value = r->airspeed_pin_value;
+        break;
+    }
+
+    case REPLAY_BARO: {
+        const struct replay_baro *r = (const struct replay_baro *)buf;
+        if (_barometer != NULL) {
+            _barometer->setHIL(r->altitude);
+        }
+        break;
+    }
+
+    case REPLAY_COMPASS: {
+        const struct replay_compass *r = (const struct replay_compass *)buf;
+        if (_compass != NULL) {
+            _compass->setHIL(r->roll, r->pitch, r->yaw);
+            _compass->mag_x = r->mag[0];
+            _compass->mag_y = r->mag[1];
+            _compass->mag_z = r->mag[2];
+        }
+        break;
+    }
+
+    case REPLAY_RCIN:
+        memcpy(pwm_input, buf, sizeof(struct replay_rcin));
+        break;
+
+    case REPLAY_PINS: {
+        const struct replay_pins *r = (const struct replay_pins *)buf;
+        _pin_mask   = r->mask;
+        _pin_levels = r->levels;
+        break;
+    }
+
+    case REPLAY_UART: {
+        const struct replay_uart *r = (const struct replay_uart *)buf;
+        SITLUARTDriver *uart = replay_port(r->port);
+        if (uart != NULL) {
+            uart->_rx_inject((const uint8_t *)(r+1), r->len);
+        }
+        break;
+    }
+
+    case REPLAY_SERVO:
+        memcpy(&replay_state.servo, buf, sizeof(replay_state.servo));
+        replay_state.have_servo = true;
+        break;
+    }
+    replay_state.count++;
+}
+
+/*
+  the recording has run out. Report how the servo outputs compared
+  and exit, with a failure if they differed
+ */
+void SITL_State::_replay_finish(void)
+{
+    fprintf(stdout, "Playback finished at %.3fs after %lu records\n",
+            replay_state.usec * 1.0e-6, (unsigned long)replay_state.count);
+    if (replay_state.servo_mismatches == 0) {
+        fprintf(stdout, "Servo outputs matched on all %lu steps\n",
+                (unsigned long)replay_state.servo_checks);
+        exit(0);
+    }
+    fprintf(stdout, "Servo outputs differed on %lu of %lu steps, first on channel %u at %.3fs (recorded %u, played back %u)\n",
+            (unsigned long)replay_state.servo_mismatches,
+            (unsigned long)replay_state.servo_checks,
+            (unsigned)replay_state.first_mismatch_chan + 1,
+            replay_state.first_mismatch_usec * 1.0e-6,
+            (unsigned)replay_state.first_mismatch_pwm[0],
+            (unsigned)replay_state.first_mismatch_pwm[1]);
+    exit(1);
+}
+
+/*
+  count the calls made to fill the receive ring of a serial port at
+  the current time. Serial records carry this count, so on playback
+  the data turns up on the same call that read it when recording
+ */
+uint8_t SITL_State::uart_fill_index(uint8_t port)
+{
+    uint64_t now = _scheduler->stopped_clock_usec();
+
+    if (port >= REPLAY_NUM_PORTS) {
+        return 0;
+    }
+    if (replay_state.fill_usec[port] != now) {
+        replay_state.fill_usec[port] = now;
+        replay_state.fill_count[port] = 0;
+    }
+    if (replay_state.fill_count[port] == 0xFF) {
+        return 0xFF;
+    }
+    return replay_state.fill_count[port]++;
+}
+
+/*
+  record data read from a serial port
+ */
+void SITL_State::record_uart(uint8_t port, uint8_t index,
+                             const uint8_t *data1, uint16_t len1,
+                             const uint8_t *data2, uint16_t len2)
+{
+    uint8_t buf[REPLAY_MAX_RECORD];
+    struct replay_uart *r = (struct replay_uart *)buf;
+
+    if (sizeof(*r) + len1 + len2 > sizeof(buf)) {
+        return;
+    }
+    r->port = port;
+    r->index = index;
+    r->len = len1 + len2;
+    memcpy(r+1, data1, len1);
+    memcpy(((uint8_t *)(r+1)) + len1, data2, len2);
+    _record(REPLAY_UART, buf, sizeof(*r) + r->len);
+}
+
+/*
+  record the values just handed to the INS
+ */
+void SITL_State::_record_ins(void)
+{
+    struct replay_ins r;
+
+    if (!recording() || _ins == NULL) {
+        return;
+    }
+    Vector3f gyro = _ins->get_gyro();
+    Vector3f accel = _ins->get_accel();
+    r.gyro[0]  = gyro.x;  r.gyro[1]  = gyro.y;  r.gyro[2]  = gyro.z;
+    r.accel[0] = accel.x; r.accel[1] = accel.y; r.accel[2] = accel.z;
+    r.airspeed_pin_value = airspeed_pin_value;
+    _record(REPLAY_INS, &r, sizeof(r));
+}
+
+/*
+  record the altitude just handed to the barometer
+ */
+void SITL_State::_record_baro(float altitude)
+{
+    struct replay_baro r;
+
+    if (!recording()) {
+        return;
+    }
+    r.altitude = altitude;
+    _record(REPLAY_BARO, &r, sizeof(r));
+}
+
+/*
+  record the attitude just handed to the compass, in radians, and the
+  field it gave with noise added
+ */
+void SITL_State::_record_compass(float roll, float pitch, float yaw)
+{
+    struct replay_compass r;
+
+    if (!recording() || _compass == NULL) {
+        return;
+    }
+    r.roll = roll;
+    r.pitch = pitch;
+    r.yaw = yaw;
+    r.mag[0] = _compass->mag_x;
+    r.mag[1] = _compass->mag_y;
+    r.mag[2] = _compass->mag_z;
+    _record(REPLAY_COMPASS, &r, sizeof(r));
+}
+
+/*
+  called on each step of the simulation to record any change in the
+  RC inputs, digital pins and servo outputs
+ */
+void SITL_State::_record_step(void)
+{
+    struct replay_pins pins;
+
+    if (!recording()) {
+        return;
+    }
+
+    if (!replay_state.have_servo ||
+        memcmp(replay_state.servo.pwm, pwm_output, sizeof(replay_state.servo.pwm)) != 0) {
+        memcpy(replay_state.servo.pwm, pwm_output, sizeof(replay_state.servo.pwm));
+        replay_state.have_servo = true;
+        _record(REPLAY_SERVO, &replay_state.servo, sizeof(replay_state.servo));
+    }
+
+    if (memcmp(replay_state.rcin.pwm, pwm_input, sizeof(replay_state.rcin.pwm)) != 0) {
+        memcpy(replay_state.rcin.pwm, pwm_input, sizeof(replay_state.rcin.pwm));
+        _record(REPLAY_RCIN, &replay_state.rcin, sizeof(replay_state.rcin));
+    }
+
+    pins.mask = _pin_mask;
+    pins.levels = _pin_levels;
+    if (memcmp(&pins, &replay_state.pins, sizeof(pins)) != 0) {
+        replay_state.pins = pins;
+        _record(REPLAY_PINS, &pins, sizeof(pins));
+    }
+
+    // keep the file current in case we are killed
+    static uint64_t last_flush_usec;
+    if (replay_state.last_usec - last_flush_usec >= 1000000) {
+        last_flush_usec = replay_state.last_usec;
+        fflush(replay_state.record);
+    }
+}
+
+/*
+  hand the firmware the recorded input up to the current time. This
+  is called on each step of the simulation with a port of
+  REPLAY_STEP, and on each attempt to fill a serial receive ring. A
+  serial record waits for the fill call that read it when recording,
+  unless the clock has already moved past it
+ */
+void SITL_State::replay_input(uint8_t port, uint8_t index)
+{
+    uint64_t now = _scheduler->stopped_clock_usec();
+
+    while (replay_state.usec <= now) {
+        if (replay_state.type == REPLAY_UART && replay_state.usec == now) {
+            const struct replay_uart *r = (const struct replay_uart *)replay_state.buf;
+            if (r->port != port || index < r->index) {
+                break;
+            }
+        }
+        _replay_apply();
+        if (!_replay_read()) {
+            _replay_finish();
+        }
+    }
+
+    if (port == REPLAY_STEP && replay_state.have_servo) {
+        replay_state.servo_checks++;
+        for (uint8_t i=0; i<11; i++) {
+            if (pwm_output[i] != replay_state.servo.pwm[i]) {
+                if (replay_state.servo_mismatches == 0) {
+                    replay_state.first_mismatch_usec = now;
+                    replay_state.first_mismatch_chan = i;
+                    replay_state.first_mismatch_pwm[0] = replay_state.servo.pwm[i];
+                    replay_state.first_mismatch_pwm[1] = pwm_output[i];
+                }
+                replay_state.servo_mismatches++;
+                break;
+            }
+        }
+    }
+}
+
+#endif
@@ -28,4 +28,5 @@ int16_t EmptyUARTDriver::read() { return -1; }
 
 /* Empty implementations of Print virtual methods */
 size_t EmptyUARTDriver::write(uint8_t c) { return 0; }
+size_t EmptyUARTDriver::write(const uint8_t *buffer, size_t size) { return 0; }
 
@@ -32,6 +32,7 @@ public:
 
     /* Empty implementations of Print virtual methods */
     size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
 };
 
 #endif // __AP_HAL_EMPTY_UARTDRIVER_H__
@@ -156,4 +156,13 @@ size_t SMACCMUARTDriver::write(uint8_t c)
   return usart_write_timeout(m_dev, delay, &c, 1);
 }
 
+size_t SMACCMUARTDriver::write(const uint8_t *buffer, size_t size)
+{
+  if (m_dev == NULL)
+    return size;
+
+  portTickType delay = m_blocking ? portMAX_DELAY : 0;
+  return usart_write_timeout(m_dev, delay, buffer, size);
+}
+
 #endif // CONFIG_HAL_BOARD == HAL_BOARD_SMACCM
@@ -39,6 +39,7 @@ public:
 
   /* SMACCM implementations of Print virtual methods */
   size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
 
 private:
   struct usart *m_dev;
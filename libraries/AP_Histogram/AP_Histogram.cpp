@@ -0,0 +1,95 @@
+// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+/// @file	AP_Histogram.cpp
+/// @brief	log scale histogram of timings in microseconds
+
+#include <AP_Histogram.h>
+#include <string.h>
+
+// reset - clears all samples
+void AP_Histogram::reset(void)
+{
+    memset(_bins, 0, sizeof(_bins));
+    _count = 0;
+    _min = 0xFFFFFFFF;
+    _max = 0;
+}
+
+/*
+  the bin for a time. 0 and 1 have their own bins, then each power of
+  two is split in half by the bit below its top bit
+ */
+uint8_t AP_Histogram::_bin(uint32_t usec)
+{
+    if (usec < 2) {
+        return usec;
+    }
+    uint8_t e = 0;
+    while ((usec >> e) > 1) {
+        e++;
+    }
+    uint8_t bin = 2*e + ((usec >> (e-1)) & 1);
+    if (bin >= AP_HISTOGRAM_BINS) {
+        bin = AP_HISTOGRAM_BINS-1;
+    }
+    return bin;
+}
+
+/*
+  the largest time that goes in a bin
+ */
+uint32_t AP_Histogram::_bin_top(uint8_t bin)
+{
+    if (bin < 2) {
+        return bin;
+    }
+    uint8_t e = bin / 2;
+    uint32_t bottom = (1UL << e) | ((uint32_t)(bin & 1) << (e-1));
+    return bottom + (1UL << (e-1)) - 1;
+}
+
+// add - adds a sample
+void AP_Histogram::add(uint32_t usec)
+{
+    uint8_t bin = _bin(usec);
+    if (_bins[bin] != 0xFFFF) {
+        _bins[bin]++;
+    }
+    _count++;
+    if (usec < _min) {
+        _min = usec;
+    }
+    if (usec > _max) {
+        _max = usec;
+    }
+}
+
+// percentile - the time that the given percentage of samples are at
+// or below
+uint32_t AP_Histogram::percentile(uint8_t percent) const
+{
+    if (_count == 0) {
+        return 0;
+    }
+    // the number of samples at or below the percentile, at least one
+    uint32_t wanted = (_count * percent + 99) / 100;
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    uint32_t total = 0;
+    for (uint8_t i=0; i<AP_HISTOGRAM_BINS; i++) {
+        total += _bins[i];
+        if (total >= wanted) {
+            // the bin can't hold anything outside the samples seen
+            uint32_t top = _bin_top(i);
+            if (top > _max) {
+                top = _max;
+            }
+            if (top < _min) {
+                top = _min;
+            }
+            return top;
+        }
+    }
+    return _max;
+}
@@ -0,0 +1,49 @@
+// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+/// @file	AP_Histogram.h
+/// @brief	log scale histogram of timings in microseconds
+
+#ifndef __AP_HISTOGRAM_H__
+#define __AP_HISTOGRAM_H__
+
+#include <stdint.h>
+
+// two bins per power of two, up to 2^17 microseconds. Longer times
+// go in the last bin, but are still seen by max_usec()
+#define AP_HISTOGRAM_BINS 34
+
+/// @class      AP_Histogram
+/// the bins are 25% wide or less, so percentiles are to within 25%
+class AP_Histogram {
+public:
+    AP_Histogram() { reset(); }
+
+    // reset - clears all samples
+    void reset(void);
+
+    // add - adds a sample
+    void add(uint32_t usec);
+
+    // count - number of samples since the last reset
+    uint32_t count(void) const { return _count; }
+
+    // min_usec, max_usec - smallest and largest sample, or zero with
+    // no samples
+    uint32_t min_usec(void) const { return _count?_min:0; }
+    uint32_t max_usec(void) const { return _max; }
+
+    // percentile - the time that the given percentage of samples
+    // are at or below, rounded up to the top of its bin
+    uint32_t percentile(uint8_t percent) const;
+
+private:
+    static uint8_t  _bin(uint32_t usec);
+    static uint32_t _bin_top(uint8_t bin);
+
+    uint16_t _bins[AP_HISTOGRAM_BINS];
+    uint32_t _count;
+    uint32_t _min;
+    uint32_t _max;
+};
+
+#endif  // __AP_HISTOGRAM_H__
@@ -23,6 +23,13 @@ const AP_Param::GroupInfo AP_Scheduler::var_info[] PROGMEM = {
     // @Values: 0:Disabled,1:ShowSlipe,2:ShowOverruns
     // @User: Advanced
     AP_GROUPINFO("DEBUG",    0, AP_Scheduler, _debug, 0),
+
+    // @Param: MODE
+    // @DisplayName: Scheduler mode
+    // @Description: How the scheduler picks the next task to run. Table order runs due tasks in the order of the task table, skipping any whose declared maximum time doesn't fit in what is left of the loop. Earliest deadline runs the highest priority then most overdue task first, using the measured cost of each task, and keeps running other tasks after an overrun
+    // @Values: 0:TableOrder,1:EarliestDeadline
+    // @User: Advanced
+    AP_GROUPINFO("MODE",     1, AP_Scheduler, _mode, AP_SCHEDULER_MODE_TABLE),
     AP_GROUPEND
 };
 
@@ -33,65 +40,222 @@ void AP_Scheduler::init(const AP_Scheduler::Task *tasks, uint8_t num_tasks)
     _num_tasks = num_tasks;
     _last_run = new uint16_t[_num_tasks];
     memset(_last_run, 0, sizeof(_last_run[0]) * _num_tasks);
+    _stats = new TaskStats[_num_tasks];
+    _cost = new uint16_t[_num_tasks];
+    for (uint8_t i=0; i<_num_tasks; i++) {
+        _cost[i] = pgm_read_word(&_tasks[i].max_time_micros);
+    }
+    reset_stats();
     _tick_counter = 0;
 }
 
+// clear the timing statistics
+void AP_Scheduler::reset_stats(void)
+{
+    memset(_stats, 0, sizeof(_stats[0]) * _num_tasks);
+    for (uint8_t i=0; i<_num_tasks; i++) {
+        _stats[i].min_micros = 0xFFFF;
+    }
+}
+
+// counters stop at their maximum rather than wrapping
+static void saturating_inc(uint16_t &v)
+{
+    if (v != 0xFFFF) {
+        v++;
+    }
+}
+
+/*
+  record one run of task i in its statistics
+ */
+void AP_Scheduler::_update_stats(uint8_t i, uint32_t time_taken)
+{
+    struct TaskStats &s = _stats[i];
+    uint16_t t = time_taken > 0xFFFF ? 0xFFFF : time_taken;
+
+    s.runs++;
+    s.total_micros += time_taken;
+    if (t < s.min_micros) {
+        s.min_micros = t;
+    }
+    if (t > s.max_micros) {
+        s.max_micros = t;
+    }
+
+    // find the histogram bin by doubling the bin limit from 1/8
+    // of the time allowed
+    uint32_t limit = _task_time_allowed >> 3;
+    uint8_t bin = 0;
+    while (bin < AP_SCHEDULER_HIST_BINS-1 && time_taken >= limit) {
+        limit <<= 1;
+        bin++;
+    }
+    saturating_inc(s.hist[bin]);
+}
+
 // one tick has passed
 void AP_Scheduler::tick(void)
 {
     _tick_counter++;
 }
 
+/*
+  run task i, which is dt ticks since it last ran, and return the
+  number of microseconds it took
+ */
+uint32_t AP_Scheduler::_run_task(uint8_t i, uint16_t dt)
+{
+    uint16_t interval_ticks = pgm_read_word(&_tasks[i].interval_ticks);
+    _task_time_allowed = pgm_read_word(&_tasks[i].max_time_micros);
+
+    if (dt >= interval_ticks*2) {
+        // we've slipped a whole run of this task!
+        saturating_inc(_stats[i].slips);
+        if (_debug != 0) {
+            hal.console->printf_P(PSTR("Scheduler slip task[%u] (%u/%u/%u)\n"), 
+                                  (unsigned)i, 
+                                  (unsigned)dt,
+                                  (unsigned)interval_ticks,
+                                  (unsigned)_task_time_allowed);
+        }
+    }
+
+    _task_time_started = hal.scheduler->micros();
+    task_fn_t func = (task_fn_t)pgm_read_pointer(&_tasks[i].function);
+    func();
+
+    // record the tick counter when we ran. This drives
+    // when we next run the event
+    _last_run[i] = _tick_counter;
+
+    // work out how long the event actually took
+    uint32_t time_taken = hal.scheduler->micros() - _task_time_started;
+    _update_stats(i, time_taken);
+
+    // the cost estimate jumps up to a long run and decays slowly
+    // back down after it
+    if (time_taken >= _cost[i]) {
+        _cost[i] = time_taken > 0xFFFF ? 0xFFFF : time_taken;
+    } else {
+        _cost[i] -= (_cost[i] - time_taken) >> 3;
+    }
+
+    if (time_taken > _task_time_allowed) {
+        // the event overran!
+        saturating_inc(_stats[i].overruns);
+        if (_debug > 1) {
+            hal.console->printf_P(PSTR("Scheduler overrun task[%u] (%u/%u)\n"), 
+                                  (unsigned)i, 
+                                  (unsigned)time_taken,
+                                  (unsigned)_task_time_allowed);
+        }
+    }
+    return time_taken;
+}
+
 /*
   run one tick
   this will run as many scheduler tasks as we can in the specified time
  */
 void AP_Scheduler::run(uint16_t time_available)
 {
+    if (_mode == AP_SCHEDULER_MODE_DEADLINE) {
+        _run_deadline(time_available);
+        return;
+    }
     for (uint8_t i=0; i<_num_tasks; i++) {
         uint16_t dt = _tick_counter - _last_run[i];
         uint16_t interval_ticks = pgm_read_word(&_tasks[i].interval_ticks);
         if (dt >= interval_ticks) {
             // this task is due to run. Do we have enough time to run it?
-            _task_time_allowed = pgm_read_word(&_tasks[i].max_time_micros);
-
-            if (dt >= interval_ticks*2) {
-                // we've slipped a whole run of this task!
-                if (_debug != 0) {
-                    hal.console->printf_P(PSTR("Scheduler slip task[%u] (%u/%u/%u)\n"), 
-                                          (unsigned)i, 
-                                          (unsigned)dt,
-                                          (unsigned)interval_ticks,
-                                          (unsigned)_task_time_allowed);
-                }
-            }
-            if (_task_time_allowed <= time_available) {
-                // run it
-                _task_time_started = hal.scheduler->micros();
-                task_fn_t func = (task_fn_t)pgm_read_pointer(&_tasks[i].function);
-                func();
-                
-                // record the tick counter when we ran. This drives
-                // when we next run the event
-                _last_run[i] = _tick_counter;
-                
-                // work out how long the event actually took
-                uint32_t time_taken = hal.scheduler->micros() - _task_time_started;
-                
+            if (pgm_read_word(&_tasks[i].max_time_micros) <= time_available) {
+                uint32_t time_taken = _run_task(i, dt);
                 if (time_taken > _task_time_allowed) {
-                    // the event overran!
-                    if (_debug > 1) {
-                        hal.console->printf_P(PSTR("Scheduler overrun task[%u] (%u/%u)\n"), 
-                                              (unsigned)i, 
-                                              (unsigned)time_taken,
-                                              (unsigned)_task_time_allowed);
-                    }
-                    return;
+                    // the rest of this tick is used up. Carry on
+                    // through the list so that the tasks which
+                    // would have run are counted as skipped
+                    time_available = 0;
+                } else {
+                    time_available -= time_taken;
                 }
-                time_available -= time_taken;
+            } else {
+                // not enough time left in this tick
+                saturating_inc(_stats[i].skips);
+            }
+        }
+    }
+}
+
+/*
+  run tasks in deadline order. Of the due tasks whose measured cost
+  fits in the time left, the one with the highest priority runs
+  first, then the one furthest past its deadline. An overrun only
+  uses up the time it took, so other tasks can still run after it
+ */
+void AP_Scheduler::_run_deadline(uint16_t time_available)
+{
+    uint32_t run_started = hal.scheduler->micros();
+
+    for (;;) {
+        uint32_t elapsed = hal.scheduler->micros() - run_started;
+        uint16_t time_left = elapsed < time_available ? time_available - elapsed : 0;
+        int16_t best = -1;
+        uint8_t best_priority = 0;
+        uint16_t best_late = 0;
+        uint16_t best_dt = 0;
+
+        for (uint8_t i=0; i<_num_tasks; i++) {
+            uint16_t dt = _tick_counter - _last_run[i];
+            uint16_t interval_ticks = pgm_read_word(&_tasks[i].interval_ticks);
+            if (dt < interval_ticks || _cost[i] > time_left) {
+                continue;
             }
+            uint8_t priority = pgm_read_byte(&_tasks[i].priority);
+            uint16_t late = dt - interval_ticks;
+            if (best == -1 ||
+                priority > best_priority ||
+                (priority == best_priority && late > best_late)) {
+                best = i;
+                best_priority = priority;
+                best_late = late;
+                best_dt = dt;
+            }
+        }
+        if (best == -1) {
+            break;
         }
+        _run_task(best, best_dt);
+    }
+
+    // anything still due didn't fit in the time we had. Decay its
+    // cost estimate so that one long run can't starve a task
+    for (uint8_t i=0; i<_num_tasks; i++) {
+        uint16_t dt = _tick_counter - _last_run[i];
+        if (dt >= pgm_read_word(&_tasks[i].interval_ticks)) {
+            saturating_inc(_stats[i].skips);
+            _cost[i] -= _cost[i] >> 3;
+        }
+    }
+}
+
+/*
+  return the max_time_micros of a task
+ */
+uint16_t AP_Scheduler::task_max_time(uint8_t i) const
+{
+    return pgm_read_word(&_tasks[i].max_time_micros);
+}
+
+/*
+  return the mean runtime of a task
+ */
+uint16_t AP_Scheduler::task_mean_micros(uint8_t i) const
+{
+    if (_stats[i].runs == 0) {
+        return 0;
     }
+    return _stats[i].total_micros / _stats[i].runs;
 }
 
 /*
@@ -23,8 +23,26 @@
 
   To run tasks use scheduler.run(), passing the amount of time that
   the scheduler is allowed to use before it must return
+
+  With SCHED_MODE set to earliest deadline the due task with the
+  highest priority, and then the one furthest past its deadline, runs
+  first, and the time check uses the measured cost of each task
+  rather than its declared max_time_micros
+
+  The scheduler keeps timing statistics for each task, which can be
+  read with task_stats() and cleared with reset_stats()
  */
 
+// number of bins in the task runtime histogram. Bin 0 counts runs
+// shorter than 1/8 of max_time_micros, and each bin after that covers
+// twice the time of the one before, so bins 0 to 3 are runs within
+// the budget and bins 4 and 5 are overruns of up to 2x and beyond
+#define AP_SCHEDULER_HIST_BINS 6
+
+// values for SCHED_MODE
+#define AP_SCHEDULER_MODE_TABLE    0
+#define AP_SCHEDULER_MODE_DEADLINE 1
+
 class AP_Scheduler
 {
 public:
@@ -34,6 +52,19 @@ public:
 		task_fn_t function;
 		uint16_t interval_ticks;
 		uint16_t max_time_micros;
+		uint8_t priority;       // higher runs first in deadline mode
+	};
+
+	// timing statistics for one task since the last reset
+	struct TaskStats {
+		uint32_t runs;          // number of times the task ran
+		uint16_t skips;         // due but not enough time left in the tick
+		uint16_t slips;         // missed a whole interval
+		uint16_t overruns;      // took longer than max_time_micros
+		uint16_t min_micros;
+		uint16_t max_micros;
+		uint32_t total_micros;
+		uint16_t hist[AP_SCHEDULER_HIST_BINS];
 	};
 
 	// initialise scheduler
@@ -53,11 +84,29 @@ public:
     // return debug parameter
     uint8_t debug(void) { return _debug; }
 
+	// number of tasks in the task list
+	uint8_t num_tasks(void) const { return _num_tasks; }
+
+	// timing statistics for a task
+	const struct TaskStats &task_stats(uint8_t i) const { return _stats[i]; }
+
+	// the max_time_micros of a task, which the histogram is scaled by
+	uint16_t task_max_time(uint8_t i) const;
+
+	// mean runtime of a task in microseconds
+	uint16_t task_mean_micros(uint8_t i) const;
+
+	// clear the timing statistics of all tasks
+	void reset_stats(void);
+
 	static const struct AP_Param::GroupInfo var_info[];
 
 private:
 	// used to enable scheduler debugging
 	AP_Int8 _debug;
+
+	// one of AP_SCHEDULER_MODE_*
+	AP_Int8 _mode;
 	
 	// progmem list of tasks to run
 	const struct Task *_tasks;
@@ -72,6 +121,22 @@ private:
 	// tick counter at the time we last ran each task
 	uint16_t *_last_run;
 
+	// timing statistics for each task
+	struct TaskStats *_stats;
+
+	// measured cost of each task in microseconds, used in deadline
+	// mode
+	uint16_t *_cost;
+
+	// record one run of a task in its statistics
+	void _update_stats(uint8_t i, uint32_t time_taken);
+
+	// run one task, returning the time it took
+	uint32_t _run_task(uint8_t i, uint16_t dt);
+
+	// run() for deadline mode
+	void _run_deadline(uint16_t time_available);
+
 	// number of microseconds allowed for the current task
 	uint16_t _task_time_allowed;
 
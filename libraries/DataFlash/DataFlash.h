@@ -12,10 +12,28 @@
 #include <AP_InertialSensor.h>
 #include <AP_AHRS.h>
 #include <stdint.h>
+#include "LogStructure.h"
+
+/*
+  state of a message type that is being logged as deltas: the last
+  packet written, the number written since the last full packet, and
+  the log they were written to
+ */
+template <typename T>
+struct DataFlash_Delta {
+    T prev;
+    uint8_t count;
+    uint8_t epoch;
+};
+
+struct log_GPS;
+struct log_IMU;
 
 class DataFlash_Class
 {
 public:
+    DataFlash_Class();
+
     // initialisation
     virtual void Init(void) = 0;
     virtual bool CardInserted(void) = 0;
@@ -41,16 +59,92 @@ public:
     virtual void ShowDeviceInfo(AP_HAL::BetterStream *port) = 0;
     virtual void ListAvailableLogs(AP_HAL::BetterStream *port) = 0;
 
+    // write buffer statistics since the last reset_buffer_stats(),
+    // for the backends that buffer writes
+    virtual uint32_t dropped_bytes(void) { return 0; }
+    virtual uint8_t max_buffer_fill_pct(void) { return 0; }
+    virtual void reset_buffer_stats(void) {}
+
+    // bytes that can be written without being dropped. Backends
+    // that write straight to the device have no limit
+    virtual uint32_t buffer_space(void) { return 0xFFFFFFFF; }
+
+    /*
+      log download. Some backends can't read while they are writing
+      a log, so prepare_download() stops logging on those until the
+      next StartNewLog(). get_log_data() returns the number of bytes
+      read, which is short at the end of the log, or -1 on error.
+      end_download() is called when a download finishes or is
+      abandoned
+     */
+    virtual void prepare_download(void) {}
+    virtual void end_download(void) {}
+    virtual bool logging_started(void) = 0;
+    virtual uint32_t get_log_size(uint16_t log_num) = 0;
+    virtual int16_t get_log_data(uint16_t log_num, uint32_t offset, uint16_t len, uint8_t *data) = 0;
+
+    /*
+      seeking in a log with an index. find_msg() gives the offset of
+      the first packet of msg_type, or of any type if msg_type is 0,
+      from the start of the index bucket holding gps_time_ms, a GPS
+      time of week (0 for the start of the log). It returns -1 if
+      there isn't one or the backend has no index, and -2 while the
+      index is being built, with each call building some more of it
+     */
+    virtual int32_t find_msg(uint16_t /* log_num */, uint8_t /* msg_type */,
+                             uint32_t /* gps_time_ms */) { return -1; }
+
+    // print a log from find_msg() on, only printing msg_type if it
+    // isn't 0. Returns false if the backend can't seek
+    virtual bool LogReadSeek(uint16_t /* log_num */, uint8_t /* msg_type */,
+                             uint32_t /* gps_time_ms */, uint8_t /* num_types */,
+                             const struct LogStructure * /* structure */,
+                             void (* /* print_mode */)(AP_HAL::BetterStream *port, uint8_t mode),
+                             AP_HAL::BetterStream * /* port */) { return false; }
+
     /* logging methods common to all vehicles */
     uint16_t StartNewLog(uint8_t num_types,
                          const struct LogStructure *structure);
     void Log_Write_Format(const struct LogStructure *structure);
     void Log_Write_Parameter(const char *name, float value);
-    void Log_Write_GPS(const GPS *gps, int32_t relative_alt);
-    void Log_Write_IMU(const AP_InertialSensor *ins);
+    void Log_Write_GPS(const GPS *gps, int32_t relative_alt,
+                       DataFlash_Delta<struct log_GPS> *delta = NULL,
+                       bool use_delta = true);
+    void Log_Write_IMU(const AP_InertialSensor *ins,
+                       DataFlash_Delta<struct log_IMU> *delta = NULL,
+                       bool use_delta = true);
     void Log_Write_Message(const char *message);
     void Log_Write_Message_P(const prog_char_t *message);
 
+    /*
+      write a packet as zig-zag varint deltas against the last packet
+      of its type, with a full packet every LOG_DELTA_KEYFRAME
+      packets. The packet's type needs a LOG_DELTA() entry in the
+      structures given to StartNewLog().
+
+      Readers take every full packet of a type as the new base, so
+      when use_delta is false the packet is written in full and the
+      next delta write starts with a full packet. Types that can be
+      delta encoded should always be written through here
+     */
+    template <typename T>
+    void WriteDelta(DataFlash_Delta<T> &delta, const T &pkt, bool use_delta = true) {
+        WriteDeltaBlock(&delta.prev, delta.count, delta.epoch, &pkt, sizeof(pkt), use_delta);
+    }
+    void WriteDeltaBlock(void *prev, uint8_t &count, uint8_t &epoch,
+                         const void *pkt, uint8_t size, bool use_delta = true);
+
+    // delta encode a packet body against the previous one. Returns
+    // the encoded length, or 0 if it won't fit in out_size
+    static uint8_t delta_encode(const prog_char *format,
+                                const uint8_t *prev, const uint8_t *body, uint8_t len,
+                                uint8_t *out, uint8_t out_size);
+
+    // length of the delta encoded body at data, or -1 if it runs
+    // past avail
+    static int16_t delta_length(const prog_char *format, uint8_t len,
+                                const uint8_t *data, uint16_t avail);
+
 	/*
       every logged packet starts with 3 bytes
     */
@@ -67,6 +161,20 @@ protected:
                           const struct LogStructure *structure,
                           void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
                           AP_HAL::BetterStream *port);
+    void _print_log_packet(const struct LogStructure *structure,
+                           const uint8_t *pkt,
+                           void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
+                           AP_HAL::BetterStream *port);
+
+    /*
+      delta decoding while reading a log. The last packet of each
+      delta encoded type is kept to apply the deltas to
+     */
+    bool _read_delta(uint8_t base_type, const struct LogStructure *base, uint8_t *pkt);
+    void _delta_keyframe(uint8_t msg_type, const uint8_t *pkt, uint8_t len);
+    void _delta_read_reset(void);
+    void _write_delta_format(const struct LogStructure *s);
+    uint32_t _read_varint(void);
     
     void Log_Write_Parameter(const AP_Param *ap, const AP_Param::ParamToken &token, 
                              enum ap_var_type type);
@@ -78,61 +186,24 @@ protected:
     */
     virtual void ReadBlock(void *pkt, uint16_t size) = 0;
 
-};
-
-/*
-  unfortunately these need to be macros because of a limitation of
-  named member structure initialisation in g++
- */
-#define LOG_PACKET_HEADER	       uint8_t head1, head2, msgid;
-#define LOG_PACKET_HEADER_INIT(id) head1 : HEAD_BYTE1, head2 : HEAD_BYTE2, msgid : id
-
-// once the logging code is all converted we will remove these from
-// this header
-#define HEAD_BYTE1  0xA3    // Decimal 163
-#define HEAD_BYTE2  0x95    // Decimal 149
+private:
+    // the structures of the current log, for WriteDeltaBlock()
+    uint8_t _num_types;
+    const struct LogStructure *_structures;
+    uint8_t _delta_epoch;
 
-/*
-Format characters in the format string for binary log messages
-  b   : int8_t
-  B   : uint8_t
-  h   : int16_t
-  H   : uint16_t
-  i   : int32_t
-  I   : uint32_t
-  f   : float
-  n   : char[4]
-  N   : char[16]
-  Z   : char[64]
-  c   : int16_t * 100
-  C   : uint16_t * 100
-  e   : int32_t * 100
-  E   : uint32_t * 100
-  L   : int32_t latitude/longitude
-  M   : uint8_t flight mode
- */
+    struct {
+        uint8_t msg_type;
+        uint8_t *body;
+    } _delta_read[LOG_DELTA_MAX_STREAMS];
 
-// structure used to define logging format
-struct LogStructure {
-    uint8_t msg_type;
-    uint8_t msg_len;
-    const char name[5];
-    const char format[16];
-    const char labels[64];
+    // delta types whose format is already in the current log
+    uint8_t _delta_format[LOG_DELTA_MAX_STREAMS];
 };
 
 /*
   log structures common to all vehicle types
  */
-struct PACKED log_Format {
-    LOG_PACKET_HEADER;
-    uint8_t type;
-    uint8_t length;
-    char name[4];
-    char format[16];
-    char labels[64];
-};
-
 struct PACKED log_Parameter {
     LOG_PACKET_HEADER;
     char name[16];
@@ -164,6 +235,13 @@ struct PACKED log_IMU {
     float accel_x, accel_y, accel_z;
 };
 
+// a time mark or trigger event in a DataFlash_BlackBox flush
+struct PACKED log_BlackBox {
+    LOG_PACKET_HEADER;
+    uint8_t  event;
+    uint32_t time_ms;
+};
+
 #define LOG_COMMON_STRUCTURES \
     { LOG_FORMAT_MSG, sizeof(log_Format), \
       "FMT", "BBnNZ",      "Type,Length,Name,Format" },    \
@@ -174,16 +252,17 @@ struct PACKED log_IMU {
     { LOG_IMU_MSG, sizeof(log_IMU), \
       "IMU",  "ffffff",     "GyrX,GyrY,GyrZ,AccX,AccY,AccZ" }, \
     { LOG_MESSAGE_MSG, sizeof(log_Message), \
-      "MSG",  "Z",     "Message" }
+      "MSG",  "Z",     "Message" }, \
+    { LOG_BLACKBOX_MSG, sizeof(log_BlackBox), \
+      "BBOX", "BI",    "Event,TimeMS" }, \
+    { LOG_BLACKBOX_IMU_MSG, sizeof(log_IMU), \
+      "IMUB", "ffffff",     "GyrX,GyrY,GyrZ,AccX,AccY,AccZ" }, \
+    LOG_DELTA_STRUCTURE(LOG_GPS_MSG, "GPSD"), \
+    LOG_DELTA_STRUCTURE(LOG_IMU_MSG, "IMUD")
 
-// message types for common messages
-#define LOG_FORMAT_MSG	  128
-#define LOG_PARAMETER_MSG 129
-#define LOG_GPS_MSG		  130
-#define LOG_IMU_MSG		  131
-#define LOG_MESSAGE_MSG	  132
 
 #include "DataFlash_Block.h"
 #include "DataFlash_File.h"
+#include "DataFlash_BlackBox.h"
 
 #endif
@@ -0,0 +1,204 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+/*
+   DataFlash black box - a RAM ring buffer of log packets
+ */
+
+#include <AP_HAL.h>
+#include <stdlib.h>
+#include <string.h>
+#include "DataFlash.h"
+
+extern const AP_HAL::HAL& hal;
+
+DataFlash_BlackBox::DataFlash_BlackBox(DataFlash_Class &dataflash) :
+    _dataflash(dataflash),
+    _buf(NULL),
+    _size(0),
+    _head(0),
+    _flush_pos(0),
+    _flush_end_ms(0),
+    _lost_bytes(0),
+    _flushing(false),
+    _num_marks(0),
+    _next_mark(0),
+    _last_mark_ms(0)
+{}
+
+bool DataFlash_BlackBox::init(uint32_t size)
+{
+    if (_buf != NULL) {
+        return true;
+    }
+    _buf = (uint8_t *)malloc(size);
+    if (_buf == NULL) {
+        return false;
+    }
+    _size = size;
+    return true;
+}
+
+/*
+  copy bytes in at the head of the ring, overwriting the oldest data
+ */
+void DataFlash_BlackBox::_copy_in(const void *data, uint16_t size)
+{
+    uint32_t ofs = _head % _size;
+    uint32_t n = _size - ofs;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(&_buf[ofs], data, n);
+    if (n < size) {
+        memcpy(&_buf[0], n + (const uint8_t *)data, size - n);
+    }
+    _head += size;
+}
+
+/*
+  copy bytes out of the ring from a position
+ */
+void DataFlash_BlackBox::_copy_out(uint32_t pos, void *data, uint16_t size) const
+{
+    uint32_t ofs = pos % _size;
+    uint32_t n = _size - ofs;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(data, &_buf[ofs], n);
+    if (n < size) {
+        memcpy(n + (uint8_t *)data, &_buf[0], size - n);
+    }
+}
+
+/*
+  add a packet to the ring behind its length
+ */
+void DataFlash_BlackBox::WriteBlock(const void *pBuffer, uint16_t size)
+{
+    if (_buf == NULL || size > 255 || size + 1U > _size) {
+        return;
+    }
+    uint8_t len = size;
+    _copy_in(&len, 1);
+    _copy_in(pBuffer, size);
+}
+
+void DataFlash_BlackBox::Log_Write_IMU(const AP_InertialSensor *ins)
+{
+    Vector3f gyro = ins->get_gyro();
+    Vector3f accel = ins->get_accel();
+    struct log_IMU pkt = {
+        LOG_PACKET_HEADER_INIT(LOG_BLACKBOX_IMU_MSG),
+        gyro_x  : gyro.x,
+        gyro_y  : gyro.y,
+        gyro_z  : gyro.z,
+        accel_x : accel.x,
+        accel_y : accel.y,
+        accel_z : accel.z
+    };
+    WriteBlock(&pkt, sizeof(pkt));
+}
+
+void DataFlash_BlackBox::_write_event(uint8_t event, uint32_t time_ms)
+{
+    struct log_BlackBox pkt = {
+        LOG_PACKET_HEADER_INIT(LOG_BLACKBOX_MSG),
+        event   : event,
+        time_ms : time_ms
+    };
+    WriteBlock(&pkt, sizeof(pkt));
+}
+
+void DataFlash_BlackBox::trigger(uint8_t event, uint16_t pre_ms, uint16_t post_ms)
+{
+    if (_buf == NULL) {
+        return;
+    }
+    uint32_t now = hal.scheduler->millis();
+    if (!_flushing) {
+        // start from the oldest mark within pre_ms that is still in
+        // the buffer
+        _flush_pos = _head;
+        for (uint8_t i=0; i<_num_marks; i++) {
+            const struct mark &m = _marks[(_next_mark + DATAFLASH_BLACKBOX_NUM_MARKS - 1 - i) % DATAFLASH_BLACKBOX_NUM_MARKS];
+            if (now - m.time_ms > pre_ms || !_in_buffer(m.pos)) {
+                break;
+            }
+            _flush_pos = m.pos;
+        }
+        _flushing = true;
+    }
+    _flush_end_ms = now + post_ms;
+    _write_event(event, now);
+}
+
+/*
+  write whole packets from a flush to the log, up to
+  DATAFLASH_BLACKBOX_FLUSH_BYTES of them
+ */
+void DataFlash_BlackBox::_flush_some(void)
+{
+    if (!_in_buffer(_flush_pos)) {
+        // the buffer has wrapped past the flush. Carry on from the
+        // oldest mark left, as that is at the start of a packet
+        uint32_t pos = _head;
+        for (uint8_t i=0; i<_num_marks; i++) {
+            const struct mark &m = _marks[(_next_mark + DATAFLASH_BLACKBOX_NUM_MARKS - 1 - i) % DATAFLASH_BLACKBOX_NUM_MARKS];
+            if (!_in_buffer(m.pos)) {
+                break;
+            }
+            pos = m.pos;
+        }
+        _lost_bytes += pos - _flush_pos;
+        _flush_pos = pos;
+    }
+
+    // only use half of the space in the log's write buffer, leaving
+    // the rest for packets logged directly
+    uint32_t n = _dataflash.buffer_space() / 2;
+    if (n > DATAFLASH_BLACKBOX_FLUSH_BYTES) {
+        n = DATAFLASH_BLACKBOX_FLUSH_BYTES;
+    }
+    while (_flush_pos != _head) {
+        uint8_t len = _buf[_flush_pos % _size];
+        if (len > n) {
+            break;
+        }
+        uint32_t ofs = (_flush_pos + 1) % _size;
+        if (ofs + len <= _size) {
+            _dataflash.WriteBlock(&_buf[ofs], len);
+        } else {
+            // the packet wraps round the end of the ring
+            uint8_t pkt[len];
+            _copy_out(_flush_pos + 1, pkt, len);
+            _dataflash.WriteBlock(pkt, len);
+        }
+        _flush_pos += 1 + len;
+        n -= len;
+    }
+}
+
+void DataFlash_BlackBox::update(void)
+{
+    if (_buf == NULL) {
+        return;
+    }
+    uint32_t now = hal.scheduler->millis();
+    if (_num_marks == 0 || now - _last_mark_ms >= DATAFLASH_BLACKBOX_MARK_MS) {
+        _marks[_next_mark].time_ms = now;
+        _marks[_next_mark].pos = _head;
+        _next_mark = (_next_mark + 1) % DATAFLASH_BLACKBOX_NUM_MARKS;
+        if (_num_marks < DATAFLASH_BLACKBOX_NUM_MARKS) {
+            _num_marks++;
+        }
+        _last_mark_ms = now;
+        _write_event(0, now);
+    }
+    if (_flushing) {
+        _flush_some();
+        if (_flush_pos == _head && (int32_t)(now - _flush_end_ms) >= 0) {
+            _flushing = false;
+        }
+    }
+}
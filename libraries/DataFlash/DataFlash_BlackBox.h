@@ -0,0 +1,106 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+/*
+   DataFlash black box - a RAM ring buffer of log packets
+
+   High rate packets are written into a ring buffer in RAM instead of
+   to the log. Nothing reaches the log until trigger() is called, when
+   the last pre_ms of the buffer is written out, followed by
+   everything written to the buffer for the next post_ms. This gives
+   full rate data around events without the cost of logging it all
+   the time.
+
+   The buffer carries a BBOX packet every DATAFLASH_BLACKBOX_MARK_MS
+   with the time, as the packets written to the log during a flush
+   are interleaved with newer ones logged directly. The packet for the
+   trigger itself has the event code given to trigger(). For the same
+   reason the packets put in the buffer need message types of their
+   own, such as IMUB, so readers don't take them as newer than the
+   live packets or as the base for delta decoding.
+
+   Each packet is kept in the buffer behind a length byte, so a flush
+   only ever writes whole packets to the log
+ */
+
+#ifndef DataFlash_BlackBox_h
+#define DataFlash_BlackBox_h
+
+// how often a time mark is put in the buffer, and how many marks are
+// kept. The marks are where a flush starts from, so this also limits
+// how far back a flush can go
+#ifndef DATAFLASH_BLACKBOX_MARK_MS
+#define DATAFLASH_BLACKBOX_MARK_MS 250
+#endif
+#ifndef DATAFLASH_BLACKBOX_NUM_MARKS
+#define DATAFLASH_BLACKBOX_NUM_MARKS 128
+#endif
+
+// the most bytes written to the log on each call to update()
+#ifndef DATAFLASH_BLACKBOX_FLUSH_BYTES
+#define DATAFLASH_BLACKBOX_FLUSH_BYTES 1024
+#endif
+
+class DataFlash_BlackBox
+{
+public:
+    DataFlash_BlackBox(DataFlash_Class &dataflash);
+
+    // allocate the buffer. Returns false if there isn't enough memory
+    bool init(uint32_t size);
+
+    // true if init() has succeeded
+    bool enabled(void) const { return _buf != NULL; }
+
+    // true while the buffer is being written to the log
+    bool flushing(void) const { return _flushing; }
+
+    // add a packet of at most 255 bytes to the buffer
+    void WriteBlock(const void *pBuffer, uint16_t size);
+
+    // add an IMUB packet to the buffer
+    void Log_Write_IMU(const AP_InertialSensor *ins);
+
+    // write the last pre_ms of the buffer to the log, and keep
+    // writing until post_ms from now. A trigger during a flush
+    // extends it
+    void trigger(uint8_t event, uint16_t pre_ms, uint16_t post_ms);
+
+    // add time marks and write some of a flush to the log. Call this
+    // every loop
+    void update(void);
+
+    // bytes lost from flushes because the buffer overran the
+    // write out
+    uint32_t lost_bytes(void) const { return _lost_bytes; }
+
+private:
+    DataFlash_Class &_dataflash;
+
+    uint8_t *_buf;
+    uint32_t _size;
+
+    // positions are counts of all bytes ever written to the
+    // buffer, so a position is still in the buffer if it is within
+    // _size of _head
+    uint32_t _head;
+    uint32_t _flush_pos;
+    uint32_t _flush_end_ms;
+    uint32_t _lost_bytes;
+    bool _flushing;
+
+    struct mark {
+        uint32_t time_ms;
+        uint32_t pos;
+    } _marks[DATAFLASH_BLACKBOX_NUM_MARKS];
+    uint8_t _num_marks;
+    uint8_t _next_mark;
+    uint32_t _last_mark_ms;
+
+    bool _in_buffer(uint32_t pos) const { return _head - pos <= _size; }
+    void _copy_in(const void *data, uint16_t size);
+    void _copy_out(uint32_t pos, void *data, uint16_t size) const;
+    void _write_event(uint8_t event, uint32_t time_ms);
+    void _flush_some(void);
+};
+
+#endif // DataFlash_BlackBox_h
@@ -181,3 +181,80 @@ bool DataFlash_Block::NeedErase(void)
     StartRead(1);
     return version != DF_LOGGING_FORMAT;
 }
+
+/*
+  log download. Reads use the page buffers and the file number that
+  writes use, so logging stops until the next log is started
+ */
+void DataFlash_Block::prepare_download(void)
+{
+    if (log_write_started) {
+        if (df_BufferIdx != 0) {
+            FinishWrite();
+        }
+        log_write_started = false;
+    }
+    df_Download_LogNum = 0;
+}
+
+uint32_t DataFlash_Block::get_log_size(uint16_t log_num)
+{
+    uint16_t num_logs = get_num_logs();
+    uint16_t last_log = find_last_log();
+    if (num_logs == 0 || log_num == 0 || log_num > last_log || last_log - log_num >= num_logs) {
+        return 0;
+    }
+    uint16_t start_page, end_page;
+    get_log_boundaries(log_num, start_page, end_page);
+    df_Download_LogNum = log_num;
+    df_Download_StartPage = start_page;
+    if (end_page >= start_page) {
+        df_Download_NumPages = end_page - start_page + 1;
+    } else {
+        df_Download_NumPages = df_NumPages - start_page + 1 + end_page;
+    }
+    return (uint32_t)df_Download_NumPages * (df_PageSize - sizeof(struct PageHeader));
+}
+
+int16_t DataFlash_Block::get_log_data(uint16_t log_num, uint32_t offset, uint16_t len, uint8_t *data)
+{
+    if (log_write_started) {
+        return -1;
+    }
+    if (log_num != df_Download_LogNum && get_log_size(log_num) == 0) {
+        return -1;
+    }
+    const uint16_t data_size = df_PageSize - sizeof(struct PageHeader);
+    int16_t ret = 0;
+    while (len > 0) {
+        uint32_t page_num = offset / data_size;
+        if (page_num >= df_Download_NumPages) {
+            break;
+        }
+        uint16_t page = df_Download_StartPage + page_num;
+        if (page > df_NumPages) {
+            page -= df_NumPages;
+        }
+        uint16_t ofs = offset % data_size;
+        uint16_t n = data_size - ofs;
+        if (n > len) {
+            n = len;
+        }
+
+        WaitReady();
+        PageToBuffer(df_Read_BufferNum, page);
+        struct PageHeader ph;
+        BlockRead(df_Read_BufferNum, 0, &ph, sizeof(ph));
+        if (ph.FileNumber != log_num) {
+            // the log has been overwritten
+            return -1;
+        }
+        BlockRead(df_Read_BufferNum, sizeof(ph) + ofs, data, n);
+
+        offset += n;
+        data += n;
+        len -= n;
+        ret += n;
+    }
+    return ret;
+}
@@ -38,6 +38,12 @@ public:
     void ShowDeviceInfo(AP_HAL::BetterStream *port);
     void ListAvailableLogs(AP_HAL::BetterStream *port);
 
+    // log download
+    void prepare_download(void);
+    bool logging_started(void) { return log_write_started; }
+    uint32_t get_log_size(uint16_t log_num);
+    int16_t get_log_data(uint16_t log_num, uint32_t offset, uint16_t len, uint8_t *data);
+
 private:
     struct PageHeader {
         uint16_t FileNumber;
@@ -55,6 +61,11 @@ private:
     uint16_t df_FilePage;
     bool log_write_started;
 
+    // pages of the log being downloaded
+    uint16_t df_Download_LogNum;
+    uint16_t df_Download_StartPage;
+    uint16_t df_Download_NumPages;
+
     /*
       functions implemented by the board specific backends
      */
@@ -22,28 +22,82 @@
 #include <assert.h>
 #include <AP_Math.h>
 #include <stdio.h>
+#include <pthread.h>
+#if CONFIG_HAL_BOARD == HAL_BOARD_AVR_SITL
+#include <sys/mman.h>
+// NuttX can't map files, so PX4 reads logs through a buffer
+#define DATAFLASH_FILE_USE_MMAP 1
+#endif
 
 extern const AP_HAL::HAL& hal;
 
 #define MAX_LOG_FILES 500U
 #define DATAFLASH_PAGE_SIZE 1024UL
 
-int DataFlash_File::_write_fd = -1;
-volatile bool DataFlash_File::_initialised = false;
+// the writer thread runs below the PX4 IO thread, so a slow card
+// can't hold up the UARTs or storage
+#if CONFIG_HAL_BOARD == HAL_BOARD_PX4
+#define DATAFLASH_FILE_WRITER_PRIORITY 50
+#endif
 
-uint8_t *DataFlash_File::_writebuf = NULL;
-const uint16_t DataFlash_File::_writebuf_size = 4096;
-volatile uint16_t DataFlash_File::_writebuf_head = 0;
-volatile uint16_t DataFlash_File::_writebuf_tail = 0;
-uint32_t DataFlash_File::_last_write_time = 0;
+// largest single write(), and the longest data waits in the buffer
+// for a whole chunk to build up
+#define DATAFLASH_FILE_MAX_CHUNK 4096U
+#define DATAFLASH_FILE_MAX_DELAY_MS 1000U
+
+// size of the read window when logs aren't mapped
+#define DATAFLASH_FILE_READ_WINDOW 4096U
+
+// index file format, and the GPS time covered by each time bucket
+#define DATAFLASH_INDEX_MAGIC "DFIX"
+#define DATAFLASH_INDEX_VERSION 2
+#define DATAFLASH_INDEX_BUCKET_MS 10000UL
+#define DATAFLASH_INDEX_MAX_BUCKETS 0xFFFFU
+
+// bytes of log indexed by each find_msg() call while building an index
+#ifndef DATAFLASH_INDEX_STEP_BYTES
+#define DATAFLASH_INDEX_STEP_BYTES 16384UL
+#endif
 
 /*
   constructor
  */
-DataFlash_File::DataFlash_File(const char *log_directory) :
+DataFlash_File::DataFlash_File(const char *log_directory,
+                               uint32_t buffer_size,
+                               uint16_t sync_interval_ms) :
+    _write_fd(-1),
     _read_fd(-1),
-    _log_directory(log_directory)
-{}
+    _initialised(false),
+    _log_directory(log_directory),
+    _read_size(0),
+    _read_map(NULL),
+    _read_buf(NULL),
+    _read_buf_ofs(0),
+    _read_buf_len(0),
+    _download_fd(-1),
+    _download_log_num(0),
+    _index(NULL),
+    _writebuf(NULL),
+    _writebuf_size(buffer_size),
+    _writebuf_head(0),
+    _writebuf_tail(0),
+    _writer_started(false),
+    _write_offset(0),
+    _sync_offset(0),
+    _last_write_ms(0),
+    _last_sync_ms(0),
+    _sync_interval_ms(sync_interval_ms),
+    _dropped_bytes(0),
+    _max_fill(0)
+{
+    // write in chunks of a quarter of the buffer, so there is room
+    // for more while one is being written
+    _chunk_size = min(DATAFLASH_FILE_MAX_CHUNK, _writebuf_size / 4);
+    _chunk_size -= _chunk_size % 512;
+    if (_chunk_size < 512) {
+        _chunk_size = 512;
+    }
+}
 
 
 // initialisation
@@ -56,16 +110,34 @@ void DataFlash_File::Init(void)
         hal.console->printf("Failed to create log directory %s", _log_directory);
         return;
     }
-    if (_writebuf != NULL) {
-        free(_writebuf);
+    if (_writebuf == NULL) {
+        _writebuf = (uint8_t *)malloc(_writebuf_size);
     }
-    _writebuf = (uint8_t *)malloc(_writebuf_size);
     if (_writebuf == NULL) {
         return;
     }
     _writebuf_head = _writebuf_tail = 0;
     _initialised = true;
-    hal.scheduler->register_io_process(_io_timer);
+
+    if (!_writer_started) {
+        pthread_mutex_init(&_write_mutex, NULL);
+
+        pthread_attr_t thread_attr;
+        pthread_attr_init(&thread_attr);
+#if CONFIG_HAL_BOARD == HAL_BOARD_PX4
+        struct sched_param param;
+        pthread_attr_setstacksize(&thread_attr, 2048);
+        param.sched_priority = DATAFLASH_FILE_WRITER_PRIORITY;
+        (void)pthread_attr_setschedparam(&thread_attr, &param);
+        pthread_attr_setschedpolicy(&thread_attr, SCHED_FIFO);
+#endif
+        if (pthread_create(&_writer_ctx, &thread_attr, &DataFlash_File::_writer_thread, this) != 0) {
+            hal.console->printf("Failed to start log writer thread\n");
+            _initialised = false;
+            return;
+        }
+        _writer_started = true;
+    }
 }
 
 // return true for CardInserted() if we successfully initialised
@@ -93,6 +165,17 @@ char *DataFlash_File::_log_file_name(uint16_t log_num)
     return buf;
 }
 
+/*
+  construct an index file name given a log number.
+  Note: Caller must free.
+ */
+char *DataFlash_File::_index_file_name(uint16_t log_num)
+{
+    char *buf = NULL;
+    asprintf(&buf, "%s/%u.idx", _log_directory, (unsigned)log_num);
+    return buf;
+}
+
 /*
   return path name of the lastlog.txt marker file
   Note: Caller must free.
@@ -108,6 +191,7 @@ char *DataFlash_File::_lastlog_file_name(void)
 // remove all log files
 void DataFlash_File::EraseAll()
 {
+    _index_abort();
     uint16_t log_num;
     for (log_num=0; log_num<MAX_LOG_FILES; log_num++) {
         char *fname = _log_file_name(log_num);
@@ -116,6 +200,11 @@ void DataFlash_File::EraseAll()
         }
         unlink(fname);
         free(fname);
+        fname = _index_file_name(log_num);
+        if (fname != NULL) {
+            unlink(fname);
+            free(fname);
+        }
     }
     char *fname = _lastlog_file_name();
     if (fname != NULL) {
@@ -125,14 +214,26 @@ void DataFlash_File::EraseAll()
 }
 
 /*
-  buffer handling macros
+  bytes waiting in the write buffer
  */
-#define BUF_AVAILABLE(buf) ((buf##_head > (_tail=buf##_tail))? (buf##_size - buf##_head) + _tail: _tail - buf##_head)
-#define BUF_SPACE(buf) (((_head=buf##_head) > buf##_tail)?(_head - buf##_tail) - 1:((buf##_size - buf##_tail) + _head) - 1)
-#define BUF_EMPTY(buf) (buf##_head == buf##_tail)
-#define BUF_ADVANCETAIL(buf, n) buf##_tail = (buf##_tail + n) % buf##_size
-#define BUF_ADVANCEHEAD(buf, n) buf##_head = (buf##_head + n) % buf##_size
+uint32_t DataFlash_File::_buf_available(void) const
+{
+    uint32_t head = _writebuf_head;
+    uint32_t tail = _writebuf_tail;
+    if (tail >= head) {
+        return tail - head;
+    }
+    return _writebuf_size - head + tail;
+}
 
+/*
+  bytes that can be added to the write buffer. One byte is kept free
+  so that a full buffer can be told from an empty one
+ */
+uint32_t DataFlash_File::_buf_space(void) const
+{
+    return _writebuf_size - 1 - _buf_available();
+}
 
 /* Write a block of data at current offset */
 void DataFlash_File::WriteBlock(const void *pBuffer, uint16_t size)
@@ -140,35 +241,46 @@ void DataFlash_File::WriteBlock(const void *pBuffer, uint16_t size)
     if (_write_fd == -1 || !_initialised) {
         return;
     }
-    uint16_t _head;
-    uint16_t space = BUF_SPACE(_writebuf);
-    if (space < size) {
+    if (_buf_space() < size) {
         // discard the whole write, to keep the log consistent
+        _dropped_bytes += size;
         return;
     }
 
-    if (_writebuf_tail < _head) {
-        // perform as single memcpy
-        assert(_writebuf_tail+size <= _writebuf_size);
-        memcpy(&_writebuf[_writebuf_tail], pBuffer, size);
-        BUF_ADVANCETAIL(_writebuf, size);
-    } else {
-        // perform as two memcpy calls
-        uint16_t n = _writebuf_size - _writebuf_tail;
-        if (n > size) n = size;
-        assert(_writebuf_tail+n <= _writebuf_size);
-        memcpy(&_writebuf[_writebuf_tail], pBuffer, n);
-        BUF_ADVANCETAIL(_writebuf, n);
-        pBuffer = (const void *)(((const uint8_t *)pBuffer) + n);
-        n = size - n;
-        if (n > 0) {
-            assert(_writebuf_tail+n <= _writebuf_size);
-            memcpy(&_writebuf[_writebuf_tail], pBuffer, n);
-            BUF_ADVANCETAIL(_writebuf, n);
-        }
+    uint32_t tail = _writebuf_tail;
+    uint32_t n = _writebuf_size - tail;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(&_writebuf[tail], pBuffer, n);
+    if (n < size) {
+        // wrap around to the start of the buffer
+        memcpy(&_writebuf[0], ((const uint8_t *)pBuffer) + n, size - n);
+    }
+    // only move the tail once the data is in place, as the writer
+    // thread may be looking at it
+    _writebuf_tail = (tail + size) % _writebuf_size;
+
+    uint32_t fill = _buf_available();
+    if (fill > _max_fill) {
+        _max_fill = fill;
     }
 }
 
+/*
+  write buffer statistics
+ */
+uint8_t DataFlash_File::max_buffer_fill_pct(void)
+{
+    return (_max_fill * 100UL) / _writebuf_size;
+}
+
+void DataFlash_File::reset_buffer_stats(void)
+{
+    _dropped_bytes = 0;
+    _max_fill = 0;
+}
+
 /*
   read a packet. The header bytes have already been read.
 */
@@ -178,11 +290,146 @@ void DataFlash_File::ReadBlock(void *pkt, uint16_t size)
         return;
     }
 
-    memset(pkt, 0, size);
-    ::read(_read_fd, pkt, size);
+    const uint8_t *data = _read_get(_read_offset, size);
+    if (data == NULL) {
+        memset(pkt, 0, size);
+    } else {
+        memcpy(pkt, data, size);
+    }
     _read_offset += size;
 }
 
+/*
+  open a log for reading
+ */
+bool DataFlash_File::_read_open(uint16_t log_num)
+{
+    _read_close();
+    char *fname = _log_file_name(log_num);
+    if (fname == NULL) {
+        return false;
+    }
+    _read_fd = ::open(fname, O_RDONLY);
+    free(fname);
+    if (_read_fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(_read_fd, &st) != 0) {
+        _read_close();
+        return false;
+    }
+    _read_size = st.st_size;
+    _read_offset = 0;
+#if DATAFLASH_FILE_USE_MMAP
+    if (_read_size != 0) {
+        void *map = ::mmap(NULL, _read_size, PROT_READ, MAP_SHARED, _read_fd, 0);
+        if (map != MAP_FAILED) {
+            ::madvise(map, _read_size, MADV_SEQUENTIAL);
+            _read_map = (uint8_t *)map;
+            return true;
+        }
+    }
+#endif
+    _read_buf = (uint8_t *)malloc(DATAFLASH_FILE_READ_WINDOW);
+    _read_buf_ofs = _read_buf_len = 0;
+    if (_read_buf == NULL) {
+        _read_close();
+        return false;
+    }
+    return true;
+}
+
+void DataFlash_File::_read_close(void)
+{
+#if DATAFLASH_FILE_USE_MMAP
+    if (_read_map != NULL) {
+        ::munmap(_read_map, _read_size);
+    }
+#endif
+    _read_map = NULL;
+    if (_read_buf != NULL) {
+        free(_read_buf);
+        _read_buf = NULL;
+    }
+    if (_read_fd != -1) {
+        ::close(_read_fd);
+        _read_fd = -1;
+    }
+    _read_size = 0;
+}
+
+/*
+  return a pointer to len bytes at the given offset of the log being
+  read, or NULL if they are past the end of it. The pointer is only
+  good until the next call
+ */
+const uint8_t *DataFlash_File::_read_get(uint32_t ofs, uint16_t len)
+{
+    if (ofs + len > _read_size || len > DATAFLASH_FILE_READ_WINDOW) {
+        return NULL;
+    }
+    if (_read_map != NULL) {
+        return &_read_map[ofs];
+    }
+    if (_read_buf == NULL) {
+        return NULL;
+    }
+    if (ofs < _read_buf_ofs || ofs + len > _read_buf_ofs + _read_buf_len) {
+        // move the window to start at this offset
+        if (::lseek(_read_fd, ofs, SEEK_SET) != (off_t)ofs) {
+            return NULL;
+        }
+        ssize_t n = ::read(_read_fd, _read_buf, DATAFLASH_FILE_READ_WINDOW);
+        if (n < (ssize_t)len) {
+            _read_buf_len = 0;
+            return NULL;
+        }
+        _read_buf_ofs = ofs;
+        _read_buf_len = n;
+    }
+    return &_read_buf[ofs - _read_buf_ofs];
+}
+
+
+/*
+  close the log being downloaded. It is opened again by the next
+  get_log_data(), so each request sees the log as it is now
+ */
+void DataFlash_File::_download_close(void)
+{
+    if (_download_fd != -1) {
+        ::close(_download_fd);
+        _download_fd = -1;
+    }
+}
+
+/*
+  read part of a log for download
+ */
+int16_t DataFlash_File::get_log_data(uint16_t log_num, uint32_t offset, uint16_t len, uint8_t *data)
+{
+    if (_download_log_num != log_num) {
+        _download_close();
+    }
+    if (_download_fd == -1) {
+        char *fname = _log_file_name(log_num);
+        if (fname == NULL) {
+            return -1;
+        }
+        _download_fd = ::open(fname, O_RDONLY);
+        free(fname);
+        if (_download_fd == -1) {
+            return -1;
+        }
+        _download_log_num = log_num;
+    }
+    if (::lseek(_download_fd, offset, SEEK_SET) != (off_t)offset) {
+        return -1;
+    }
+    return ::read(_download_fd, data, len);
+}
+
 
 /*
   find the highest log number
@@ -256,11 +503,20 @@ uint16_t DataFlash_File::get_num_logs(void)
  */
 uint16_t DataFlash_File::start_new_log(void)
 {
+    pthread_mutex_lock(&_write_mutex);
     if (_write_fd != -1) {
-        int fd = _write_fd;
-        _write_fd = -1;
-        ::close(fd);
+        // finish off the old log before closing it
+        while (_write_some(true)) ;
+        // a failed write has already closed it
+        if (_write_fd != -1) {
+            ::fsync(_write_fd);
+            ::close(_write_fd);
+            _write_fd = -1;
+        }
     }
+    _writebuf_head = _writebuf_tail = 0;
+    _write_offset = _sync_offset = 0;
+    pthread_mutex_unlock(&_write_mutex);
 
     uint16_t log_num = find_last_log();
     // re-use empty logs if possible
@@ -270,9 +526,20 @@ uint16_t DataFlash_File::start_new_log(void)
     if (log_num > MAX_LOG_FILES) {
         log_num = 1;
     }
-    char *fname = _log_file_name(log_num);
-    _write_fd = ::open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    // any index of a log with this number is now out of date
+    if (_index != NULL && _index->log_num == log_num) {
+        _index_abort();
+    }
+    char *fname = _index_file_name(log_num);
+    if (fname != NULL) {
+        unlink(fname);
+        free(fname);
+    }
+    fname = _log_file_name(log_num);
+    int fd = ::open(fname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
     free(fname);
+    _last_write_ms = _last_sync_ms = hal.scheduler->millis();
+    _write_fd = fd;
     if (_write_fd == -1) {
         _initialised = false;
         return 0xFFFF;
@@ -288,6 +555,8 @@ uint16_t DataFlash_File::start_new_log(void)
     return log_num;
 }
 
+#define PGM_UINT8(addr) pgm_read_byte((const prog_char *)addr)
+
 /*
   Read the log and print it on port
 */
@@ -298,63 +567,484 @@ void DataFlash_File::LogReadProcess(uint16_t log_num,
                                     void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
                                     AP_HAL::BetterStream *port)
 {
-    uint8_t log_step = 0;
     if (!_initialised) {
         return;
     }
-    if (_read_fd != -1) {
-        ::close(_read_fd);
-    }
-    char *fname = _log_file_name(log_num);
-    if (fname == NULL) {
+    // the reader and an index being built share the read functions
+    _index_abort();
+    if (!_read_open(log_num)) {
         return;
     }
-    _read_fd = ::open(fname, O_RDONLY);
-    free(fname);
-    if (_read_fd == -1) {
-        return;
+    _read_packets(start_page * DATAFLASH_PAGE_SIZE, (end_page+1) * DATAFLASH_PAGE_SIZE, 0,
+                  num_types, structure, print_mode, port);
+    _read_close();
+}
+
+/*
+  print the log from find_msg() on. Packets of other types are still
+  read when only_type is given, as their delta packets need decoding
+  to find where they end
+ */
+bool DataFlash_File::LogReadSeek(uint16_t log_num, uint8_t msg_type, uint32_t gps_time_ms,
+                                 uint8_t num_types,
+                                 const struct LogStructure *structure,
+                                 void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
+                                 AP_HAL::BetterStream *port)
+{
+    if (!_initialised) {
+        return false;
     }
-    _read_offset = 0;
-    if (start_page != 0) {
-        ::lseek(_read_fd, start_page * DATAFLASH_PAGE_SIZE, SEEK_SET);
+    int32_t ofs;
+    while ((ofs = find_msg(log_num, msg_type, gps_time_ms)) == -2) ;
+    if (ofs < 0) {
+        port->printf_P(PSTR("No match\n"));
+        return true;
+    }
+    if (!_read_open(log_num)) {
+        return true;
     }
+    _read_packets(ofs, _read_size, msg_type, num_types, structure, print_mode, port);
+    _read_close();
+    return true;
+}
 
-    while (true) {
-        uint8_t data;
-        if (::read(_read_fd, &data, 1) != 1) {
+/*
+  print the packets of the open log from ofs to end_ofs, or only
+  those of only_type if it isn't 0
+ */
+void DataFlash_File::_read_packets(uint32_t ofs, uint32_t end_ofs, uint8_t only_type,
+                                   uint8_t num_types,
+                                   const struct LogStructure *structure,
+                                   void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
+                                   AP_HAL::BetterStream *port)
+{
+    // structure for each message type, to save searching for it in
+    // every packet
+    uint8_t type_index[256];
+    memset(type_index, 0xFF, sizeof(type_index));
+    for (uint8_t i=0; i<num_types; i++) {
+        type_index[PGM_UINT8(&structure[i].msg_type)] = i;
+    }
+
+    _delta_read_reset();
+    while (ofs < end_ofs) {
+        const uint8_t *hd = _read_get(ofs, 3);
+        if (hd == NULL) {
             // reached end of file
             break;
         }
-        _read_offset++;
-
-        // This is a state machine to read the packets
-        switch(log_step) {
-            case 0:
-                if (data == HEAD_BYTE1) {
-                    log_step++;
+        if (hd[0] != HEAD_BYTE1 || hd[1] != HEAD_BYTE2) {
+            ofs++;
+            continue;
+        }
+        uint8_t msg_type = hd[2];
+        ofs += 3;
+        uint8_t i = type_index[msg_type];
+        if (i == 0xFF) {
+            if (only_type == 0) {
+                port->printf_P(PSTR("UNKN, %u\n"), (unsigned)msg_type);
+            }
+            continue;
+        }
+        if (PGM_UINT8(&structure[i].format[0]) == '*') {
+            // a delta encoded packet, print it as the full message
+            uint8_t base_type = msg_type & ~LOG_DELTA_FLAG;
+            i = type_index[base_type];
+            if (i == 0xFF) {
+                if (only_type == 0) {
+                    port->printf_P(PSTR("UNKN, %u\n"), (unsigned)msg_type);
                 }
-                break;
+                continue;
+            }
+            uint8_t pkt[PGM_UINT8(&structure[i].msg_len) - 3];
+            _read_offset = ofs;
+            bool ok = _read_delta(base_type, &structure[i], pkt);
+            ofs = _read_offset;
+            if (ok && (only_type == 0 || only_type == base_type)) {
+                _print_log_packet(&structure[i], pkt, print_mode, port);
+            }
+            continue;
+        }
+        uint8_t msg_len = PGM_UINT8(&structure[i].msg_len) - 3;
+        const uint8_t *pkt = _read_get(ofs, msg_len);
+        if (pkt == NULL) {
+            break;
+        }
+        if (!(msg_type & LOG_DELTA_FLAG) && type_index[LOG_DELTA(msg_type)] != 0xFF) {
+            _delta_keyframe(msg_type, pkt, msg_len);
+        }
+        if (only_type == 0 || only_type == msg_type) {
+            _print_log_packet(&structure[i], pkt, print_mode, port);
+        }
+        ofs += msg_len;
+    }
+    _delta_read_reset();
+}
 
-            case 1:
-                if (data == HEAD_BYTE2) {
-                    log_step++;
-                } else {
-                    log_step = 0;
-                }
-                break;
+/*
+  find the offset in a packet of the GPS time field from the FMT
+  message for GPS. Returns 0 if there isn't a suitable field
+ */
+static uint8_t gps_time_offset(const struct log_Format *f)
+{
+    if (strncmp(f->name, "GPS", sizeof(f->name)) != 0) {
+        return 0;
+    }
+    const char *label = f->labels;
+    const char *labels_end = f->labels + sizeof(f->labels);
+    uint8_t ofs = 3;
+    for (uint8_t i=0; i<sizeof(f->format) && f->format[i] != 0; i++) {
+        uint8_t len = 0;
+        while (label+len < labels_end && label[len] != ',' && label[len] != 0) {
+            len++;
+        }
+        if (len == 4 && strncmp(label, "Time", 4) == 0) {
+            return f->format[i] == 'I' ? ofs : 0;
+        }
+        uint8_t size = log_format_size(f->format[i]);
+        if (size == 0 || label+len >= labels_end || label[len] == 0) {
+            return 0;
+        }
+        ofs += size;
+        label += len + 1;
+    }
+    return 0;
+}
 
-            case 2:
-                log_step = 0;
-                _print_log_entry(data, num_types, structure, print_mode, port);
+/*
+  start building the index file for a log. The message lengths and
+  formats come from the FMT messages in the log itself, so this
+  doesn't need the vehicle's structure table
+ */
+bool DataFlash_File::_index_start(uint16_t log_num)
+{
+    _index_abort();
+    if (!_read_open(log_num)) {
+        return false;
+    }
+    char *fname = _index_file_name(log_num);
+    if (fname == NULL) {
+        _read_close();
+        return false;
+    }
+    _index = (struct index_builder *)calloc(1, sizeof(struct index_builder));
+    if (_index == NULL) {
+        free(fname);
+        _read_close();
+        return false;
+    }
+    _index->log_num = log_num;
+    _index->fd = ::open(fname, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    free(fname);
+
+    // the header is written without its magic until the index is
+    // finished, so one that wasn't finished won't be used
+    _index->hdr.version = DATAFLASH_INDEX_VERSION;
+    _index->hdr.log_size = _read_size;
+    _index->hdr.bucket_ms = DATAFLASH_INDEX_BUCKET_MS;
+    _index->msg_len[LOG_FORMAT_MSG] = sizeof(struct log_Format);
+    _index->record_offset = sizeof(_index->hdr) + sizeof(_index->types);
+    if (_index->fd == -1 ||
+        ::write(_index->fd, &_index->hdr, sizeof(_index->hdr)) != sizeof(_index->hdr) ||
+        ::write(_index->fd, _index->types, sizeof(_index->types)) != sizeof(_index->types) ||
+        !_index_start_bucket(0)) {
+        _index_abort();
+        return false;
+    }
+    return true;
+}
+
+/*
+  write the record of the current bucket
+ */
+bool DataFlash_File::_index_end_bucket(void)
+{
+    struct index_builder &ix = *_index;
+    uint16_t num;
+    memcpy(&num, ix.record, sizeof(num));
+    uint16_t len = sizeof(num) + num*sizeof(struct index_entry);
+    if (::write(ix.fd, ix.record, len) != len) {
+        return false;
+    }
+    ix.buckets[ix.hdr.num_buckets-1].record_offset = ix.record_offset;
+    ix.record_offset += len;
+    return true;
+}
+
+/*
+  start a new bucket at log_offset
+ */
+bool DataFlash_File::_index_start_bucket(uint32_t log_offset)
+{
+    struct index_builder &ix = *_index;
+    if (ix.hdr.num_buckets == ix.max_buckets) {
+        uint16_t max_buckets = min((uint32_t)ix.max_buckets + 64, DATAFLASH_INDEX_MAX_BUCKETS);
+        if (max_buckets == ix.max_buckets) {
+            return false;
+        }
+        struct index_bucket *buckets = (struct index_bucket *)realloc(ix.buckets, max_buckets*sizeof(buckets[0]));
+        if (buckets == NULL) {
+            return false;
+        }
+        ix.buckets = buckets;
+        ix.max_buckets = max_buckets;
+    }
+    ix.buckets[ix.hdr.num_buckets].log_offset = log_offset;
+    ix.hdr.num_buckets++;
+    memset(ix.record, 0, sizeof(uint16_t));
+    memset(ix.seen, 0, sizeof(ix.seen));
+    return true;
+}
+
+/*
+  index some more of the log. Returns 1 when the index is finished,
+  0 if there is more to do and -1 if it failed
+ */
+int8_t DataFlash_File::_index_step(void)
+{
+    if (_index == NULL) {
+        return -1;
+    }
+    struct index_builder &ix = *_index;
+    uint32_t step_end = ix.ofs + DATAFLASH_INDEX_STEP_BYTES;
+    bool ok = true;
+    while (ok && ix.ofs < step_end) {
+        uint32_t ofs = ix.ofs;
+        const uint8_t *hd = _read_get(ofs, 3);
+        if (hd == NULL) {
+            break;
+        }
+        uint8_t msg_type = hd[2];
+        if (hd[0] != HEAD_BYTE1 || hd[1] != HEAD_BYTE2 || ix.msg_len[msg_type] == 0) {
+            ix.ofs++;
+            continue;
+        }
+        uint16_t len = ix.msg_len[msg_type];
+        if (ix.formats[msg_type][0] == '*') {
+            // the length of a delta packet depends on its contents
+            uint8_t base_type = msg_type & ~LOG_DELTA_FLAG;
+            if (ix.msg_len[base_type] < 3) {
+                ix.ofs++;
+                continue;
+            }
+            uint16_t avail = min(_read_size - (ofs+3), (uint32_t)DATAFLASH_FILE_READ_WINDOW/2);
+            const uint8_t *data = _read_get(ofs+3, avail);
+            int16_t dlen = data ? delta_length(ix.formats[base_type], ix.msg_len[base_type]-3, data, avail) : -1;
+            if (dlen < 0) {
                 break;
+            }
+            len = 3 + dlen;
         }
-        if (_read_offset >= (end_page+1) * DATAFLASH_PAGE_SIZE) {
+        const uint8_t *pkt = _read_get(ofs, len);
+        if (pkt == NULL) {
             break;
         }
+
+        if (msg_type == LOG_FORMAT_MSG) {
+            const struct log_Format *f = (const struct log_Format *)pkt;
+            if (f->length >= 3) {
+                ix.msg_len[f->type] = f->length;
+                memcpy(ix.formats[f->type], f->format, sizeof(ix.formats[0]));
+                ix.formats[f->type][sizeof(ix.formats[0])-1] = 0;
+            }
+            uint8_t time_ofs = gps_time_offset(f);
+            if (time_ofs != 0 && time_ofs + 4 <= f->length) {
+                ix.gps_type = f->type;
+                ix.gps_time_ofs = time_ofs;
+            }
+        } else if (msg_type == ix.gps_type && ix.gps_time_ofs != 0) {
+            uint32_t gps_time;
+            memcpy(&gps_time, &pkt[ix.gps_time_ofs], sizeof(gps_time));
+            if (gps_time != 0 && ix.hdr.first_gps_ms == 0) {
+                ix.hdr.first_gps_ms = gps_time;
+            }
+            if (gps_time >= ix.hdr.first_gps_ms && ix.hdr.first_gps_ms != 0) {
+                // start every bucket up to this one here
+                uint32_t bucket = (gps_time - ix.hdr.first_gps_ms) / ix.hdr.bucket_ms;
+                while (ok && ix.hdr.num_buckets <= bucket) {
+                    ok = _index_end_bucket() && _index_start_bucket(ofs);
+                }
+            }
+        }
+
+        // delta encoded packets are counted under their own type, so
+        // seeking by type finds full packets
+        if (ix.types[msg_type].count == 0) {
+            ix.types[msg_type].first_offset = ofs;
+        }
+        ix.types[msg_type].count++;
+        if (!ix.seen[msg_type]) {
+            uint16_t num;
+            memcpy(&num, ix.record, sizeof(num));
+            struct index_entry entry = { msg_type, ofs };
+            memcpy(&ix.record[sizeof(num) + num*sizeof(entry)], &entry, sizeof(entry));
+            num++;
+            memcpy(ix.record, &num, sizeof(num));
+            ix.seen[msg_type] = true;
+        }
+        ix.ofs = ofs + len;
+    }
+    if (!ok) {
+        return -1;
     }
+    if (ix.ofs < step_end) {
+        // reached the end of the log
+        return _index_finish() ? 1 : -1;
+    }
+    return 0;
+}
 
-    ::close(_read_fd);
-    _read_fd = -1;
+/*
+  write the last bucket record, the bucket table and the header
+ */
+bool DataFlash_File::_index_finish(void)
+{
+    struct index_builder &ix = *_index;
+    if (!_index_end_bucket()) {
+        return false;
+    }
+    ix.hdr.buckets_offset = ix.record_offset;
+    uint32_t table_len = ix.hdr.num_buckets * sizeof(ix.buckets[0]);
+    memcpy(ix.hdr.magic, DATAFLASH_INDEX_MAGIC, sizeof(ix.hdr.magic));
+    return ::write(ix.fd, ix.buckets, table_len) == (ssize_t)table_len &&
+        ::lseek(ix.fd, 0, SEEK_SET) == 0 &&
+        ::write(ix.fd, &ix.hdr, sizeof(ix.hdr)) == sizeof(ix.hdr) &&
+        ::write(ix.fd, ix.types, sizeof(ix.types)) == sizeof(ix.types);
+}
+
+/*
+  stop building an index. One that wasn't finished is left without
+  its magic, so it will be built again
+ */
+void DataFlash_File::_index_abort(void)
+{
+    if (_index == NULL) {
+        return;
+    }
+    if (_index->fd != -1) {
+        ::close(_index->fd);
+    }
+    free(_index->buckets);
+    free(_index);
+    _index = NULL;
+    _read_close();
+}
+
+/*
+  open the index file for a log. It has to cover the whole log, unless
+  allow_short is set for one that has just been built while the log
+  was being written. Returns a file descriptor or -1
+ */
+int DataFlash_File::_index_open(uint16_t log_num, struct index_header &hdr, bool allow_short)
+{
+    uint32_t log_size = _get_log_size(log_num);
+    if (log_size == 0) {
+        return -1;
+    }
+    char *fname = _index_file_name(log_num);
+    if (fname == NULL) {
+        return -1;
+    }
+    int fd = ::open(fname, O_RDONLY);
+    free(fname);
+    if (fd == -1) {
+        return -1;
+    }
+    if (::read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        memcmp(hdr.magic, DATAFLASH_INDEX_MAGIC, sizeof(hdr.magic)) == 0 &&
+        hdr.version == DATAFLASH_INDEX_VERSION &&
+        (hdr.log_size == log_size || (allow_short && hdr.log_size < log_size))) {
+        return fd;
+    }
+    ::close(fd);
+    return -1;
+}
+
+/*
+  find the first message of msg_type, or the first message of any
+  type if it is 0, at or after the start of the index bucket holding
+  gps_time_ms. The index is built a step at a time by repeated calls
+  if it is missing or older than the log
+ */
+int32_t DataFlash_File::find_msg(uint16_t log_num, uint8_t msg_type, uint32_t gps_time_ms)
+{
+    bool just_built = false;
+    if (_index != NULL && _index->log_num != log_num) {
+        _index_abort();
+    }
+    if (_index != NULL) {
+        int8_t ret = _index_step();
+        if (ret == 0) {
+            return -2;
+        }
+        _index_abort();
+        if (ret < 0) {
+            return -1;
+        }
+        just_built = true;
+    }
+
+    struct index_header hdr;
+    int fd = _index_open(log_num, hdr, just_built);
+    if (fd == -1) {
+        if (!just_built && _index_start(log_num)) {
+            return -2;
+        }
+        return -1;
+    }
+
+    int32_t ret = -1;
+    uint32_t bucket = 0;
+    if (gps_time_ms != 0) {
+        if (hdr.first_gps_ms == 0) {
+            // no GPS times in this log
+            bucket = hdr.num_buckets;
+        } else if (gps_time_ms > hdr.first_gps_ms) {
+            bucket = (gps_time_ms - hdr.first_gps_ms) / hdr.bucket_ms;
+        }
+    }
+    struct index_type type;
+    if (msg_type != 0 &&
+        (::lseek(fd, sizeof(hdr) + msg_type*sizeof(type), SEEK_SET) == -1 ||
+         ::read(fd, &type, sizeof(type)) != sizeof(type) ||
+         type.count == 0)) {
+        // none of this type in the log
+        bucket = hdr.num_buckets;
+    }
+    for (; bucket < hdr.num_buckets && ret == -1; bucket++) {
+        struct index_bucket b;
+        if (::lseek(fd, hdr.buckets_offset + bucket*sizeof(b), SEEK_SET) == -1 ||
+            ::read(fd, &b, sizeof(b)) != sizeof(b)) {
+            break;
+        }
+        if (msg_type == 0) {
+            ret = b.log_offset;
+            break;
+        }
+        uint16_t num;
+        if (::lseek(fd, b.record_offset, SEEK_SET) == -1 ||
+            ::read(fd, &num, sizeof(num)) != sizeof(num)) {
+            break;
+        }
+        struct index_entry entries[16];
+        while (num > 0 && ret == -1) {
+            uint16_t n = min(num, (uint16_t)(sizeof(entries)/sizeof(entries[0])));
+            if (::read(fd, entries, n*sizeof(entries[0])) != (ssize_t)(n*sizeof(entries[0]))) {
+                num = 0;
+                bucket = hdr.num_buckets;
+                break;
+            }
+            for (uint16_t i=0; i<n; i++) {
+                if (entries[i].msg_type == msg_type) {
+                    ret = entries[i].offset;
+                    break;
+                }
+            }
+            num -= n;
+        }
+    }
+    ::close(fd);
+    return ret;
 }
 
 /*
@@ -409,41 +1099,74 @@ void DataFlash_File::ListAvailableLogs(AP_HAL::BetterStream *port)
 }
 
 
-void DataFlash_File::_io_timer(uint32_t tnow)
+/*
+  write the next part of the buffer to the log file, returning true
+  if something was written. Unless flushing, this waits for a whole
+  chunk and ends the write on a chunk boundary of the file. Called
+  with _write_mutex held
+ */
+bool DataFlash_File::_write_some(bool flush)
 {
-    uint16_t _tail;
-    if (_write_fd == -1 || !_initialised) {
-        return;
+    if (_write_fd == -1) {
+        return false;
     }
-    uint16_t nbytes = BUF_AVAILABLE(_writebuf);
+    uint32_t tnow = hal.scheduler->millis();
+    uint32_t nbytes = _buf_available();
     if (nbytes == 0) {
-        return;
-    }
-    if (nbytes < 512 && 
-        tnow - _last_write_time < 2000000UL) {
-        // write in 512 byte chunks, but always write at least once
-        // per 2 seconds if data is available
-        return;
+        return false;
     }
-    _last_write_time = tnow;
-    if (nbytes > 512) {
-        // be kind to the FAT PX4 filesystem
-        nbytes = 512;
+    // after a partial write the next one only goes up to the chunk
+    // boundary, so the file lines up with the chunks again
+    uint32_t to_boundary = _chunk_size - _write_offset % _chunk_size;
+    if (!flush &&
+        nbytes < to_boundary &&
+        tnow - _last_write_ms < DATAFLASH_FILE_MAX_DELAY_MS) {
+        return false;
     }
-    if (_writebuf_head > _tail) {
-        // only write to the end of the buffer
-        nbytes = min(nbytes, _writebuf_size - _writebuf_head);
-    }
-    assert(_writebuf_head+nbytes <= _writebuf_size);
-    ssize_t nwritten = ::write(_write_fd, &_writebuf[_writebuf_head], nbytes);
+    uint32_t head = _writebuf_head;
+    // only write to the end of the buffer
+    nbytes = min(nbytes, _writebuf_size - head);
+    nbytes = min(nbytes, to_boundary);
+    ssize_t nwritten = ::write(_write_fd, &_writebuf[head], nbytes);
     if (nwritten <= 0) {
-        close(_write_fd);
+        ::close(_write_fd);
         _write_fd = -1;
         _initialised = false;
-    } else {
-        ::fsync(_write_fd);
-        BUF_ADVANCEHEAD(_writebuf, nwritten);
+        return false;
     }
+    _write_offset += nwritten;
+    _last_write_ms = tnow;
+    _writebuf_head = (head + nwritten) % _writebuf_size;
+    return true;
+}
+
+/*
+  the writer thread. This moves data from the buffer to the file, so
+  that a slow card only holds up this thread
+ */
+void DataFlash_File::_writer_loop(void)
+{
+    while (true) {
+        pthread_mutex_lock(&_write_mutex);
+        bool wrote = _write_some(false);
+        if (_write_fd != -1 &&
+            _write_offset != _sync_offset &&
+            hal.scheduler->millis() - _last_sync_ms >= _sync_interval_ms) {
+            ::fsync(_write_fd);
+            _sync_offset = _write_offset;
+            _last_sync_ms = hal.scheduler->millis();
+        }
+        pthread_mutex_unlock(&_write_mutex);
+        if (!wrote) {
+            usleep(2000);
+        }
+    }
+}
+
+void *DataFlash_File::_writer_thread(void *arg)
+{
+    ((DataFlash_File *)arg)->_writer_loop();
+    return NULL;
 }
 
 #endif // CONFIG_HAL_BOARD
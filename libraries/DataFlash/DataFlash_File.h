@@ -10,11 +10,24 @@
 #ifndef DataFlash_File_h
 #define DataFlash_File_h
 
+#include <pthread.h>
+
+// default size of the write buffer, and how often written data is
+// flushed to the card with fsync()
+#ifndef DATAFLASH_FILE_BUFFER_SIZE
+#define DATAFLASH_FILE_BUFFER_SIZE 16384
+#endif
+#ifndef DATAFLASH_FILE_SYNC_MS
+#define DATAFLASH_FILE_SYNC_MS 2000
+#endif
+
 class DataFlash_File : public DataFlash_Class
 {
 public:
     // constructor
-    DataFlash_File(const char *log_directory);
+    DataFlash_File(const char *log_directory,
+                   uint32_t buffer_size = DATAFLASH_FILE_BUFFER_SIZE,
+                   uint16_t sync_interval_ms = DATAFLASH_FILE_SYNC_MS);
 
     // initialisation
     void Init(void);
@@ -42,11 +55,32 @@ public:
     void ShowDeviceInfo(AP_HAL::BetterStream *port);
     void ListAvailableLogs(AP_HAL::BetterStream *port);
 
+    // seek within a log using its index file
+    int32_t find_msg(uint16_t log_num, uint8_t msg_type, uint32_t gps_time_ms);
+    bool LogReadSeek(uint16_t log_num, uint8_t msg_type, uint32_t gps_time_ms,
+                     uint8_t num_types,
+                     const struct LogStructure *structure,
+                     void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
+                     AP_HAL::BetterStream *port);
+
+    // write buffer statistics
+    uint32_t dropped_bytes(void) { return _dropped_bytes; }
+    uint8_t max_buffer_fill_pct(void);
+    void reset_buffer_stats(void);
+    uint32_t buffer_space(void) { return _buf_space(); }
+
+    // log download
+    void prepare_download(void) { _download_close(); }
+    void end_download(void) { _download_close(); }
+    bool logging_started(void) { return _write_fd != -1; }
+    uint32_t get_log_size(uint16_t log_num) { return _get_log_size(log_num); }
+    int16_t get_log_data(uint16_t log_num, uint32_t offset, uint16_t len, uint8_t *data);
+
 private:
-    static int _write_fd;
+    int _write_fd;
     int _read_fd;
     uint32_t _read_offset;
-    static volatile bool _initialised;
+    volatile bool _initialised;
     const char *_log_directory;
 
     /*
@@ -54,21 +88,128 @@ private:
     */
     void ReadBlock(void *pkt, uint16_t size);
 
-    // write buffer
-    static uint8_t *_writebuf;
-    static const uint16_t _writebuf_size;
-    static volatile uint16_t _writebuf_head;
-    static volatile uint16_t _writebuf_tail;
-    static uint32_t _last_write_time;
+    // the log being read, either mapped into memory or through a
+    // window buffer where mmap() isn't available
+    uint32_t _read_size;
+    uint8_t *_read_map;
+    uint8_t *_read_buf;
+    uint32_t _read_buf_ofs;
+    uint32_t _read_buf_len;
+
+    // the log being downloaded. This has its own descriptor as the
+    // current log can be downloaded while it is being written
+    int _download_fd;
+    uint16_t _download_log_num;
+    void _download_close(void);
+
+    bool _read_open(uint16_t log_num);
+    void _read_close(void);
+    const uint8_t *_read_get(uint32_t ofs, uint16_t len);
+    void _read_packets(uint32_t ofs, uint32_t end_ofs, uint8_t only_type,
+                       uint8_t num_types,
+                       const struct LogStructure *structure,
+                       void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
+                       AP_HAL::BetterStream *port);
+
+    /*
+      the index file for a log. The header is followed by an entry
+      for each message type, then a record for each bucket of GPS
+      time, then the bucket table. A bucket starts at the first GPS
+      message in its time, except the first, which starts at the
+      start of the log. Its record is the number of message types in
+      it, then the type and offset of the first message of each
+     */
+    struct PACKED index_header {
+        char magic[4];
+        uint8_t version;
+        uint8_t reserved;
+        uint16_t num_buckets;
+        uint32_t log_size;
+        uint32_t bucket_ms;
+        uint32_t first_gps_ms;
+        uint32_t buckets_offset;
+    };
+    struct PACKED index_type {
+        uint32_t count;
+        uint32_t first_offset;
+    };
+    struct PACKED index_entry {
+        uint8_t msg_type;
+        uint32_t offset;
+    };
+    struct PACKED index_bucket {
+        uint32_t log_offset;
+        uint32_t record_offset;
+    };
+
+    /*
+      an index being built. This is done a step at a time, so
+      building one for a MAVLink seek doesn't hold up the main loop.
+      The log is read through the _read_ functions while it is built
+     */
+    struct index_builder {
+        uint16_t log_num;
+        int fd;
+        uint32_t ofs;
+        uint32_t record_offset;
+        struct index_header hdr;
+        struct index_type types[256];
+        bool seen[256];
+        uint8_t msg_len[256];
+        char formats[256][16];
+        uint8_t gps_type;
+        uint8_t gps_time_ofs;
+        struct index_bucket *buckets;
+        uint16_t max_buckets;
+        uint8_t record[2 + 256*sizeof(struct index_entry)];
+    } *_index;
+
+    char *_index_file_name(uint16_t log_num);
+    int _index_open(uint16_t log_num, struct index_header &hdr, bool allow_short);
+    bool _index_start(uint16_t log_num);
+    int8_t _index_step(void);
+    bool _index_end_bucket(void);
+    bool _index_start_bucket(uint32_t log_offset);
+    bool _index_finish(void);
+    void _index_abort(void);
+
+    // write buffer. WriteBlock() adds at the tail and the writer
+    // thread takes from the head, so each only moves its own end
+    uint8_t *_writebuf;
+    const uint32_t _writebuf_size;
+    uint32_t _chunk_size;
+    volatile uint32_t _writebuf_head;
+    volatile uint32_t _writebuf_tail;
+
+    // the writer thread holds this while it uses _write_fd
+    pthread_mutex_t _write_mutex;
+    pthread_t _writer_ctx;
+    bool _writer_started;
+
+    // offset in the log file of the next write and at the last
+    // fsync, and the times of the last write and fsync
+    uint32_t _write_offset;
+    uint32_t _sync_offset;
+    uint32_t _last_write_ms;
+    uint32_t _last_sync_ms;
+    const uint16_t _sync_interval_ms;
+
+    // bytes of whole blocks that didn't fit in the buffer, and the
+    // most bytes that have been waiting in it
+    volatile uint32_t _dropped_bytes;
+    volatile uint32_t _max_fill;
 
     /* construct a file name given a log number. Caller must free. */
     char *_log_file_name(uint16_t log_num);
     char *_lastlog_file_name(void);
     uint32_t _get_log_size(uint16_t log_num);
 
-    static void _io_timer(uint32_t now);
+    uint32_t _buf_available(void) const;
+    uint32_t _buf_space(void) const;
+    bool _write_some(bool flush);
+    void _writer_loop(void);
+    static void *_writer_thread(void *arg);
 };
 
 
 #endif // DataFlash_File_h
-
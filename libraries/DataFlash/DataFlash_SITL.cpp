@@ -9,33 +9,55 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdint.h>
 #include "DataFlash.h"
 
 #define DF_PAGE_SIZE 512
 #define DF_NUM_PAGES 4096
+// the page after the last one holds the logging format version
+#define DF_FLASH_SIZE (DF_PAGE_SIZE*(DF_NUM_PAGES+1))
 
 extern const AP_HAL::HAL& hal;
 
-static int flash_fd;
+static int flash_fd = -1;
+static uint8_t *flash;
 static uint8_t buffer[2][DF_PAGE_SIZE];
 
+/*
+  dataflash.bin is a sparse file mapped into memory. Erased pages are
+  holes (or zero filled where holes can't be punched), and as a real
+  page always has a non-zero header they are presented as 0xFF when
+  read. Images from older builds that were filled with 0xFF still work
+ */
+
 // Public Methods //////////////////////////////////////////////////////////////
 void DataFlash_SITL::Init(void)
 {
-	if (flash_fd == 0) {
-		flash_fd = open("dataflash.bin", O_RDWR, 0777);
-		if (flash_fd == -1) {
-			uint8_t *fill;
-			fill = (uint8_t *)malloc(DF_PAGE_SIZE*DF_NUM_PAGES);
-			flash_fd = open("dataflash.bin", O_RDWR | O_CREAT, 0777);
-			memset(fill, 0xFF, DF_PAGE_SIZE*DF_NUM_PAGES);
-			write(flash_fd, fill, DF_PAGE_SIZE*DF_NUM_PAGES);
-			free(fill);
+	if (flash == NULL) {
+		struct stat st;
+		flash_fd = open("dataflash.bin", O_RDWR | O_CREAT, 0777);
+		if (flash_fd == -1 || fstat(flash_fd, &st) != 0) {
+			fprintf(stderr, "Failed to open dataflash.bin - %s\n", strerror(errno));
+			exit(1);
+		}
+		// extending the file leaves a hole, so a new image costs nothing
+		if (st.st_size < DF_FLASH_SIZE && ftruncate(flash_fd, DF_FLASH_SIZE) != 0) {
+			fprintf(stderr, "Failed to size dataflash.bin - %s\n", strerror(errno));
+			exit(1);
 		}
+		void *p = mmap(NULL, DF_FLASH_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, flash_fd, 0);
+		if (p == MAP_FAILED) {
+			fprintf(stderr, "Failed to map dataflash.bin - %s\n", strerror(errno));
+			exit(1);
+		}
+		flash = (uint8_t *)p;
 	}
 	df_PageSize = DF_PAGE_SIZE;
 
@@ -82,14 +104,39 @@ void DataFlash_SITL::WaitReady()
 	while(!ReadStatus());
 }
 
+/*
+  return true if a page of the image has never been programmed
+ */
+static bool page_is_hole(const uint8_t *page)
+{
+	const uint32_t *p = (const uint32_t *)page;
+	for (uint16_t i=0; i<DF_PAGE_SIZE/sizeof(uint32_t); i++) {
+		if (p[i] != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void DataFlash_SITL::PageToBuffer(unsigned char BufferNum, uint16_t PageAdr)
 {
-	pread(flash_fd, buffer[BufferNum], DF_PAGE_SIZE, PageAdr*DF_PAGE_SIZE);
+	const uint8_t *page = &flash[PageAdr*DF_PAGE_SIZE];
+	if (page_is_hole(page)) {
+		memset(buffer[BufferNum], 0xFF, DF_PAGE_SIZE);
+	} else {
+		memcpy(buffer[BufferNum], page, DF_PAGE_SIZE);
+	}
 }
 
 void DataFlash_SITL::BufferToPage (unsigned char BufferNum, uint16_t PageAdr, unsigned char wait)
 {
-	pwrite(flash_fd, buffer[BufferNum], DF_PAGE_SIZE, PageAdr*DF_PAGE_SIZE);
+	memcpy(&flash[PageAdr*DF_PAGE_SIZE], buffer[BufferNum], DF_PAGE_SIZE);
+
+	// start writeback of the system page holding this flash page,
+	// without waiting for it
+	uintptr_t mask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+	uint8_t *start = (uint8_t *)((uintptr_t)&flash[PageAdr*DF_PAGE_SIZE] & mask);
+	msync(start, &flash[(PageAdr+1)*DF_PAGE_SIZE] - start, MS_ASYNC);
 }
 
 void DataFlash_SITL::BufferWrite (unsigned char BufferNum, uint16_t IntPageAdr, unsigned char Data)
@@ -128,27 +175,41 @@ bool DataFlash_SITL::BlockRead(uint8_t BufferNum, uint16_t IntPageAdr, void *pBu
 
 // *** END OF INTERNAL FUNCTIONS ***
 
+/*
+  erase a range of the image. Punching a hole frees the disk space,
+  otherwise fall back to zero filling
+ */
+static void erase_range(uint32_t offset, uint32_t len)
+{
+	// the last block EraseAll() asks for runs past the end of the image
+	if (offset >= DF_FLASH_SIZE) {
+		return;
+	}
+	if (offset + len > DF_FLASH_SIZE) {
+		len = DF_FLASH_SIZE - offset;
+	}
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (fallocate(flash_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0) {
+		return;
+	}
+#endif
+	memset(&flash[offset], 0, len);
+}
+
 void DataFlash_SITL::PageErase (uint16_t PageAdr)
 {
-	uint8_t fill[DF_PAGE_SIZE];
-	memset(fill, 0xFF, sizeof(fill));
-	pwrite(flash_fd, fill, DF_PAGE_SIZE, PageAdr*DF_PAGE_SIZE);
+	erase_range(PageAdr*DF_PAGE_SIZE, DF_PAGE_SIZE);
 }
 
 void DataFlash_SITL::BlockErase (uint16_t BlockAdr)
 {
-	uint8_t fill[DF_PAGE_SIZE*8];
-	memset(fill, 0xFF, sizeof(fill));
-	pwrite(flash_fd, fill, DF_PAGE_SIZE*8, BlockAdr*DF_PAGE_SIZE*8);
+	erase_range(BlockAdr*DF_PAGE_SIZE*8, DF_PAGE_SIZE*8);
 }
 
 
 void DataFlash_SITL::ChipErase()
 {
-	for (int i=0; i<DF_NUM_PAGES; i++) {
-		PageErase(i);
-        hal.scheduler->delay(1);
-	}
+	erase_range(0, DF_FLASH_SIZE);
 }
 
 
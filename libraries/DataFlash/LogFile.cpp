@@ -268,12 +268,53 @@ void DataFlash_Class::_print_log_entry(uint8_t msg_type,
         port->printf_P(PSTR("UNKN, %u\n"), (unsigned)msg_type);
         return;
     }
+    if (PGM_UINT8(&structure[i].format[0]) == '*') {
+        // a delta encoded packet, print it as the full message
+        uint8_t base_type = msg_type & ~LOG_DELTA_FLAG;
+        for (i=0; i<num_types; i++) {
+            if (base_type == PGM_UINT8(&structure[i].msg_type)) {
+                break;
+            }
+        }
+        if (i == num_types) {
+            port->printf_P(PSTR("UNKN, %u\n"), (unsigned)msg_type);
+            return;
+        }
+        uint8_t msg_len = PGM_UINT8(&structure[i].msg_len) - 3;
+        uint8_t pkt[msg_len];
+        if (_read_delta(base_type, &structure[i], pkt)) {
+            _print_log_packet(&structure[i], pkt, print_mode, port);
+        }
+        return;
+    }
     uint8_t msg_len = PGM_UINT8(&structure[i].msg_len) - 3;
     uint8_t pkt[msg_len];
     ReadBlock(pkt, msg_len);
-    port->printf_P(PSTR("%S, "), structure[i].name);
+    if (!(msg_type & LOG_DELTA_FLAG)) {
+        // keep the packet if deltas against it may follow
+        for (uint8_t j=0; j<num_types; j++) {
+            if (PGM_UINT8(&structure[j].msg_type) == LOG_DELTA(msg_type)) {
+                _delta_keyframe(msg_type, pkt, msg_len);
+                break;
+            }
+        }
+    }
+    _print_log_packet(&structure[i], pkt, print_mode, port);
+}
+
+/*
+  print the body of a log entry, which has already been read, using
+  the format string of its structure
+ */
+void DataFlash_Class::_print_log_packet(const struct LogStructure *structure,
+                                        const uint8_t *pkt,
+                                        void (*print_mode)(AP_HAL::BetterStream *port, uint8_t mode),
+                                        AP_HAL::BetterStream *port)
+{
+    uint8_t msg_len = PGM_UINT8(&structure->msg_len) - 3;
+    port->printf_P(PSTR("%S, "), structure->name);
     for (uint8_t ofs=0, fmt_ofs=0; ofs<msg_len; fmt_ofs++) {
-        char fmt = PGM_UINT8(&structure[i].format[fmt_ofs]);
+        char fmt = PGM_UINT8(&structure->format[fmt_ofs]);
         switch (fmt) {
         case 'b': {
             port->printf_P(PSTR("%d"), (int)pkt[ofs]);
@@ -395,6 +436,210 @@ void DataFlash_Class::_print_log_entry(uint8_t msg_type,
     port->println();
 }
 
+/*
+  string fields are sent whole when they change, numbers as the
+  difference from the last value
+ */
+static bool format_is_string(char fmt)
+{
+    return fmt == 'n' || fmt == 'N' || fmt == 'Z';
+}
+
+/*
+  read a little-endian field of 1, 2 or 4 bytes
+ */
+static uint32_t field_get(const uint8_t *p, uint8_t size)
+{
+    uint32_t v = 0;
+    for (uint8_t i=size; i>0; i--) {
+        v = (v << 8) | p[i-1];
+    }
+    return v;
+}
+
+static void field_set(uint8_t *p, uint8_t size, uint32_t v)
+{
+    for (uint8_t i=0; i<size; i++) {
+        p[i] = v & 0xFF;
+        v >>= 8;
+    }
+}
+
+/*
+  delta encode a packet body against the previous one
+ */
+uint8_t DataFlash_Class::delta_encode(const prog_char *format,
+                                      const uint8_t *prev, const uint8_t *body, uint8_t len,
+                                      uint8_t *out, uint8_t out_size)
+{
+    uint8_t n = 0;
+    for (uint8_t ofs=0, fmt_ofs=0; ofs<len; fmt_ofs++) {
+        char fmt = PGM_UINT8(&format[fmt_ofs]);
+        uint8_t size = log_format_size(fmt);
+        if (size == 0 || ofs + size > len) {
+            return 0;
+        }
+        if (format_is_string(fmt)) {
+            bool changed = memcmp(&prev[ofs], &body[ofs], size) != 0;
+            if (n + 1 + (changed?size:0) > out_size) {
+                return 0;
+            }
+            out[n++] = changed;
+            if (changed) {
+                memcpy(&out[n], &body[ofs], size);
+                n += size;
+            }
+        } else {
+            // the difference, sign extended from the field size
+            uint8_t shift = 32 - 8*size;
+            int32_t d = (int32_t)((field_get(&body[ofs], size) - field_get(&prev[ofs], size)) << shift) >> shift;
+            uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+            do {
+                if (n == out_size) {
+                    return 0;
+                }
+                out[n++] = (z & 0x7F) | (z > 0x7F ? 0x80 : 0);
+                z >>= 7;
+            } while (z != 0);
+        }
+        ofs += size;
+    }
+    return n;
+}
+
+/*
+  length of a delta encoded body
+ */
+int16_t DataFlash_Class::delta_length(const prog_char *format, uint8_t len,
+                                      const uint8_t *data, uint16_t avail)
+{
+    uint16_t n = 0;
+    for (uint8_t ofs=0, fmt_ofs=0; ofs<len; fmt_ofs++) {
+        char fmt = PGM_UINT8(&format[fmt_ofs]);
+        uint8_t size = log_format_size(fmt);
+        if (size == 0) {
+            return -1;
+        }
+        if (n >= avail) {
+            return -1;
+        }
+        if (format_is_string(fmt)) {
+            n += data[n] ? 1 + size : 1;
+        } else {
+            while (n < avail && (data[n] & 0x80)) {
+                n++;
+            }
+            n++;
+        }
+        ofs += size;
+    }
+    if (n > avail) {
+        return -1;
+    }
+    return n;
+}
+
+/*
+  read a varint with ReadBlock()
+ */
+uint32_t DataFlash_Class::_read_varint(void)
+{
+    uint32_t v = 0;
+    for (uint8_t shift=0; shift<35; shift += 7) {
+        uint8_t b;
+        ReadBlock(&b, 1);
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return v;
+}
+
+/*
+  read a delta encoded packet body and apply it to the last packet of
+  its type. Returns false if there hasn't been a full packet of the
+  type yet, in which case the body is read and discarded
+ */
+bool DataFlash_Class::_read_delta(uint8_t base_type, const struct LogStructure *base, uint8_t *pkt)
+{
+    uint8_t msg_len = PGM_UINT8(&base->msg_len) - 3;
+    uint8_t *body = NULL;
+    for (uint8_t i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+        if (_delta_read[i].body != NULL && _delta_read[i].msg_type == base_type) {
+            body = _delta_read[i].body;
+            break;
+        }
+    }
+    if (body == NULL) {
+        memset(pkt, 0, msg_len);
+        body = pkt;
+    }
+    for (uint8_t ofs=0, fmt_ofs=0; ofs<msg_len; fmt_ofs++) {
+        char fmt = PGM_UINT8(&base->format[fmt_ofs]);
+        uint8_t size = log_format_size(fmt);
+        if (size == 0) {
+            break;
+        }
+        if (format_is_string(fmt)) {
+            uint8_t changed;
+            ReadBlock(&changed, 1);
+            if (changed) {
+                ReadBlock(&body[ofs], size);
+            }
+        } else {
+            uint32_t z = _read_varint();
+            int32_t d = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+            field_set(&body[ofs], size, field_get(&body[ofs], size) + d);
+        }
+        ofs += size;
+    }
+    if (body == pkt) {
+        return false;
+    }
+    memcpy(pkt, body, msg_len);
+    return true;
+}
+
+/*
+  keep a full packet of a type that may have deltas against it
+ */
+void DataFlash_Class::_delta_keyframe(uint8_t msg_type, const uint8_t *pkt, uint8_t len)
+{
+    uint8_t i;
+    for (i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+        if (_delta_read[i].body != NULL && _delta_read[i].msg_type == msg_type) {
+            break;
+        }
+    }
+    if (i == LOG_DELTA_MAX_STREAMS) {
+        for (i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+            if (_delta_read[i].body == NULL) {
+                _delta_read[i].body = (uint8_t *)malloc(len);
+                _delta_read[i].msg_type = msg_type;
+                break;
+            }
+        }
+        if (i == LOG_DELTA_MAX_STREAMS || _delta_read[i].body == NULL) {
+            return;
+        }
+    }
+    memcpy(_delta_read[i].body, pkt, len);
+}
+
+/*
+  forget the packets kept for delta decoding
+ */
+void DataFlash_Class::_delta_read_reset(void)
+{
+    for (uint8_t i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+        if (_delta_read[i].body != NULL) {
+            free(_delta_read[i].body);
+            _delta_read[i].body = NULL;
+        }
+    }
+}
+
 /*
   Read the log and print it on port
 */
@@ -413,6 +658,7 @@ void DataFlash_Block::LogReadProcess(uint16_t log_num,
     }
 
     StartRead(start_page);
+    _delta_read_reset();
 
 	while (true) {
 		uint8_t data;
@@ -442,6 +688,7 @@ void DataFlash_Block::LogReadProcess(uint16_t log_num,
         uint16_t new_page = GetPage();
         if (new_page != page) {
             if (new_page == end_page || new_page == start_page) {
+                _delta_read_reset();
                 return;
             }
             page = new_page;
@@ -512,6 +759,17 @@ void DataFlash_Block::ListAvailableLogs(AP_HAL::BetterStream *port)
     port->println();
 }
 
+DataFlash_Class::DataFlash_Class() :
+    _num_types(0),
+    _structures(NULL),
+    _delta_epoch(0)
+{
+    for (uint8_t i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+        _delta_read[i].body = NULL;
+        _delta_format[i] = 0;
+    }
+}
+
 // This function starts a new log file in the DataFlash, and writes
 // the format of supported messages in the log, plus all parameters
 uint16_t DataFlash_Class::StartNewLog(uint8_t num_types, const struct LogStructure *structures)
@@ -519,8 +777,21 @@ uint16_t DataFlash_Class::StartNewLog(uint8_t num_types, const struct LogStructu
     uint16_t ret;
     ret = start_new_log();
 
-    // write log formats so the log is self-describing
+    // delta encoded messages start again with a full packet
+    _num_types = num_types;
+    _structures = structures;
+    _delta_epoch++;
+    for (uint8_t i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+        _delta_format[i] = 0;
+    }
+
+    // write log formats so the log is self-describing. Delta formats
+    // wait for the first delta packet of their type, see
+    // WriteDeltaBlock()
     for (uint8_t i=0; i<num_types; i++) {
+        if (PGM_UINT8(&structures[i].format[0]) == '*') {
+            continue;
+        }
         Log_Write_Format(&structures[i]);
         // avoid corrupting the APM1/APM2 dataflash by writing too fast
         hal.scheduler->delay(10);
@@ -598,8 +869,92 @@ void DataFlash_Class::Log_Write_Parameters(void)
 
 
 
+/*
+  write a packet as a delta against the last one of its type
+ */
+void DataFlash_Class::WriteDeltaBlock(void *prev, uint8_t &count, uint8_t &epoch,
+                                      const void *pkt, uint8_t size, bool use_delta)
+{
+    if (!use_delta) {
+        // a reader takes this as its new base, so the next delta
+        // write has to be a full packet too
+        WriteBlock(pkt, size);
+        count = 0;
+        return;
+    }
+
+    const uint8_t *p = (const uint8_t *)pkt;
+    const struct LogStructure *s = NULL;
+    const struct LogStructure *ds = NULL;
+    for (uint8_t i=0; i<_num_types; i++) {
+        uint8_t type = PGM_UINT8(&_structures[i].msg_type);
+        if (type == p[2]) {
+            s = &_structures[i];
+        } else if (type == LOG_DELTA(p[2])) {
+            ds = &_structures[i];
+        }
+    }
+    if (s == NULL || ds == NULL || PGM_UINT8(&s->msg_len) != size) {
+        WriteBlock(pkt, size);
+        return;
+    }
+
+    // readers need the delta format before the full packet the
+    // deltas start from
+    _write_delta_format(ds);
+
+    uint32_t dropped = dropped_bytes();
+    uint8_t out[size];
+    uint8_t n = 0;
+    if (epoch == _delta_epoch && count != 0) {
+        // only worth sending if it is shorter than the full packet
+        n = delta_encode(s->format, (const uint8_t *)prev + 3, p + 3, size - 3,
+                         &out[3], size - 4);
+    }
+    if (n == 0) {
+        WriteBlock(pkt, size);
+        count = 0;
+    } else {
+        out[0] = HEAD_BYTE1;
+        out[1] = HEAD_BYTE2;
+        out[2] = LOG_DELTA(p[2]);
+        WriteBlock(out, n + 3);
+    }
+    memcpy(prev, pkt, size);
+    epoch = _delta_epoch;
+    if (++count >= LOG_DELTA_KEYFRAME || dropped_bytes() != dropped) {
+        // the next packet is a full one, including when a write has
+        // been lost and the reader can no longer follow the deltas
+        count = 0;
+    }
+}
+
+/*
+  write the format of a delta type the first time a packet that may
+  be delta encoded goes into the current log
+ */
+void DataFlash_Class::_write_delta_format(const struct LogStructure *s)
+{
+    uint8_t type = PGM_UINT8(&s->msg_type);
+    uint8_t i;
+    for (i=0; i<LOG_DELTA_MAX_STREAMS; i++) {
+        if (_delta_format[i] == type) {
+            return;
+        }
+        if (_delta_format[i] == 0) {
+            break;
+        }
+    }
+    Log_Write_Format(s);
+    if (i < LOG_DELTA_MAX_STREAMS) {
+        _delta_format[i] = type;
+    }
+}
+
 // Write an GPS packet
-void DataFlash_Class::Log_Write_GPS(const GPS *gps, int32_t relative_alt)
+void DataFlash_Class::Log_Write_GPS(const GPS *gps, int32_t relative_alt,
+                                    DataFlash_Delta<struct log_GPS> *delta,
+                                    bool use_delta)
 {
     struct log_GPS pkt = {
         LOG_PACKET_HEADER_INIT(LOG_GPS_MSG),
@@ -614,12 +969,18 @@ void DataFlash_Class::Log_Write_GPS(const GPS *gps, int32_t relative_alt)
         ground_speed  : gps->ground_speed,
         ground_course : gps->ground_course
     };
+    if (delta != NULL) {
+        WriteDelta(*delta, pkt, use_delta);
+        return;
+    }
     WriteBlock(&pkt, sizeof(pkt));
 }
 
 
 // Write an raw accel/gyro data packet
-void DataFlash_Class::Log_Write_IMU(const AP_InertialSensor *ins)
+void DataFlash_Class::Log_Write_IMU(const AP_InertialSensor *ins,
+                                    DataFlash_Delta<struct log_IMU> *delta,
+                                    bool use_delta)
 {
     Vector3f gyro = ins->get_gyro();
     Vector3f accel = ins->get_accel();
@@ -632,6 +993,10 @@ void DataFlash_Class::Log_Write_IMU(const AP_InertialSensor *ins)
         accel_y : accel.y,
         accel_z : accel.z
     };
+    if (delta != NULL) {
+        WriteDelta(*delta, pkt, use_delta);
+        return;
+    }
     WriteBlock(&pkt, sizeof(pkt));
 }
 
@@ -0,0 +1,123 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+
+/*
+  the binary log format. This only needs stdint.h, so host tools
+  that read logs can include it as well as the DataFlash library
+ */
+#ifndef LogStructure_h
+#define LogStructure_h
+
+#include <stdint.h>
+
+#ifndef PACKED
+#define PACKED __attribute__((__packed__))
+#endif
+
+/*
+  unfortunately these need to be macros because of a limitation of
+  named member structure initialisation in g++
+ */
+#define LOG_PACKET_HEADER	       uint8_t head1, head2, msgid;
+#define LOG_PACKET_HEADER_INIT(id) head1 : HEAD_BYTE1, head2 : HEAD_BYTE2, msgid : id
+
+#define HEAD_BYTE1  0xA3    // Decimal 163
+#define HEAD_BYTE2  0x95    // Decimal 149
+
+/*
+Format characters in the format string for binary log messages
+  b   : int8_t
+  B   : uint8_t
+  h   : int16_t
+  H   : uint16_t
+  i   : int32_t
+  I   : uint32_t
+  f   : float
+  n   : char[4]
+  N   : char[16]
+  Z   : char[64]
+  c   : int16_t * 100
+  C   : uint16_t * 100
+  e   : int32_t * 100
+  E   : uint32_t * 100
+  L   : int32_t latitude/longitude
+  M   : uint8_t flight mode
+  *   : delta encoded packet, see LOG_DELTA_FLAG
+ */
+
+// structure used to define logging format
+struct LogStructure {
+    uint8_t msg_type;
+    uint8_t msg_len;
+    const char name[5];
+    const char format[16];
+    const char labels[64];
+};
+
+/*
+  size in a packet of a field with the given format character, or 0
+  if it isn't one
+ */
+static inline uint8_t log_format_size(char fmt)
+{
+    switch (fmt) {
+    case 'b':
+    case 'B':
+    case 'M':
+        return 1;
+    case 'h':
+    case 'H':
+    case 'c':
+    case 'C':
+        return 2;
+    case 'i':
+    case 'I':
+    case 'f':
+    case 'e':
+    case 'E':
+    case 'L':
+    case 'n':
+        return 4;
+    case 'N':
+        return 16;
+    case 'Z':
+        return 64;
+    }
+    return 0;
+}
+
+/*
+  delta encoded packets of a message type have the type with
+  LOG_DELTA_FLAG set, and a structure with a format of "*" under a
+  name of its own, such as GPSD for GPS. Its FMT entry only goes into
+  a log once packets of the type are being delta encoded. The body is a varint for each field of the
+  full message, holding the zig-zag encoded difference from the last
+  packet of that type, or for strings a 0 if unchanged or a 1 and the
+  new string. Floats are differenced as their bit patterns, so the
+  encoding is lossless
+ */
+#define LOG_DELTA_FLAG          0x40
+#define LOG_DELTA(type)         ((type) | LOG_DELTA_FLAG)
+#define LOG_DELTA_STRUCTURE(type, name) { LOG_DELTA(type), 3, name, "*", "" }
+#define LOG_DELTA_KEYFRAME      50
+#define LOG_DELTA_MAX_STREAMS   6
+
+// the FMT message, which describes the other messages in a log
+struct PACKED log_Format {
+    LOG_PACKET_HEADER;
+    uint8_t type;
+    uint8_t length;
+    char name[4];
+    char format[16];
+    char labels[64];
+};
+
+// message types for common messages
+#define LOG_FORMAT_MSG	  128
+#define LOG_PARAMETER_MSG 129
+#define LOG_GPS_MSG		  130
+#define LOG_IMU_MSG		  131
+#define LOG_MESSAGE_MSG	  132
+#define LOG_BLACKBOX_MSG  133
+#define LOG_BLACKBOX_IMU_MSG 134    // an IMU packet from a black box flush
+
+#endif // LogStructure_h
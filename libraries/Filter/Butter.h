@@ -88,6 +88,7 @@ struct butter100_4_coeffs
 typedef Butter2<butter100_4_coeffs> butter100hz4_0; //100hz sample, 4hz fcut
 typedef Butter2<butter100_4_coeffs> butter50hz2_0; //50hz sample, 2hz fcut
 typedef Butter2<butter100_4_coeffs> butter10hz0_4; //10hz sample, .4hz fcut
+typedef Butter2<butter100_4_coeffs> butter200hz8_0; //200hz sample, 8hz fcut
 
 struct butter100_8_coeffs
 {
@@ -21,9 +21,12 @@
 
 #if CONFIG_HAL_BOARD == HAL_BOARD_APM1 || CONFIG_HAL_BOARD == HAL_BOARD_APM2
 #include <util/crc16.h>
-#define HAVE_CRC_ACCUMULATE
 #endif
 
+// we supply a faster crc_accumulate() than the generic one on all
+// boards, see below
+#define HAVE_CRC_ACCUMULATE
+
 #include "include/mavlink/v1.0/ardupilotmega/version.h"
 
 // this allows us to make mavlink_message_t much smaller. It means we
@@ -43,6 +46,10 @@ extern AP_HAL::BetterStream	*mavlink_comm_1_port;
 /// MAVLink system definition
 extern mavlink_system_t mavlink_system;
 
+/// Count of bytes written to each MAVLink channel, for measuring the
+/// throughput of a link
+extern uint32_t mavlink_comm_tx_bytes[MAVLINK_COMM_NUM_BUFFERS];
+
 /// Send a byte to the nominated MAVLink channel
 ///
 /// @param chan		Channel to send to
@@ -52,10 +59,10 @@ static inline void comm_send_ch(mavlink_channel_t chan, uint8_t ch)
 {
     switch(chan) {
 	case MAVLINK_COMM_0:
-		mavlink_comm_0_port->write(ch);
+		mavlink_comm_tx_bytes[0] += mavlink_comm_0_port->write(ch);
 		break;
 	case MAVLINK_COMM_1:
-		mavlink_comm_1_port->write(ch);
+		mavlink_comm_tx_bytes[1] += mavlink_comm_1_port->write(ch);
 		break;
 	default:
 		break;
@@ -133,13 +140,22 @@ static inline uint16_t comm_get_txspace(mavlink_channel_t chan)
     return (uint16_t)ret;
 }
 
-#ifdef HAVE_CRC_ACCUMULATE
+#if CONFIG_HAL_BOARD == HAL_BOARD_APM1 || CONFIG_HAL_BOARD == HAL_BOARD_APM2
 // use the AVR C library implementation. This is a bit over twice as
 // fast as the C version
 static inline void crc_accumulate(uint8_t data, uint16_t *crcAccum)
 {
 	*crcAccum = _crc_ccitt_update(*crcAccum, data);
 }
+#else
+// elsewhere there is room for a 512 byte table, which replaces the
+// shifts and xors of the C version with one lookup per byte. See
+// libraries/GCS_MAVLink/examples/crc_speed for a comparison
+extern const uint16_t mavlink_crc_table[256];
+static inline void crc_accumulate(uint8_t data, uint16_t *crcAccum)
+{
+	*crcAccum = (*crcAccum >> 8) ^ mavlink_crc_table[(uint8_t)(*crcAccum ^ data)];
+}
 #endif
 
 /*
@@ -0,0 +1,130 @@
+/// -*- tab-width: 4; Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil -*-
+//
+// Speed test of the X.25 CRC used by MAVLink. This compares the
+// generic shift and xor version from checksum.h, the crc_accumulate()
+// the library uses on this board, and a slicing-by-4 version that
+// takes 4 bytes per step with 4 tables
+//
+
+#include <AP_HAL.h>
+#include <AP_Common.h>
+#include <AP_Progmem.h>
+#include <AP_Param.h>
+#include <AP_HAL_AVR.h>
+#include <AP_HAL_AVR_SITL.h>
+#include <AP_HAL_Empty.h>
+#include <AP_HAL_PX4.h>
+#include <AP_Math.h>
+#include <Filter.h>
+#include <AP_ADC.h>
+#include <SITL.h>
+#include <AP_Compass.h>
+#include <AP_Baro.h>
+#include <GCS_MAVLink.h>
+
+const AP_HAL::HAL& hal = AP_HAL_BOARD_DRIVER;
+
+// a full size MAVLink frame, less the start byte
+#define FRAME_LEN (MAVLINK_MAX_PAYLOAD_LEN + MAVLINK_NUM_NON_PAYLOAD_BYTES - 1)
+#define NUM_FRAMES 10000
+
+// the X.25 initial value, from checksum.h
+#define CRC_INIT 0xffff
+
+static uint8_t frame[FRAME_LEN];
+
+static uint16_t crc_generic(const uint8_t *p, uint16_t len)
+{
+    uint16_t crc = CRC_INIT;
+    while (len--) {
+        uint8_t tmp = *p++ ^ (uint8_t)(crc & 0xff);
+        tmp ^= (tmp<<4);
+        crc = (crc>>8) ^ (tmp<<8) ^ (tmp<<3) ^ (tmp>>4);
+    }
+    return crc;
+}
+
+static uint16_t crc_library(const uint8_t *p, uint16_t len)
+{
+    uint16_t crc = CRC_INIT;
+    while (len--) {
+        crc_accumulate(*p++, &crc);
+    }
+    return crc;
+}
+
+#if CONFIG_HAL_BOARD != HAL_BOARD_APM1 && CONFIG_HAL_BOARD != HAL_BOARD_APM2
+// slice_table[k][i] is the CRC of byte i followed by k zero bytes
+static uint16_t slice_table[4][256];
+
+static void slice_init(void)
+{
+    for (uint16_t i=0; i<256; i++) {
+        slice_table[0][i] = mavlink_crc_table[i];
+    }
+    for (uint8_t k=1; k<4; k++) {
+        for (uint16_t i=0; i<256; i++) {
+            uint16_t c = slice_table[k-1][i];
+            slice_table[k][i] = (c >> 8) ^ mavlink_crc_table[c & 0xff];
+        }
+    }
+}
+
+static uint16_t crc_slice4(const uint8_t *p, uint16_t len)
+{
+    uint16_t crc = CRC_INIT;
+    while (len >= 4) {
+        crc ^= p[0] | (p[1]<<8);
+        crc = slice_table[3][crc & 0xff] ^ slice_table[2][crc >> 8] ^
+              slice_table[1][p[2]] ^ slice_table[0][p[3]];
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ mavlink_crc_table[(uint8_t)(crc ^ *p++)];
+    }
+    return crc;
+}
+#endif
+
+/*
+  CRC NUM_FRAMES frames, changing the first byte of each so the work
+  can't be hoisted out of the loop. Returns the sum of the CRCs so the
+  versions can be checked against each other
+ */
+static uint32_t test_crc(const char *name, uint16_t (*fn)(const uint8_t *, uint16_t), uint32_t expected)
+{
+    uint32_t sum = 0;
+    uint32_t start_time = hal.scheduler->micros();
+    for (uint16_t count=0; count<NUM_FRAMES; count++) {
+        frame[0] = count;
+        sum += fn(frame, FRAME_LEN);
+    }
+    uint32_t elapsed = hal.scheduler->micros() - start_time;
+    hal.console->printf_P(PSTR("%-8s %s  %lu usec for %u frames, %.2f usec/frame\n"),
+                          name,
+                          (expected == 0 || sum == expected) ? "PASS" : "FAIL",
+                          (unsigned long)elapsed, (unsigned)NUM_FRAMES,
+                          elapsed / (float)NUM_FRAMES);
+    return sum;
+}
+
+void setup(void)
+{
+    hal.console->printf_P(PSTR("MAVLink CRC speed test, %u byte frames\n\n"), (unsigned)FRAME_LEN);
+
+    for (uint16_t i=0; i<FRAME_LEN; i++) {
+        frame[i] = i * 37 + 11;
+    }
+
+    uint32_t expected = test_crc("generic", crc_generic, 0);
+    test_crc("library", crc_library, expected);
+#if CONFIG_HAL_BOARD != HAL_BOARD_APM1 && CONFIG_HAL_BOARD != HAL_BOARD_APM2
+    slice_init();
+    test_crc("slice4", crc_slice4, expected);
+#endif
+}
+
+void loop(void){}
+
+AP_HAL_MAIN();
@@ -30,6 +30,12 @@ const AP_Param::GroupInfo SITL::var_info[] PROGMEM = {
     AP_GROUPINFO("GPS_BYTELOSS",  13, SITL,  gps_byteloss,  0),
     AP_GROUPINFO("GPS_NUMSATS",   14, SITL,  gps_numsats,   10),
     AP_GROUPINFO("MAG_ERROR",     15, SITL,  mag_error,  0),
+    AP_GROUPINFO("CURR_SPD",      16, SITL,  current_speed,  0),
+    AP_GROUPINFO("CURR_DIR",      17, SITL,  current_direction,  0),
+    AP_GROUPINFO("GPS_NOISE",     18, SITL,  gps_noise,  0),
+    AP_GROUPINFO("SPEEDUP",       19, SITL,  speedup,  0),
+    AP_GROUPINFO("WINCH_SNAG",    20, SITL,  winch_snag,  0),
+    AP_GROUPINFO("PIN_BOUNCE",    21, SITL,  pin_bounce,  30),
     AP_GROUPEND
 };
 
@@ -60,11 +60,24 @@ public:
     AP_Int8  gps_type;    // see enum GPSType
     AP_Float gps_byteloss;// byte loss as a percent
     AP_Int8  gps_numsats; // number of visible satellites
+    AP_Float gps_noise;   // position noise in metres
 
     // wind control
     AP_Float wind_speed;
     AP_Float wind_direction;
     AP_Float wind_turbulance;
+
+    // water current, direction is where it flows towards
+    AP_Float current_speed;
+    AP_Float current_direction;
+
+    // limit on simulated time per wall clock time with a synthetic
+    // clock, zero for no limit
+    AP_Float speedup;
+
+    // A-frame and winch hardware
+    AP_Float winch_snag;  // chance of a snag on each cast, 0 to 1
+    AP_Int16 pin_bounce;  // contact bounce of the A-frame sensors in ms
     
 	void simstate_send(mavlink_channel_t chan);
 